@@ -6,12 +6,64 @@
 //============================================================================
 
 #include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <chrono>
 #include <climits>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string> // atoi and stoi
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <time.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define ABCU_IO_URING
+#endif
+#endif
+
 #include "CSVparser.hpp"
+#include "abcu_catalog.h"
 
 using namespace std;
 
@@ -21,6 +73,9 @@ using namespace std;
 
 const unsigned int DEFAULT_SIZE = 179;
 
+// marks a node whose course did not come from a mapped CSV row
+const size_t NO_OFFSET = SIZE_MAX;
+
 // forward declarations
 double strToDouble(string str, char ch);
 
@@ -41,388 +96,10108 @@ struct less_than_key {
 };
 
 //============================================================================
-// Hash Table class definition
+// Runtime CPU feature dispatch for vectorized kernels
 //============================================================================
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ABCU_X86_KERNELS 1
+#endif
+
+// instruction set levels a kernel table can be built for
+enum KernelLevel { KERNELS_SCALAR, KERNELS_AVX2, KERNELS_AVX512 };
+
 /**
- * Define a class containing data members and methods to
- * implement a hash table with chaining.
+ * Function table for the hot byte and bitset loops. Every variant of a
+ * kernel returns exactly the same result as the scalar one, only
+ * faster, so the table can be swapped without changing behaviour.
  */
-class HashTable {
+struct Kernels {
+    const char* name;
+    // 32-bit hash of a byte string (course IDs, table buckets)
+    uint32_t (*hash)(const char* data, size_t size);
+    // offset of the first occurrence of a byte, or size (CSV scanning)
+    size_t (*findByte)(const char* data, size_t size, char byte);
+    // equality of two byte strings of the same length (key compare)
+    bool (*keyEquals)(const char* a, const char* b, size_t size);
+    // ASCII case folding in place, other bytes are left alone
+    void (*changeCase)(char* data, size_t size, bool toUpper);
+    // dst |= src over a number of 64-bit words
+    void (*bitsetOr)(uint64_t* dst, const uint64_t* src, size_t words);
+    // true if a has any bit that b does not
+    bool (*bitsetAndNotAny)(const uint64_t* a, const uint64_t* b, size_t words);
+    // number of set bits
+    size_t (*bitsetCount)(const uint64_t* bits, size_t words);
+};
 
-private:
-    // Define structures to hold courses
-    struct Node {
-        Course course;
-        unsigned int key;
-        Node *next;
+// seeds for the eight hash lanes and the per-lane multiplier
+const uint32_t HASH_LANE_SEEDS[8] = {
+    0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du, 0x27D4EB2Fu,
+    0x165667B1u, 0xD3A2646Cu, 0xFD7046C5u, 0xB55A4F09u
+};
+const uint32_t HASH_PRIME = 16777619u;
 
-        // default constructor
-        Node() {
-            key = UINT_MAX;
-            next = nullptr;
+/**
+ * Fold the eight lanes and the bytes after the last 32-byte block into
+ * the final hash. Shared by every hash variant so they agree exactly.
+ */
+uint32_t finishHash(const uint32_t lanes[8], const char* tail, size_t tailSize, size_t size) {
+    uint32_t hash = 2166136261u ^ (uint32_t)size;
+    for (int l = 0; l < 8; l++) {
+        hash = (hash ^ lanes[l]) * HASH_PRIME;
+    }
+    for (size_t i = 0; i < tailSize; i++) {
+        hash = (hash ^ (unsigned char)tail[i]) * HASH_PRIME;
+    }
+    // final avalanche so nearby IDs land in distant buckets
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+uint32_t hashScalar(const char* data, size_t size) {
+    uint32_t lanes[8];
+    memcpy(lanes, HASH_LANE_SEEDS, sizeof(lanes));
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 8; l++) {
+            uint32_t word;
+            memcpy(&word, data + i + 4 * l, sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * HASH_PRIME;
         }
+    }
+    return finishHash(lanes, data + i, size - i, size);
+}
 
-        // initialize with a course
-        Node(Course aCourse) : Node() {
-            course = aCourse;
+size_t findByteScalar(const char* data, size_t size, char byte) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == byte) {
+            return i;
         }
+    }
+    return size;
+}
 
-        // initialize with a course and a key
-        Node(Course aCourse, unsigned int aKey) : Node(aCourse) {
-            key = aKey;
+bool keyEqualsScalar(const char* a, const char* b, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (a[i] != b[i]) {
+            return false;
         }
-    };
+    }
+    return true;
+}
 
-    vector<Node> nodes;
+void changeCaseScalar(char* data, size_t size, bool toUpper) {
+    char first = toUpper ? 'a' : 'A';
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] >= first && data[i] <= first + 25) {
+            data[i] ^= 0x20;
+        }
+    }
+}
 
-    unsigned int tableSize = DEFAULT_SIZE;
+void bitsetOrScalar(uint64_t* dst, const uint64_t* src, size_t words) {
+    for (size_t i = 0; i < words; i++) {
+        dst[i] |= src[i];
+    }
+}
 
-    unsigned int hash(string courseId);
+bool bitsetAndNotAnyScalar(const uint64_t* a, const uint64_t* b, size_t words) {
+    for (size_t i = 0; i < words; i++) {
+        if (a[i] & ~b[i]) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    double loadFactor = 0.0;
+size_t bitsetCountScalar(const uint64_t* bits, size_t words) {
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        // clear the lowest set bit until none are left
+        for (uint64_t word = bits[i]; word != 0; word &= word - 1) {
+            count++;
+        }
+    }
+    return count;
+}
 
-    int numEntries = 0;
+#ifdef ABCU_X86_KERNELS
 
-public:
-    HashTable();
-    HashTable(unsigned int size);
-    virtual ~HashTable();
-    void Insert(Course course);
-    void PrintAll();
-    void Sort(vector<Course>& sortCourses);
-    Course Search(string courseId);
-    void Resize();
-};
+__attribute__((target("avx2")))
+uint32_t hashAvx2(const char* data, size_t size) {
+    __m256i lanes = _mm256_loadu_si256((const __m256i*)HASH_LANE_SEEDS);
+    __m256i prime = _mm256_set1_epi32((int)HASH_PRIME);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i words = _mm256_loadu_si256((const __m256i*)(data + i));
+        lanes = _mm256_mullo_epi32(_mm256_xor_si256(lanes, words), prime);
+    }
+    uint32_t out[8];
+    _mm256_storeu_si256((__m256i*)out, lanes);
+    return finishHash(out, data + i, size - i, size);
+}
 
-/**
- * Default constructor
- */
-HashTable::HashTable() {
-    // Initializes the structures used to hold courses
-    // Initalize node structure by resizing tableSize
-    // Resize nodes list to tableSize
-    nodes.resize(tableSize);
-    // initialize vector nodes full of empty Nodes
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i] = Node();
+__attribute__((target("avx2")))
+size_t findByteAvx2(const char* data, size_t size, char byte) {
+    __m256i needle = _mm256_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
+    return i + findByteScalar(data + i, size - i, byte);
 }
 
-/**
- * Constructor for specifying size of the table
- * Use to improve efficiency of hashing algorithm
- * by reducing collisions without wasting memory.
- */
-HashTable::HashTable(unsigned int size) {
-    // invoke local tableSize to size with this->
-    this->tableSize = size;
-    // resize nodes size
-    nodes.resize(tableSize);
-    // initialize vector nodes full of empty Nodes
-    for (int i = 0; i < nodes.size(); i++) {
-       nodes[i] = Node();
+__attribute__((target("avx512f,avx512bw")))
+size_t findByteAvx512(const char* data, size_t size, char byte) {
+    __m512i needle = _mm512_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m512i block = _mm512_loadu_si512((const void*)(data + i));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(block, needle);
+        if (mask != 0) {
+            return i + __builtin_ctzll(mask);
+        }
+    }
+    return i + findByteAvx2(data + i, size - i, byte);
+}
+
+__attribute__((target("avx2")))
+bool keyEqualsAvx2(const char* a, const char* b, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu) {
+            return false;
+        }
     }
+    return keyEqualsScalar(a + i, b + i, size - i);
 }
 
+__attribute__((target("avx512f,avx512bw")))
+bool keyEqualsAvx512(const char* a, const char* b, size_t size) {
+    // masked loads compare short keys in one step without reading past them
+    for (size_t i = 0; i < size; i += 64) {
+        size_t chunk = min(size - i, size_t(64));
+        __mmask64 live = chunk == 64 ? ~__mmask64(0) : (__mmask64(1) << chunk) - 1;
+        __m512i x = _mm512_maskz_loadu_epi8(live, a + i);
+        __m512i y = _mm512_maskz_loadu_epi8(live, b + i);
+        if (_mm512_cmpneq_epi8_mask(x, y) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
 
-/**
- * Destructor
- */
-HashTable::~HashTable() {
-    // Logic to free storage when class is destroyed
-    Node* current;
-    Node* temp;
+__attribute__((target("avx2")))
+void changeCaseAvx2(char* data, size_t size, bool toUpper) {
+    char first = toUpper ? 'a' : 'A';
+    __m256i below = _mm256_set1_epi8(first - 1);
+    __m256i above = _mm256_set1_epi8(first + 26);
+    __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+        // signed compares leave bytes >= 0x80 out of the letter range
+        __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(block, below), _mm256_cmpgt_epi8(above, block));
+        block = _mm256_xor_si256(block, _mm256_and_si256(letters, flip));
+        _mm256_storeu_si256((__m256i*)(data + i), block);
+    }
+    changeCaseScalar(data + i, size - i, toUpper);
+}
 
-    // For each item in vector nodes (buckets)
-    for (int i = 0; i < nodes.size(); i++) {
-        // current variable points to bucket's node
-        current = &nodes[i];
-        // While current node is not null (pointing to an entry)
-        while (current != nullptr) {
-            // temp points to bucket's node
-            temp = current;
-            // current becomes next node in bucket's linked list
-            current = current->next;
-            // delete the orphan node
-            delete temp;
+__attribute__((target("avx512f,avx512bw")))
+void changeCaseAvx512(char* data, size_t size, bool toUpper) {
+    char first = toUpper ? 'a' : 'A';
+    __m512i below = _mm512_set1_epi8(first - 1);
+    __m512i above = _mm512_set1_epi8(first + 26);
+    __m512i flip = _mm512_set1_epi8(0x20);
+    for (size_t i = 0; i < size; i += 64) {
+        size_t chunk = min(size - i, size_t(64));
+        __mmask64 live = chunk == 64 ? ~__mmask64(0) : (__mmask64(1) << chunk) - 1;
+        __m512i block = _mm512_maskz_loadu_epi8(live, data + i);
+        __mmask64 letters = _mm512_cmpgt_epi8_mask(block, below) & _mm512_cmpgt_epi8_mask(above, block);
+        block = _mm512_xor_si512(block, _mm512_maskz_mov_epi8(letters, flip));
+        _mm512_mask_storeu_epi8(data + i, live, block);
+    }
+}
+
+__attribute__((target("avx2")))
+void bitsetOrAvx2(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(x, y));
+    }
+    bitsetOrScalar(dst + i, src + i, words - i);
+}
+
+__attribute__((target("avx512f")))
+void bitsetOrAvx512(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void*)(dst + i));
+        __m512i y = _mm512_loadu_si512((const void*)(src + i));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_or_si512(x, y));
+    }
+    bitsetOrAvx2(dst + i, src + i, words - i);
+}
+
+__attribute__((target("avx2")))
+bool bitsetAndNotAnyAvx2(const uint64_t* a, const uint64_t* b, size_t words) {
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        // testc is 1 when every bit of x is also set in y
+        if (!_mm256_testc_si256(y, x)) {
+            return true;
         }
     }
+    return bitsetAndNotAnyScalar(a + i, b + i, words - i);
 }
 
-/**
- * Calculate the hash value of a given key.
- * Note that key is specifically defined as
- * unsigned int to prevent undefined results
- * of a negative list index.
- *
- * @param key The key to hash
- * @return The calculated hash
- */
-unsigned int HashTable::hash(string courseId) {
-    // Logic to calculate a hash value
-    unsigned int hash;
-    int key = 0;
-    // Adds ASCII values of all characters in courseID
-    // Then squares
-    for (int i = 0; i < courseId.length(); i++) {
-        key += int(courseId[i]);
-        key *= key;
+__attribute__((target("avx512f")))
+bool bitsetAndNotAnyAvx512(const uint64_t* a, const uint64_t* b, size_t words) {
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void*)(a + i));
+        __m512i y = _mm512_loadu_si512((const void*)(b + i));
+        // x & y differs from x exactly when x has a bit y lacks
+        if (_mm512_cmpneq_epi64_mask(_mm512_and_si512(x, y), x) != 0) {
+            return true;
+        }
     }
+    return bitsetAndNotAnyAvx2(a + i, b + i, words - i);
+}
 
-    // hash variable stores value as it is generated
-    hash = key % nodes.size();
+__attribute__((target("avx2")))
+size_t bitsetCountAvx2(const uint64_t* bits, size_t words) {
+    // per-nibble popcount by table lookup, summed with sad
+    __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(bits + i));
+        __m256i counts = _mm256_add_epi8(
+            _mm256_shuffle_epi8(table, _mm256_and_si256(block, low)),
+            _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(block, 4), low)));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    uint64_t sums[4];
+    _mm256_storeu_si256((__m256i*)sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3] + bitsetCountScalar(bits + i, words - i);
+}
 
-    // return the finalized hash
-    return hash;
+__attribute__((target("avx512f,avx512vpopcntdq")))
+size_t bitsetCountAvx512(const uint64_t* bits, size_t words) {
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512((const void*)(bits + i))));
+    }
+    uint64_t sums[8];
+    _mm512_storeu_si512((void*)sums, total);
+    size_t count = bitsetCountAvx2(bits + i, words - i);
+    for (int l = 0; l < 8; l++) {
+        count += sums[l];
+    }
+    return count;
 }
 
+#endif
+
 /**
- * Insert a course
+ * Kernel table for an instruction set level. AVX-512 has no faster way
+ * to hash short keys than AVX2, and popcount needs VPOPCNTDQ on top of
+ * AVX-512F, so those entries fall back to the AVX2 versions.
  *
- * @param course The course to insert
+ * @param level The level to build the table for
+ * @return The table
  */
-void HashTable::Insert(Course course) {
-    // Logic to insert a course
-    // 
-    // create the key for the given course
-    int key = hash(course.courseId);
-    // retrieve node using key
-    Node* current = &nodes[key];
-    // if no entry found for the key
-    if (current->key == UINT_MAX) {
-        // assign this node to the key position
-        nodes[key] = Node(course, key);
+Kernels kernelsFor(KernelLevel level) {
+    Kernels table = { "scalar", hashScalar, findByteScalar, keyEqualsScalar, changeCaseScalar,
+        bitsetOrScalar, bitsetAndNotAnyScalar, bitsetCountScalar };
+#ifdef ABCU_X86_KERNELS
+    if (level >= KERNELS_AVX2) {
+        table = { "avx2", hashAvx2, findByteAvx2, keyEqualsAvx2, changeCaseAvx2,
+            bitsetOrAvx2, bitsetAndNotAnyAvx2, bitsetCountAvx2 };
     }
-    // else find the next open node
-    else {
-        // While the current node is pointing to something
-        while (current->next != nullptr) {
-            // Move to next node
-            current = current->next;
+    if (level >= KERNELS_AVX512) {
+        table.name = "avx512";
+        table.findByte = findByteAvx512;
+        table.keyEquals = keyEqualsAvx512;
+        table.changeCase = changeCaseAvx512;
+        table.bitsetOr = bitsetOrAvx512;
+        table.bitsetAndNotAny = bitsetAndNotAnyAvx512;
+        if (__builtin_cpu_supports("avx512vpopcntdq")) {
+            table.bitsetCount = bitsetCountAvx512;
         }
-        // Once the current node is not pointing to anything,
-        // Append newNode to bucket's linked list
-        current->next = new Node(course, key);
     }
-    numEntries += 1;
+#endif
+    return table;
+}
 
-    // Check if hash table is sufficient size
-    //Determine load factor
-    loadFactor = double(numEntries) / tableSize;
-    // If the load factor is too great
-    if (loadFactor >= 1.0) {
-        // Resize hash table
-        Resize();
+/**
+ * Highest kernel level this CPU can run
+ */
+KernelLevel detectKernelLevel() {
+#ifdef ABCU_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return KERNELS_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return KERNELS_AVX2;
     }
+#endif
+    return KERNELS_SCALAR;
 }
 
+// kernels in use; scalar until selectKernels runs
+Kernels kernels = kernelsFor(KERNELS_SCALAR);
+
 /**
- * Print all courses
+ * Compare two course IDs with the key compare kernel
  */
-void HashTable::PrintAll() {
-    // Logic to print all courses
-    // First call function to sort hash table
-    vector<Course> sortedCourses;
-    Sort(sortedCourses);
+bool sameId(const string& a, const string& b) {
+    return a.size() == b.size() && kernels.keyEquals(a.data(), b.data(), a.size());
+}
 
-    // Iterate over entire nodes vector
-    for (int i = 0; i < sortedCourses.size(); i++) {
-        // Output course information
-        cout << " " << sortedCourses[i].courseId << ", " 
-            << sortedCourses[i].courseTitle << endl;
+/**
+ * Bind every kernel to its best implementation for this CPU. A
+ * requested level ("scalar", "avx2" or "avx512") can only lower the
+ * choice, so forcing scalar works on any host. With no request the
+ * ABCU_KERNELS environment variable is honoured the same way.
+ *
+ * @param requested The level to cap at, or empty for the best
+ * @return false if the level named is not one of the three; the best
+ *         kernels are bound anyway
+ */
+bool selectKernels(string requested) {
+    KernelLevel level = detectKernelLevel();
+    if (requested.empty() && getenv("ABCU_KERNELS") != nullptr) {
+        requested = getenv("ABCU_KERNELS");
+    }
+    bool known = requested.empty() || requested == "scalar" || requested == "avx2" || requested == "avx512";
+    if (requested == "scalar") {
+        level = KERNELS_SCALAR;
+    }
+    else if (requested == "avx2") {
+        level = min(level, KERNELS_AVX2);
     }
+    kernels = kernelsFor(level);
+    return known;
 }
 
-void HashTable::Sort(vector<Course> &sortCourses)
-{
-    // Create new vector that isolates all courses
-    for (int i = 0; i < nodes.size(); i++) {
-        if (nodes[i].key != UINT_MAX) {
-            sortCourses.push_back(nodes[i].course);
-            Node* current = nodes[i].next;
-            while (current != nullptr) {
-                sortCourses.push_back(current->course);
-                current = current->next;
-            }
-        }
-    }
+//============================================================================
+// Batched file reads
+//============================================================================
 
-    // Sort vector of courses
-    sort(sortCourses.begin(), sortCourses.end(), less_than_key());
-}
+// bytes per read, and the most reads kept in flight at once
+const size_t READ_BLOCK_BYTES = 1 << 20;
+const int READ_QUEUE_DEPTH = 32;
 
 /**
- * Search for the specified courseId
- *
- * @param courseId The course ID to search for
+ * Reads a list of files front to back with many large reads in flight
+ * at once, so the device sees a deep queue instead of one blocking read
+ * at a time. Reads go through an io_uring set up with raw system calls
+ * where the kernel offers one. Elsewhere, or when the ring cannot be
+ * set up, the blocks ahead are announced with posix_fadvise so the
+ * kernel reads them in the background, and each is then taken with
+ * pread. Blocks are handed over in file order either way, whatever
+ * order the device completes them in.
  */
-Course HashTable::Search(string courseId) {
-    // Create empty course
-    Course course;
+class BatchedReader {
 
-    // Logic to search for and return a bid
+public:
+    // receives each block in order; size 0 marks the end of a file
+    typedef function<void(int file, const char* data, size_t size)> Sink;
 
-    // create the key for the given course
-    int key = hash(courseId);
+private:
+    struct Slot {
+        int file = 0;
+        uint64_t offset = 0;
+        size_t length = 0;
+        long long result = 0;
+        bool done = false;
+        vector<char> buffer;
+    };
 
-    // retrieve node using key
-    Node* current = &nodes[key];
+    size_t blockBytes;
+    int depth;
+    bool ring = false;
+    string failed;
+    size_t reads = 0;
+    int mostInFlight = 0;
 
-    // if no entry found for the key
-    if (current->key == UINT_MAX) {
-        // return course
-        return course;
-    }
+#ifdef ABCU_IO_URING
+    int ringFd = -1;
+    void* sqMap = nullptr;
+    size_t sqMapSize = 0;
+    void* cqMap = nullptr;
+    size_t cqMapSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0;
+    unsigned inFlight = 0;
 
-    // if entry found for the key and courseId matches
-    if (current->course.courseId == courseId) {
-        //return node course
-        return current->course;
+    bool SetUpRing();
+    void TearDownRing();
+    void Reap(vector<Slot>& slots, bool wait);
+#endif
+
+    bool Finish(int fd, Slot& slot);
+
+public:
+    BatchedReader(bool useRing = true, size_t blockBytes = READ_BLOCK_BYTES, int depth = READ_QUEUE_DEPTH);
+    virtual ~BatchedReader();
+    bool Read(const vector<string>& paths, Sink sink);
+    // true if reads went through io_uring
+    bool Ring() const { return ring; }
+    // the file that could not be opened or read, after Read fails
+    string Failed() const { return failed; }
+    size_t Reads() const { return reads; }
+    int MostInFlight() const { return mostInFlight; }
+};
+
+/**
+ * Constructor
+ *
+ * @param useRing false to skip io_uring and use the pread path
+ * @param blockBytes Bytes per read
+ * @param depth Most reads in flight, which is also how many block
+ *        buffers are allocated
+ */
+BatchedReader::BatchedReader(bool useRing, size_t blockBytes, int depth) : blockBytes(blockBytes), depth(depth) {
+#ifdef ABCU_IO_URING
+    ring = useRing && SetUpRing();
+#endif
+}
+
+/**
+ * Destructor
+ */
+BatchedReader::~BatchedReader() {
+#ifdef ABCU_IO_URING
+    TearDownRing();
+#endif
+}
+
+#ifdef ABCU_IO_URING
+/**
+ * Create the ring and map its queues. Kernels without io_uring, or
+ * sandboxes that filter it, fail here and the pread path is used.
+ *
+ * @return true if the ring is ready
+ */
+bool BatchedReader::SetUpRing() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = int(syscall(__NR_io_uring_setup, unsigned(depth), &params));
+    if (ringFd < 0) {
+        ringFd = -1;
+        return false;
     }
-    // while node not equal to nullptr
-    while (current->next != nullptr) {
-        // if the current node matches, return it
-        if (current->next->course.courseId == courseId) {
-            return current->next->course;
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    // newer kernels share one mapping between both queues
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqMapSize = cqMapSize = max(sqMapSize, cqMapSize);
+    }
+    sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        sqMap = nullptr;
+        TearDownRing();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqMap = sqMap;
+    }
+    else {
+        cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+            IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) {
+            cqMap = nullptr;
+            TearDownRing();
+            return false;
         }
-        //node is equal to next node
-        current = current->next;
     }
-    // Otherwise, no match found, return empty course
-    return course;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* entries = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+        IORING_OFF_SQES);
+    if (entries == MAP_FAILED) {
+        TearDownRing();
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(entries);
+    char* sq = static_cast<char*>(sqMap);
+    char* cq = static_cast<char*>(cqMap);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
 }
 
-/** 
-* Checks load factor of hash table,
-* resizes if necessary by doubling size
-* then finding next prime
-*/
-void HashTable::Resize() {
-    
-    // Create temporary vector to copy existing hash table
-    vector<Node> temp = nodes;
-    // Initialize newSize with double current size
-    unsigned int newSize = tableSize * 2;
-    // Initialize isPrime boolean to false
-    bool isPrime = false;
-    // While newSize is not a prime number
-    while (!isPrime) {
-        // For loop that checks newSize for remainders
-        for (int i = 2; i <= newSize / 2; ++i) {
-            // If newSize is evenly divisible
-            if (newSize % i == 0) {
-                // Increment newSize
-                newSize += 1;
-                // Jump to new iteration of while loop
+/**
+ * Unmap the queues and close the ring
+ */
+void BatchedReader::TearDownRing() {
+    if (sqes != nullptr) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqMap != nullptr && cqMap != sqMap) {
+        munmap(cqMap, cqMapSize);
+    }
+    if (sqMap != nullptr) {
+        munmap(sqMap, sqMapSize);
+    }
+    if (ringFd >= 0) {
+        close(ringFd);
+    }
+    sqes = nullptr;
+    sqMap = cqMap = nullptr;
+    ringFd = -1;
+}
+
+/**
+ * Submit queued reads and collect whatever has completed
+ *
+ * @param slots Slots indexed by each read's user_data
+ * @param wait true to block until at least one read completes
+ */
+void BatchedReader::Reap(vector<Slot>& slots, bool wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (unsubmitted > 0 || wait) {
+        long entered = syscall(__NR_io_uring_enter, ringFd, unsubmitted, wait ? 1u : 0u, flags, nullptr, 0);
+        if (entered >= 0) {
+            unsubmitted -= min(unsubmitted, unsigned(entered));
+        }
+    }
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const io_uring_cqe& completion = cqes[head & *cqMask];
+        Slot& slot = slots[completion.user_data];
+        slot.result = completion.res;
+        slot.done = true;
+        inFlight--;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+ * Complete a block with pread, after a short or failed ring read or
+ * on the fallback path
+ *
+ * @return false if the file could not be read
+ */
+bool BatchedReader::Finish(int fd, Slot& slot) {
+#ifndef _WIN32
+    size_t got = slot.result > 0 ? size_t(slot.result) : 0;
+    while (got < slot.length) {
+        ssize_t more = pread(fd, slot.buffer.data() + got, slot.length - got, off_t(slot.offset + got));
+        if (more < 0 && errno == EINTR) {
+            continue;
+        }
+        if (more <= 0) {
+            return false;
+        }
+        got += size_t(more);
+    }
+    slot.result = (long long)got;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Read every file in order and hand its contents to sink block by
+ * block. Reads for the next file start before the current one ends, so
+ * a list of small files keeps the queue as deep as one large file.
+ *
+ * @param paths The files to read
+ * @param sink Called on this thread for each block and file end
+ * @return false if a file could not be opened or read; Failed names it
+ */
+bool BatchedReader::Read(const vector<string>& paths, Sink sink) {
+    failed.clear();
+#ifdef _WIN32
+    vector<char> buffer(blockBytes);
+    for (int i = 0; i < paths.size(); i++) {
+        ifstream in(paths[i].c_str(), ios::binary);
+        if (!in.is_open()) {
+            failed = paths[i];
+            return false;
+        }
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+            reads++;
+            sink(i, buffer.data(), size_t(in.gcount()));
+        }
+        sink(i, nullptr, 0);
+    }
+    return true;
+#else
+    vector<int> fds(paths.size(), -1);
+    vector<uint64_t> sizes(paths.size(), 0);
+    bool ok = true;
+    for (size_t i = 0; ok && i < paths.size(); i++) {
+        struct stat info;
+        fds[i] = open(paths[i].c_str(), O_RDONLY);
+        if (fds[i] < 0 || fstat(fds[i], &info) != 0) {
+            failed = paths[i];
+            ok = false;
+            break;
+        }
+        sizes[i] = uint64_t(info.st_size);
+        posix_fadvise(fds[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    vector<Slot> slots(depth);
+    for (int i = 0; i < depth; i++) {
+        slots[i].buffer.resize(blockBytes);
+    }
+    // reads are numbered in file order; read n lives in slot n % depth
+    size_t submitted = 0;
+    size_t delivered = 0;
+    int nextFile = 0;
+    uint64_t nextOffset = 0;
+    int endedFiles = 0;
+    while (ok) {
+        while (submitted - delivered < size_t(depth) && nextFile < int(paths.size())) {
+            if (nextOffset >= sizes[nextFile]) {
+                nextFile++;
+                nextOffset = 0;
                 continue;
             }
+            Slot& slot = slots[submitted % depth];
+            slot.file = nextFile;
+            slot.offset = nextOffset;
+            slot.length = size_t(min(uint64_t(blockBytes), sizes[nextFile] - nextOffset));
+            slot.result = 0;
+            slot.done = false;
+#ifdef ABCU_IO_URING
+            if (ring) {
+                unsigned tail = *sqTail;
+                unsigned index = tail & *sqMask;
+                io_uring_sqe& entry = sqes[index];
+                memset(&entry, 0, sizeof(entry));
+                entry.opcode = IORING_OP_READ;
+                entry.fd = fds[nextFile];
+                entry.addr = (uint64_t)(uintptr_t)slot.buffer.data();
+                entry.len = unsigned(slot.length);
+                entry.off = nextOffset;
+                entry.user_data = submitted % depth;
+                sqArray[index] = index;
+                __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+                unsubmitted++;
+                inFlight++;
+            }
+#endif
+            if (!ring) {
+                // start the kernel reading it now; pread collects it later
+                posix_fadvise(fds[nextFile], off_t(nextOffset), off_t(slot.length), POSIX_FADV_WILLNEED);
+            }
+            nextOffset += slot.length;
+            submitted++;
+            reads++;
+            mostInFlight = max(mostInFlight, int(submitted - delivered));
         }
-        // newSize not divisible, so is a prime number
-        isPrime = true;
+        if (submitted == delivered) {
+            break;
+        }
+
+        Slot& next = slots[delivered % depth];
+#ifdef ABCU_IO_URING
+        while (ring && !next.done) {
+            Reap(slots, true);
+        }
+#endif
+        if (!Finish(fds[next.file], next)) {
+            failed = paths[next.file];
+            ok = false;
+            break;
+        }
+        for (; endedFiles < next.file; endedFiles++) {
+            sink(endedFiles, nullptr, 0);
+        }
+        sink(next.file, next.buffer.data(), size_t(next.result));
+        delivered++;
+#ifdef ABCU_IO_URING
+        // pick up anything else already finished without blocking
+        if (ring && unsubmitted > 0) {
+            Reap(slots, false);
+        }
+#endif
     }
-    // resize tableSize
-    tableSize = newSize;
-    // resize nodes size
-    nodes.resize(tableSize);
-    // initialize new vector nodes full of empty Nodes
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i] = Node();
+#ifdef ABCU_IO_URING
+    // after a failure, reads still in flight land in these buffers
+    while (ring && inFlight > 0) {
+        Reap(slots, true);
     }
-    // Reset numEntries so entries are not counted twice
-    numEntries = 0;
-    Node* tempNode;
-    // Fill new vector with existing entries
-    for (int i = 0; i < temp.size(); i++) {
-        if (temp[i].key != UINT_MAX) {
-            Insert(temp[i].course);
-            tempNode = temp[i].next;
-            while (tempNode != nullptr) {
-                Insert(tempNode->course);
-                tempNode = tempNode->next;
+#endif
+    for (; ok && endedFiles < int(paths.size()); endedFiles++) {
+        sink(endedFiles, nullptr, 0);
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    return ok;
+#endif
+}
+
+//============================================================================
+// Memory-mapped CSV source
+//============================================================================
+
+/**
+ * Read-only view of a whole CSV file. On POSIX hosts the file is
+ * mapped with mmap so untouched rows never become resident; elsewhere
+ * the file is read into a heap buffer once.
+ */
+class MappedFile {
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    long long modified = 0; // nanoseconds since the epoch
+    bool mapped = false;
+    vector<char> buffer;
+
+public:
+    MappedFile() { }
+    virtual ~MappedFile();
+    bool Open(string path);
+    bool Read(string path);
+    void Close();
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    long long Modified() const { return modified; }
+};
+
+/**
+ * Destructor
+ */
+MappedFile::~MappedFile() {
+    Close();
+}
+
+/**
+ * Map the given file into memory
+ *
+ * @param path The path of the file to map
+ * @return true if the file contents are available
+ */
+bool MappedFile::Open(string path) {
+    Close();
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    size = size_t(info.st_size);
+    modified = (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    // mmap refuses zero-length mappings, an empty file has no rows anyway
+    if (size > 0) {
+        void* region = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (region == MAP_FAILED) {
+            close(fd);
+            size = 0;
+            return false;
+        }
+        // rows are visited front to back during the index scan
+        madvise(region, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(region);
+        mapped = true;
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    return true;
+#else
+    ifstream in(path.c_str(), ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+#endif
+}
+
+/**
+ * Read the whole file into the heap buffer with batched reads instead
+ * of mapping it, for a file consumed in full straight away. A cold
+ * mapping faults its pages in a few at a time; this keeps many large
+ * reads in flight. Modified is not filled in.
+ *
+ * @param path The path of the file to read
+ * @return true if the file contents are available
+ */
+bool MappedFile::Read(string path) {
+    Close();
+    BatchedReader reader;
+    bool ok = reader.Read(vector<string>(1, path), [this](int, const char* block, size_t length) {
+        buffer.insert(buffer.end(), block, block + length);
+    });
+    if (!ok) {
+        buffer.clear();
+        return false;
+    }
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
+
+/**
+ * Release the mapping or buffer
+ */
+void MappedFile::Close() {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(const_cast<char*>(data), size);
+    }
+#endif
+    buffer.clear();
+    data = nullptr;
+    size = 0;
+    modified = 0;
+    mapped = false;
+}
+
+/**
+ * Find the end of the line starting at offset
+ *
+ * @param data The mapped file contents
+ * @param size Number of bytes in data
+ * @param offset Byte offset of the start of the line
+ * @return Offset of the newline, or size if the file ends first
+ */
+size_t findLineEnd(const char* data, size_t size, size_t offset) {
+    return offset + kernels.findByte(data + offset, size - offset, '\n');
+}
+
+/**
+ * Where the fields of a row stop: its newline, less a carriage return
+ * from a file written with Windows line endings
+ *
+ * @param end Offset of the row's newline, from findLineEnd
+ */
+size_t csvRowLast(const char* data, size_t offset, size_t end) {
+    return end > offset && data[end - 1] == '\r' ? end - 1 : end;
+}
+
+/**
+ * Read one CSV field. A quoted field may hold commas and doubled
+ * quotes, like the rows csv::Parser accepts.
+ *
+ * @param data The mapped file contents
+ * @param offset Byte offset of the start of the field
+ * @param last Offset the row's fields stop at, from csvRowLast
+ * @param field Receives the field, unquoted
+ * @return Offset of the comma after the field, or last
+ */
+size_t parseCsvField(const char* data, size_t offset, size_t last, string& field) {
+    field.clear();
+    bool quoted = false;
+    size_t i = offset;
+    for (; i < last; i++) {
+        char ch = data[i];
+        if (ch == '"') {
+            // a doubled quote inside a quoted field is a literal quote
+            if (quoted && i + 1 < last && data[i + 1] == '"') {
+                field.push_back('"');
+                i++;
             }
+            else {
+                quoted = !quoted;
+            }
+        }
+        else if (ch == ',' && !quoted) {
+            break;
+        }
+        else {
+            field.push_back(ch);
         }
     }
-    return;
+    return i;
+}
+
+/**
+ * Split one CSV row into its fields with parseCsvField
+ *
+ * @param data The mapped file contents
+ * @param size Number of bytes in data
+ * @param offset Byte offset of the start of the row
+ * @param fields Receives the fields of the row
+ * @return Offset of the first byte of the next row
+ */
+size_t parseCsvRow(const char* data, size_t size, size_t offset, vector<string>& fields) {
+    fields.clear();
+    size_t end = findLineEnd(data, size, offset);
+    size_t last = csvRowLast(data, offset, end);
+
+    string field;
+    for (size_t i = offset; ; i++) {
+        i = parseCsvField(data, i, last, field);
+        fields.push_back(field);
+        if (i >= last) {
+            break;
+        }
+    }
+
+    return end < size ? end + 1 : size;
 }
 
 //============================================================================
-// Static methods used for testing
+// Sidecar offset index
 //============================================================================
 
+// identifies a sidecar offset index file and its layout version; 2
+// stores IDs unquoted, so files from version 1 are rebuilt
+const char OFFSET_INDEX_MAGIC[8] = { 'A', 'B', 'C', 'U', 'I', 'D', 'X', '2' };
+
+// bytes hashed from each sampled region of the CSV
+const size_t SAMPLE_PAGE = 4096;
+const size_t SAMPLE_PAGES = 64;
+
+// one indexed row: the course ID and where its row starts
+struct OffsetIndexEntry {
+    string courseId;
+    size_t offset;
+};
+
 /**
- * Display the course information to the console (std::out)
+ * 64-bit FNV-1a hash of a byte range
  *
- * @param course struct containing the course info
+ * @param data The bytes to hash
+ * @param size Number of bytes
+ * @param seed Running hash to continue from
+ * @return The updated hash
  */
-void displayCourse(Course course) {
-    // output key, courseID, courseTitle, and any prerequisites
-    cout << " " << course.courseId << ", " << course.courseTitle << endl;
-    cout << " Prerequisites: ";
-    for (int i = 0; i < course.prerequisites.size(); i++)
-    {
-        cout << course.prerequisites[i];
-        // If not the last item in the list, print comma
-        if ((i + 1) != course.prerequisites.size()) {
-            cout << ", ";
-        }
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Content hash used to detect a changed CSV without reading all of it.
+ * Hashes the first and last pages plus evenly spaced pages in between,
+ * so the check stays constant time for multi-GB files. Size and mtime
+ * catch the edits that sampling could miss.
+ *
+ * @param data The mapped file contents
+ * @param size Number of bytes in data
+ * @return The sampled hash
+ */
+uint64_t sampleFileHash(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    // small files are hashed in full
+    if (size <= SAMPLE_PAGE * (SAMPLE_PAGES + 2)) {
+        return hashBytes(data, size, hash);
+    }
+    hash = hashBytes(data, SAMPLE_PAGE, hash);
+    size_t stride = (size - 2 * SAMPLE_PAGE) / SAMPLE_PAGES;
+    for (size_t i = 0; i < SAMPLE_PAGES; i++) {
+        hash = hashBytes(data + SAMPLE_PAGE + i * stride, SAMPLE_PAGE, hash);
+    }
+    return hashBytes(data + size - SAMPLE_PAGE, SAMPLE_PAGE, hash);
+}
+
+/**
+ * Sidecar path for a CSV file
+ *
+ * @param csvPath the path to the CSV file
+ * @return the path of its offset index
+ */
+string offsetIndexPath(string csvPath) {
+    return csvPath + ".idx";
+}
+
+/**
+ * Read a sidecar offset index, if it still describes the CSV.
+ *
+ * Layout: magic, CSV size, CSV mtime, sampled content hash, entry
+ * count, then per entry a 2-byte ID length, the ID and an 8-byte
+ * row offset. All integers are in host byte order.
+ *
+ * @param idxPath the path of the sidecar
+ * @param csv the mapped CSV the index must match
+ * @param entries Receives the indexed rows
+ * @return true if the index was valid for this CSV
+ */
+bool readOffsetIndex(string idxPath, const MappedFile& csv, vector<OffsetIndexEntry>& entries) {
+    MappedFile index;
+    if (!index.Open(idxPath)) {
+        return false;
+    }
+    const char* data = index.Data();
+    size_t size = index.Size();
+    uint64_t header[4];
+    if (size < sizeof(OFFSET_INDEX_MAGIC) + sizeof(header)
+        || memcmp(data, OFFSET_INDEX_MAGIC, sizeof(OFFSET_INDEX_MAGIC)) != 0) {
+        return false;
+    }
+    size_t pos = sizeof(OFFSET_INDEX_MAGIC);
+    memcpy(header, data + pos, sizeof(header));
+    pos += sizeof(header);
+
+    // any change to the CSV means the offsets can no longer be trusted
+    if (header[0] != csv.Size() || header[1] != (uint64_t)csv.Modified()
+        || header[2] != sampleFileHash(csv.Data(), csv.Size())) {
+        return false;
+    }
+
+    entries.clear();
+    entries.reserve(header[3]);
+    for (uint64_t i = 0; i < header[3]; i++) {
+        uint16_t length;
+        uint64_t offset;
+        if (pos + sizeof(length) > size) {
+            return false;
+        }
+        memcpy(&length, data + pos, sizeof(length));
+        pos += sizeof(length);
+        if (pos + length + sizeof(offset) > size) {
+            return false;
+        }
+        OffsetIndexEntry entry;
+        entry.courseId.assign(data + pos, length);
+        pos += length;
+        memcpy(&offset, data + pos, sizeof(offset));
+        pos += sizeof(offset);
+        if (offset >= csv.Size()) {
+            return false;
+        }
+        entry.offset = size_t(offset);
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+/**
+ * Write the sidecar offset index for a CSV. The file is written under a
+ * temporary name and renamed so readers never see a partial index.
+ *
+ * @param idxPath the path of the sidecar
+ * @param csv the mapped CSV the index describes
+ * @param entries The indexed rows
+ * @return true if the index was written; false as well if an ID is too
+ *         long for its 2-byte length, when no index is written
+ */
+bool writeOffsetIndex(string idxPath, const MappedFile& csv, const vector<OffsetIndexEntry>& entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].courseId.size() > UINT16_MAX) {
+            return false;
+        }
+    }
+    string tempPath = idxPath + ".tmp";
+    ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    uint64_t header[4];
+    header[0] = csv.Size();
+    header[1] = (uint64_t)csv.Modified();
+    header[2] = sampleFileHash(csv.Data(), csv.Size());
+    header[3] = entries.size();
+    out.write(OFFSET_INDEX_MAGIC, sizeof(OFFSET_INDEX_MAGIC));
+    out.write((const char*)header, sizeof(header));
+    for (size_t i = 0; i < entries.size(); i++) {
+        uint16_t length = (uint16_t)entries[i].courseId.size();
+        uint64_t offset = entries[i].offset;
+        out.write((const char*)&length, sizeof(length));
+        out.write(entries[i].courseId.data(), length);
+        out.write((const char*)&offset, sizeof(offset));
+    }
+    out.close();
+    if (out.fail()) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return rename(tempPath.c_str(), idxPath.c_str()) == 0;
+}
+
+//============================================================================
+// Title compression with a static symbol table
+//============================================================================
+
+// code that introduces a literal byte not covered by any symbol
+const unsigned char TITLE_ESCAPE = 255;
+// longest byte sequence a single code can stand for
+const unsigned int MAX_SYMBOL_LENGTH = 8;
+// titles looked at while training the symbol table
+const unsigned int TITLE_SAMPLE_SIZE = 4096;
+
+/**
+ * FSST-style compressor for course titles. Up to 255 symbols of 1 to 8
+ * bytes ("Introduction to", "Programming" split into a few symbols) are
+ * learned once from a sample of titles. Every title is then encoded on
+ * its own as one code per symbol, so any single title can be decoded
+ * without touching the others.
+ */
+class TitleCodec {
+
+private:
+    // symbol bytes by code
+    vector<string> symbols;
+    // codes of the symbols starting with each byte, longest first
+    vector<unsigned char> byFirstByte[256];
+
+    int Match(const char* text, size_t length) const;
+    void Index();
+
+public:
+    void Train(const vector<string>& titles);
+    string Encode(const string& title) const;
+    void DecodeAppend(const string& encoded, string& out) const;
+    size_t SymbolCount() const { return symbols.size(); }
+};
+
+/**
+ * Longest symbol matching the start of text
+ *
+ * @return The symbol's code, or -1 if only an escape will do
+ */
+int TitleCodec::Match(const char* text, size_t length) const {
+    const vector<unsigned char>& candidates = byFirstByte[(unsigned char)text[0]];
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const string& symbol = symbols[candidates[i]];
+        if (symbol.size() <= length && memcmp(symbol.data(), text, symbol.size()) == 0) {
+            return candidates[i];
+        }
+    }
+    return -1;
+}
+
+/**
+ * Rebuild the first-byte lookup after the symbols change
+ */
+void TitleCodec::Index() {
+    for (int b = 0; b < 256; b++) {
+        byFirstByte[b].clear();
+    }
+    for (size_t code = 0; code < symbols.size(); code++) {
+        byFirstByte[(unsigned char)symbols[code][0]].push_back((unsigned char)code);
+    }
+    for (int b = 0; b < 256; b++) {
+        sort(byFirstByte[b].begin(), byFirstByte[b].end(), [this](unsigned char x, unsigned char y) {
+            return symbols[x].size() > symbols[y].size();
+        });
+    }
+}
+
+/**
+ * Learn the symbol table. Each round encodes the sample with the
+ * current table, then keeps the 255 candidates with the highest gain
+ * (bytes covered), where candidates are the symbols and literals used
+ * plus every adjacent pair of them that still fits in 8 bytes.
+ *
+ * @param titles Sample titles to learn from
+ */
+void TitleCodec::Train(const vector<string>& titles) {
+    symbols.clear();
+    Index();
+    for (int round = 0; round < 5; round++) {
+        map<string, size_t> gain;
+        for (size_t t = 0; t < titles.size(); t++) {
+            const string& title = titles[t];
+            string previous;
+            size_t i = 0;
+            while (i < title.size()) {
+                int code = Match(title.data() + i, title.size() - i);
+                string token = code >= 0 ? symbols[code] : title.substr(i, 1);
+                i += token.size();
+                gain[token] += token.size();
+                if (!previous.empty() && previous.size() + token.size() <= MAX_SYMBOL_LENGTH) {
+                    gain[previous + token] += previous.size() + token.size();
+                }
+                previous = token;
+            }
+        }
+
+        // keep the candidates that cover the most bytes
+        vector<pair<size_t, string>> ranked;
+        for (map<string, size_t>::iterator it = gain.begin(); it != gain.end(); ++it) {
+            ranked.push_back(make_pair(it->second, it->first));
+        }
+        sort(ranked.begin(), ranked.end(), [](const pair<size_t, string>& a, const pair<size_t, string>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+        symbols.clear();
+        for (size_t i = 0; i < ranked.size() && symbols.size() < TITLE_ESCAPE; i++) {
+            symbols.push_back(ranked[i].second);
+        }
+        Index();
+    }
+}
+
+/**
+ * Compress one title
+ *
+ * @param title The plain title
+ * @return One byte per symbol, escapes followed by their literal
+ */
+string TitleCodec::Encode(const string& title) const {
+    string encoded;
+    encoded.reserve(title.size());
+    size_t i = 0;
+    while (i < title.size()) {
+        int code = Match(title.data() + i, title.size() - i);
+        if (code >= 0) {
+            encoded.push_back((char)code);
+            i += symbols[code].size();
+        }
+        else {
+            encoded.push_back((char)TITLE_ESCAPE);
+            encoded.push_back(title[i]);
+            i += 1;
+        }
+    }
+    encoded.shrink_to_fit();
+    return encoded;
+}
+
+/**
+ * Decompress one title onto the end of an output buffer
+ *
+ * @param encoded The compressed title
+ * @param out The buffer to append to
+ */
+void TitleCodec::DecodeAppend(const string& encoded, string& out) const {
+    for (size_t i = 0; i < encoded.size(); i++) {
+        unsigned char code = (unsigned char)encoded[i];
+        if (code == TITLE_ESCAPE) {
+            i += 1;
+            out.push_back(encoded[i]);
+        }
+        else {
+            out.append(symbols[code]);
+        }
+    }
+}
+
+//============================================================================
+// Title collation keys
+//============================================================================
+
+// orders PrintAll and ExportCsv can list courses in
+enum CourseOrder { BY_ID, BY_TITLE };
+
+/**
+ * Normalized sort key for a title: lower case, runs of spaces collapsed
+ * and a leading "a", "an" or "the" dropped, so "The Art of Proof" files
+ * under "art of proof".
+ *
+ * @param title The plain title
+ * @return The collation key
+ */
+string titleSortKey(const string& title) {
+    string key;
+    key.reserve(title.size());
+    for (size_t i = 0; i < title.size(); i++) {
+        unsigned char ch = title[i];
+        if (isspace(ch)) {
+            if (!key.empty() && key.back() != ' ') {
+                key.push_back(' ');
+            }
+        }
+        else {
+            key.push_back(ch);
+        }
+    }
+    if (!key.empty() && key.back() == ' ') {
+        key.pop_back();
+    }
+    kernels.changeCase(&key[0], key.size(), false);
+    const char* articles[] = { "the ", "an ", "a " };
+    for (int i = 0; i < 3; i++) {
+        size_t length = strlen(articles[i]);
+        // keep the article if it is the whole title
+        if (key.size() > length && key.compare(0, length, articles[i]) == 0) {
+            key.erase(0, length);
+            break;
+        }
+    }
+    return key;
+}
+
+/**
+ * Split a title's collation key into a big-endian integer of its first
+ * 8 bytes and the remaining bytes. Comparing the integers first and the
+ * rest only on a tie gives the same order as comparing whole keys.
+ *
+ * @param title The plain title
+ * @param prefix Receives the integer prefix
+ * @param rest Receives the bytes after the first 8
+ */
+void setTitleKey(const string& title, uint64_t& prefix, string& rest) {
+    string key = titleSortKey(title);
+    prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (i < key.size()) {
+            prefix |= (unsigned char)key[i];
+        }
+    }
+    rest = key.size() > 8 ? key.substr(8) : string();
+}
+
+//============================================================================
+// Operational metrics
+//============================================================================
+
+// counters summed over every thread
+enum MetricCounter {
+    LOOKUP_HITS,
+    LOOKUP_MISSES,
+    BODY_HITS,
+    BODY_MISSES,
+    EVICTIONS,
+    RESIZES,
+    SERVER_REQUESTS,
+    SERVER_CONNECTIONS,
+    SERVER_REJECTIONS,
+    METRIC_COUNTERS
+};
+
+// latency histograms summed over every thread
+enum MetricHistogram {
+    LOOKUP_SECONDS,
+    RESIZE_SECONDS,
+    SERVER_SECONDS,
+    SERVER_EXPENSIVE_SECONDS,
+    METRIC_HISTOGRAMS
+};
+
+// values the owning thread publishes as a whole
+enum MetricGauge {
+    TABLE_ENTRIES,
+    TABLE_BUCKETS,
+    TABLE_LOAD_FACTOR,
+    BUCKET_BYTES,
+    RESIDENT_BODY_BYTES,
+    BODY_BUDGET_BYTES,
+    PREFIX_INDEX_READY,
+    SIMILAR_INDEX_READY,
+    DEPENDENCY_INDEX_READY,
+    NATURAL_INDEX_READY,
+    METRIC_GAUGES
+};
+
+// upper bounds of the histogram buckets in nanoseconds, before +Inf
+const int HISTOGRAM_BOUNDS = 12;
+const uint64_t LOOKUP_BOUNDS[HISTOGRAM_BOUNDS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+const uint64_t RESIZE_BOUNDS[HISTOGRAM_BOUNDS] = {
+    10000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    25000000, 100000000, 1000000000, 10000000000ULL
+};
+
+/**
+ * One thread's metrics. Only the owning thread writes a shard, so each
+ * update is a relaxed load and store of its own cache lines: no locked
+ * instruction and no sharing with other threads. Readers may see a
+ * slightly stale total, which is all a scrape needs.
+ */
+struct alignas(64) MetricShard {
+    atomic<uint64_t> counters[METRIC_COUNTERS];
+    atomic<uint64_t> buckets[METRIC_HISTOGRAMS][HISTOGRAM_BOUNDS + 1];
+    atomic<uint64_t> sumNanos[METRIC_HISTOGRAMS];
+    // the core a server thread is pinned to, -1 for other threads
+    atomic<int> core;
+
+    MetricShard() : core(-1) {
+        for (int i = 0; i < METRIC_COUNTERS; i++) {
+            counters[i].store(0, memory_order_relaxed);
+        }
+        for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+            for (int b = 0; b <= HISTOGRAM_BOUNDS; b++) {
+                buckets[h][b].store(0, memory_order_relaxed);
+            }
+            sumNanos[h].store(0, memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * Process-wide metrics in per-thread shards. A thread registers its
+ * shard on first use, the only time the lock is taken; rendering sums
+ * the shards into Prometheus text exposition format.
+ */
+class Metrics {
+
+private:
+    mutex shardsLock;
+    // shards outlive their threads so finished work stays counted
+    vector<MetricShard*> shards;
+    atomic<double> gauges[METRIC_GAUGES];
+
+    MetricShard& Local();
+    static void Add(atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+public:
+    Metrics();
+    void Count(MetricCounter counter, uint64_t amount = 1) {
+        Add(Local().counters[counter], amount);
+    }
+    void Observe(MetricHistogram histogram, uint64_t nanos);
+    void SetGauge(MetricGauge gauge, double value) {
+        gauges[gauge].store(value, memory_order_relaxed);
+    }
+    void SetCore(int core) {
+        Local().core.store(core, memory_order_relaxed);
+    }
+    void CoreCounts(MetricCounter counter, map<int, uint64_t>& counts);
+    void Render(string& out);
+};
+
+// set once at startup, before any worker thread; off costs one branch
+bool metricsEnabled = false;
+Metrics metrics;
+
+Metrics::Metrics() {
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        gauges[i].store(0.0, memory_order_relaxed);
+    }
+}
+
+/**
+ * The calling thread's shard, registered on first use
+ */
+MetricShard& Metrics::Local() {
+    thread_local MetricShard* shard = nullptr;
+    if (shard == nullptr) {
+        shard = new MetricShard();
+        lock_guard<mutex> guard(shardsLock);
+        shards.push_back(shard);
+    }
+    return *shard;
+}
+
+/**
+ * Record one duration in a histogram
+ */
+void Metrics::Observe(MetricHistogram histogram, uint64_t nanos) {
+    const uint64_t* bounds = histogram == RESIZE_SECONDS || histogram == SERVER_EXPENSIVE_SECONDS ? RESIZE_BOUNDS
+        : LOOKUP_BOUNDS;
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BOUNDS && nanos > bounds[bucket]) {
+        bucket++;
+    }
+    MetricShard& shard = Local();
+    Add(shard.buckets[histogram][bucket], 1);
+    Add(shard.sumNanos[histogram], nanos);
+}
+
+/**
+ * Nanoseconds since a start time, for Observe
+ */
+uint64_t nanosSince(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * A counter summed per core, over the shards of threads pinned to one
+ *
+ * @param counts Receives the total for each core seen
+ */
+void Metrics::CoreCounts(MetricCounter counter, map<int, uint64_t>& counts) {
+    counts.clear();
+    lock_guard<mutex> guard(shardsLock);
+    for (size_t s = 0; s < shards.size(); s++) {
+        int core = shards[s]->core.load(memory_order_relaxed);
+        if (core >= 0) {
+            counts[core] += shards[s]->counters[counter].load(memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Sum every shard and write Prometheus text exposition format
+ *
+ * @param out Receives the metrics text
+ */
+void Metrics::Render(string& out) {
+    uint64_t counters[METRIC_COUNTERS] = { 0 };
+    uint64_t buckets[METRIC_HISTOGRAMS][HISTOGRAM_BOUNDS + 1] = { { 0 } };
+    uint64_t sums[METRIC_HISTOGRAMS] = { 0 };
+    {
+        lock_guard<mutex> guard(shardsLock);
+        for (size_t s = 0; s < shards.size(); s++) {
+            for (int i = 0; i < METRIC_COUNTERS; i++) {
+                counters[i] += shards[s]->counters[i].load(memory_order_relaxed);
+            }
+            for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+                for (int b = 0; b <= HISTOGRAM_BOUNDS; b++) {
+                    buckets[h][b] += shards[s]->buckets[h][b].load(memory_order_relaxed);
+                }
+                sums[h] += shards[s]->sumNanos[h].load(memory_order_relaxed);
+            }
+        }
+    }
+
+    char line[160];
+    auto header = [&](const char* name, const char* type, const char* help) {
+        out += string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    };
+    auto sample = [&](const char* name, const char* labels, double value) {
+        snprintf(line, sizeof(line), "%s%s %.17g\n", name, labels, value);
+        out += line;
+    };
+    auto histogram = [&](const char* name, const char* help, MetricHistogram h, const uint64_t* bounds) {
+        header(name, "histogram", help);
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= HISTOGRAM_BOUNDS; b++) {
+            cumulative += buckets[h][b];
+            if (b < HISTOGRAM_BOUNDS) {
+                snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, bounds[b] / 1e9,
+                    (unsigned long long)cumulative);
+            }
+            else {
+                snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+            }
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", name, sums[h] / 1e9, name,
+            (unsigned long long)cumulative);
+        out += line;
+    };
+
+    header("abcu_lookups_total", "counter", "Course lookups by ID, by whether the course was found.");
+    sample("abcu_lookups_total", "{result=\"hit\"}", counters[LOOKUP_HITS]);
+    sample("abcu_lookups_total", "{result=\"miss\"}", counters[LOOKUP_MISSES]);
+    histogram("abcu_lookup_duration_seconds", "Time to look up a course by ID.", LOOKUP_SECONDS, LOOKUP_BOUNDS);
+    header("abcu_body_cache_total", "counter", "Course body reads, by whether the body was already parsed.");
+    sample("abcu_body_cache_total", "{result=\"hit\"}", counters[BODY_HITS]);
+    sample("abcu_body_cache_total", "{result=\"miss\"}", counters[BODY_MISSES]);
+    header("abcu_body_evictions_total", "counter", "Course bodies dropped to stay under the body budget.");
+    sample("abcu_body_evictions_total", "", counters[EVICTIONS]);
+    header("abcu_resizes_total", "counter", "Times the hash table grew.");
+    sample("abcu_resizes_total", "", counters[RESIZES]);
+    histogram("abcu_resize_duration_seconds", "Time to grow and rehash the table.", RESIZE_SECONDS, RESIZE_BOUNDS);
+
+    map<int, uint64_t> perCore;
+    auto coreSamples = [&](const char* name, MetricCounter counter) {
+        CoreCounts(counter, perCore);
+        for (map<int, uint64_t>::iterator it = perCore.begin(); it != perCore.end(); ++it) {
+            snprintf(line, sizeof(line), "%s{core=\"%d\"} %llu\n", name, it->first, (unsigned long long)it->second);
+            out += line;
+        }
+    };
+    header("abcu_server_requests_total", "counter", "Requests answered by the catalog server, by core.");
+    coreSamples("abcu_server_requests_total", SERVER_REQUESTS);
+    header("abcu_server_connections_total", "counter", "Connections accepted by the catalog server, by core.");
+    coreSamples("abcu_server_connections_total", SERVER_CONNECTIONS);
+    header("abcu_server_rejections_total", "counter", "Expensive requests turned away as BUSY, by core.");
+    coreSamples("abcu_server_rejections_total", SERVER_REJECTIONS);
+    histogram("abcu_server_request_duration_seconds", "Time to answer one cheap server request.", SERVER_SECONDS,
+        LOOKUP_BOUNDS);
+    histogram("abcu_server_expensive_duration_seconds", "Time from reading an expensive request to its last row, "
+        "queueing included.", SERVER_EXPENSIVE_SECONDS, RESIZE_BOUNDS);
+
+    header("abcu_table_entries", "gauge", "Courses stored in the hash table.");
+    sample("abcu_table_entries", "", gauges[TABLE_ENTRIES].load(memory_order_relaxed));
+    header("abcu_table_buckets", "gauge", "Buckets in the hash table.");
+    sample("abcu_table_buckets", "", gauges[TABLE_BUCKETS].load(memory_order_relaxed));
+    header("abcu_table_load_factor", "gauge", "Entries per bucket.");
+    sample("abcu_table_load_factor", "", gauges[TABLE_LOAD_FACTOR].load(memory_order_relaxed));
+    header("abcu_memory_bytes", "gauge", "Memory in use, by category.");
+    sample("abcu_memory_bytes", "{category=\"buckets\"}", gauges[BUCKET_BYTES].load(memory_order_relaxed));
+    sample("abcu_memory_bytes", "{category=\"course_bodies\"}", gauges[RESIDENT_BODY_BYTES].load(memory_order_relaxed));
+    header("abcu_body_budget_bytes", "gauge", "Cap on resident course bodies, 0 for none.");
+    sample("abcu_body_budget_bytes", "", gauges[BODY_BUDGET_BYTES].load(memory_order_relaxed));
+    header("abcu_index_ready", "gauge", "1 once a secondary index matches the current catalog.");
+    sample("abcu_index_ready", "{index=\"prefix\"}", gauges[PREFIX_INDEX_READY].load(memory_order_relaxed));
+    sample("abcu_index_ready", "{index=\"similar\"}", gauges[SIMILAR_INDEX_READY].load(memory_order_relaxed));
+    sample("abcu_index_ready", "{index=\"dependencies\"}", gauges[DEPENDENCY_INDEX_READY].load(memory_order_relaxed));
+    sample("abcu_index_ready", "{index=\"natural\"}", gauges[NATURAL_INDEX_READY].load(memory_order_relaxed));
+}
+
+//============================================================================
+// Catalog change notifications
+//============================================================================
+
+/**
+ * Receives every visible change to a table's courses, so structures
+ * derived from the catalog can follow along instead of being rebuilt.
+ */
+class HashTable;
+
+class CatalogListener {
+
+public:
+    virtual ~CatalogListener() { }
+    /**
+     * @param before The course before the change, null if it was added
+     * @param after The course after the change, null if it was removed
+     */
+    virtual void CourseChanged(const Course* before, const Course* after) = 0;
+    /**
+     * Asked about a change before the table applies it and before any
+     * listener hears of it. A listener that must record the change
+     * first, like a log, does so here.
+     *
+     * @return false to refuse the change, which the table then skips
+     */
+    virtual bool Accept(const Course*, const Course*) { return true; }
+    /**
+     * A bulk load has changed many courses without a call for each one;
+     * catch up from the table. Listeners that do not follow bulk loads
+     * can ignore it.
+     */
+    virtual void Reloaded(HashTable*) { }
+};
+
+//============================================================================
+// Hash Table class definition
+//============================================================================
+
+/**
+ * Define a class containing data members and methods to
+ * implement a hash table with chaining.
+ */
+class HashTable {
+
+private:
+    // Define structures to hold courses
+    struct Node {
+        Course course;
+        unsigned int key;
+        Node *next;
+        // where the row lives in its mapped source, for lazy loading
+        size_t offset;
+        unsigned int source;
+        bool loaded;
+        // CLOCK reference bit for bounded-memory eviction
+        bool referenced;
+        // title collation key: first 8 bytes as an integer, then the rest
+        uint64_t titlePrefix;
+        string titleKeyRest;
+        bool titleKeyed;
+
+        // default constructor
+        Node() {
+            key = UINT_MAX;
+            next = nullptr;
+            offset = NO_OFFSET;
+            source = 0;
+            loaded = true;
+            referenced = false;
+            titlePrefix = 0;
+            titleKeyed = false;
+        }
+
+        // initialize with a course
+        Node(Course aCourse) : Node() {
+            course = aCourse;
+        }
+
+        // initialize with a course and a key
+        Node(Course aCourse, unsigned int aKey) : Node(aCourse) {
+            key = aKey;
+        }
+    };
+
+    vector<Node> nodes;
+
+    // mapped CSV files that lazy nodes read their rows from
+    vector<MappedFile*> sources;
+
+    unsigned int tableSize = DEFAULT_SIZE;
+
+    unsigned int hash(string courseId);
+
+    double loadFactor = 0.0;
+
+    int numEntries = 0;
+
+    // cap on parsed course bodies, 0 keeps every body resident
+    size_t bodyBudget = 0;
+    size_t bodyBytes = 0;
+    // resident bodies that can be re-parsed, swept by the CLOCK hand
+    vector<Node*> clock;
+    size_t clockHand = 0;
+    // a body bigger than the whole budget, parsed for one use only
+    Node* oversized = nullptr;
+
+    void Place(Node node);
+    void Place(Node node, uint32_t idHash);
+    void CheckLoad();
+    void Materialize(Node* node);
+    void Evict(size_t needed);
+    void DropOversized();
+    void RebuildClock();
+
+    // when set, every stored title is compressed with this codec
+    TitleCodec* titleCodec = nullptr;
+
+    void AppendTitle(Node* node, string& out);
+    Course CourseOf(Node* node);
+    void SortNodes(vector<Node*>& sortedNodes, CourseOrder order);
+
+    // told about every insert, update and removal
+    vector<CatalogListener*> listeners;
+    // set while a bulk load runs, which listeners hear about once
+    bool bulkLoading = false;
+
+    bool Listening() const { return !listeners.empty() && !bulkLoading; }
+
+    Node* Find(const string& courseId);
+    bool Notify(const Course* before, const Course* after);
+
+public:
+    HashTable();
+    HashTable(unsigned int size);
+    virtual ~HashTable();
+    bool Insert(Course course);
+    bool InsertHashed(Course course, uint32_t idHash);
+    bool Update(Course course);
+    bool Remove(string courseId);
+    void AddListener(CatalogListener* listener);
+    void BeginBulkLoad();
+    void EndBulkLoad();
+    unsigned int AddSource(MappedFile* file);
+    bool InsertLazy(string courseId, unsigned int source, size_t offset);
+    void Reserve(unsigned int count);
+    void SetBodyBudget(size_t bytes);
+    size_t ResidentBodyBytes() { return bodyBytes; }
+    size_t Count() const { return numEntries; }
+    void CompressTitles();
+    void PrintAll(CourseOrder order = BY_ID);
+    void Sort(vector<Course>& sortCourses);
+    Course Search(string courseId);
+    void SearchTitles(string text, vector<Course>& matches);
+    bool ExportCsv(string csvPath, CourseOrder order = BY_ID);
+    void SortedIds(vector<string>& ids);
+    void Snapshot(vector<Course>& courses, bool bodies);
+    void IdsWithPrefix(const string& prefix, vector<string>& ids);
+    void Resize();
+    void Rehash(unsigned int newSize);
+    void PublishMetrics();
+};
+
+/**
+ * Default constructor
+ */
+HashTable::HashTable() {
+    // Initializes the structures used to hold courses
+    // Initalize node structure by resizing tableSize
+    // Resize nodes list to tableSize
+    nodes.resize(tableSize);
+    // initialize vector nodes full of empty Nodes
+    for (int i = 0; i < nodes.size(); i++) {
+        nodes[i] = Node();
+    }
+}
+
+/**
+ * Constructor for specifying size of the table
+ * Use to improve efficiency of hashing algorithm
+ * by reducing collisions without wasting memory.
+ */
+HashTable::HashTable(unsigned int size) {
+    // invoke local tableSize to size with this->
+    this->tableSize = size;
+    // resize nodes size
+    nodes.resize(tableSize);
+    // initialize vector nodes full of empty Nodes
+    for (int i = 0; i < nodes.size(); i++) {
+       nodes[i] = Node();
+    }
+}
+
+
+/**
+ * Destructor
+ */
+HashTable::~HashTable() {
+    // Logic to free storage when class is destroyed
+    Node* current;
+    Node* temp;
+
+    // For each item in vector nodes (buckets)
+    for (int i = 0; i < nodes.size(); i++) {
+        // current variable points to the first chained node, the
+        // bucket's own node belongs to the vector
+        current = nodes[i].next;
+        // While current node is not null (pointing to an entry)
+        while (current != nullptr) {
+            // temp points to bucket's node
+            temp = current;
+            // current becomes next node in bucket's linked list
+            current = current->next;
+            // delete the orphan node
+            delete temp;
+        }
+    }
+
+    // Unmap every CSV the lazy nodes were reading from
+    for (size_t i = 0; i < sources.size(); i++) {
+        delete sources[i];
+    }
+    delete titleCodec;
+}
+
+/**
+ * Calculate the hash value of a given key.
+ * Note that key is specifically defined as
+ * unsigned int to prevent undefined results
+ * of a negative list index.
+ *
+ * @param key The key to hash
+ * @return The calculated hash
+ */
+unsigned int HashTable::hash(string courseId) {
+    // Logic to calculate a hash value
+    unsigned int hash;
+    // Hash the ID bytes with the kernel picked for this CPU
+    unsigned int key = kernels.hash(courseId.data(), courseId.size());
+
+    // hash variable stores value as it is generated
+    hash = key % nodes.size();
+
+    // return the finalized hash
+    return hash;
+}
+
+/**
+ * Insert a course
+ *
+ * @param course The course to insert
+ * @return false if a listener refused the change
+ */
+bool HashTable::Insert(Course course) {
+    return InsertHashed(course, kernels.hash(course.courseId.data(), course.courseId.size()));
+}
+
+/**
+ * Insert a course whose ID hash was already computed, so a loader can
+ * hash on another thread ahead of the one filling the table
+ *
+ * @param course The course to insert
+ * @param idHash kernels.hash of the course ID
+ * @return false if a listener refused the change
+ */
+bool HashTable::InsertHashed(Course course, uint32_t idHash) {
+    // Logic to insert a course
+    // a repeated ID stays hidden behind the first, so only new IDs notify
+    bool added = Listening() && Find(course.courseId) == nullptr;
+    if (added && !Notify(nullptr, &course)) {
+        return false;
+    }
+    Node node;
+    setTitleKey(course.courseTitle, node.titlePrefix, node.titleKeyRest);
+    node.titleKeyed = true;
+    if (titleCodec != nullptr) {
+        course.courseTitle = titleCodec->Encode(course.courseTitle);
+    }
+    node.course = course;
+    Place(node, idHash);
+    CheckLoad();
+    return true;
+}
+
+/**
+ * Take ownership of a mapped CSV so lazy nodes can parse rows from it
+ *
+ * @param file The mapped file
+ * @return The source number to pass to InsertLazy
+ */
+unsigned int HashTable::AddSource(MappedFile* file) {
+    sources.push_back(file);
+    return sources.size() - 1;
+}
+
+/**
+ * Insert a course known only by its ID. Title and prerequisites are
+ * parsed from the mapped source row the first time it is looked up.
+ *
+ * @param courseId The course ID read from the row
+ * @param source The source number returned by AddSource
+ * @param offset Byte offset of the row in the source
+ * @return false if a listener refused the change
+ */
+bool HashTable::InsertLazy(string courseId, unsigned int source, size_t offset) {
+    // listeners need the prerequisites, so outside a bulk load the row
+    // is parsed right away
+    if (Listening() && Find(courseId) == nullptr) {
+        vector<string> fields;
+        parseCsvRow(sources[source]->Data(), sources[source]->Size(), offset, fields);
+        Course course;
+        course.courseId = courseId;
+        if (fields.size() > 1) {
+            course.courseTitle = fields[1];
+        }
+        for (size_t j = 2; j < fields.size(); j++) {
+            course.prerequisites.push_back(fields[j]);
+        }
+        if (!Notify(nullptr, &course)) {
+            return false;
+        }
+    }
+    Node node;
+    node.course.courseId = courseId;
+    node.source = source;
+    node.offset = offset;
+    node.loaded = false;
+    Place(node);
+    CheckLoad();
+    return true;
+}
+
+/**
+ * Replace the course with the same ID, or insert it if there is none
+ *
+ * @param course The new version of the course
+ * @return false if a listener refused the change
+ */
+bool HashTable::Update(Course course) {
+    Node* node = Find(course.courseId);
+    if (node == nullptr) {
+        return Insert(course);
+    }
+    if (Listening()) {
+        Course before = CourseOf(node);
+        if (!Notify(&before, &course)) {
+            return false;
+        }
+    }
+    setTitleKey(course.courseTitle, node->titlePrefix, node->titleKeyRest);
+    node->titleKeyed = true;
+    if (titleCodec != nullptr) {
+        course.courseTitle = titleCodec->Encode(course.courseTitle);
+    }
+    node->course = course;
+    // the new body has no CSV row to be re-read from, so it is pinned
+    node->loaded = true;
+    node->offset = NO_OFFSET;
+    if (bodyBudget > 0) {
+        RebuildClock();
+    }
+    return true;
+}
+
+/**
+ * Remove the course with an ID. If the ID had been inserted more than
+ * once, the next copy becomes the visible one.
+ *
+ * @param courseId The ID of the course to remove
+ * @return true if a course was removed, false if there was none or a
+ *         listener refused the change
+ */
+bool HashTable::Remove(string courseId) {
+    int key = hash(courseId);
+    Node* head = &nodes[key];
+    if (head->key == UINT_MAX) {
+        return false;
+    }
+    Node* previous = nullptr;
+    Node* current = head;
+    while (current != nullptr && !sameId(current->course.courseId, courseId)) {
+        previous = current;
+        current = current->next;
+    }
+    if (current == nullptr) {
+        return false;
+    }
+    if (Listening()) {
+        // the next copy of the ID, if any, is what stays visible
+        Node* hidden = current->next;
+        while (hidden != nullptr && !sameId(hidden->course.courseId, courseId)) {
+            hidden = hidden->next;
+        }
+        Course before = CourseOf(current);
+        Course after;
+        if (hidden != nullptr) {
+            after = CourseOf(hidden);
+        }
+        if (!Notify(&before, hidden != nullptr ? &after : nullptr)) {
+            return false;
+        }
+    }
+
+    if (previous == nullptr) {
+        // the bucket's node lives in the vector, so pull the next one in
+        Node* next = head->next;
+        if (next != nullptr) {
+            *head = *next;
+            delete next;
+        }
+        else {
+            *head = Node();
+        }
+    }
+    else {
+        previous->next = current->next;
+        delete current;
+    }
+    numEntries -= 1;
+    loadFactor = double(numEntries) / tableSize;
+    if (bodyBudget > 0) {
+        RebuildClock();
+    }
+    return true;
+}
+
+/**
+ * Register a listener for course changes. The table does not own it.
+ */
+void HashTable::AddListener(CatalogListener* listener) {
+    listeners.push_back(listener);
+}
+
+/**
+ * Stop telling listeners about each course until EndBulkLoad, so a
+ * load costs them one catch-up instead of a change per row, and lazy
+ * rows are not parsed just to describe the change
+ */
+void HashTable::BeginBulkLoad() {
+    bulkLoading = true;
+}
+
+/**
+ * Resume notifications and let every listener catch up from the table
+ */
+void HashTable::EndBulkLoad() {
+    bulkLoading = false;
+    for (size_t i = 0; i < listeners.size(); i++) {
+        listeners[i]->Reloaded(this);
+    }
+}
+
+/**
+ * Tell every listener about a change the table is about to apply, once
+ * they have all accepted it
+ *
+ * @return false if a listener refused the change, which must then be
+ *         skipped
+ */
+bool HashTable::Notify(const Course* before, const Course* after) {
+    for (size_t i = 0; i < listeners.size(); i++) {
+        if (!listeners[i]->Accept(before, after)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < listeners.size(); i++) {
+        listeners[i]->CourseChanged(before, after);
+    }
+    return true;
+}
+
+/**
+ * Is a table size prime, by trial division up to its square root
+ */
+bool isPrimeSize(unsigned int size) {
+    if (size < 4) {
+        return size > 1;
+    }
+    if (size % 2 == 0) {
+        return false;
+    }
+    for (unsigned int d = 3; d <= size / d; d += 2) {
+        if (size % d == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Grow the table ahead of a bulk load of a known number of courses,
+ * rehashing once straight to the first prime size that holds them
+ *
+ * @param count Number of courses about to be inserted
+ */
+void HashTable::Reserve(unsigned int count) {
+    if (tableSize >= count) {
+        return;
+    }
+    unsigned int size = count;
+    while (!isPrimeSize(size)) {
+        size++;
+    }
+    Rehash(size);
+}
+
+/**
+ * Link a node into its bucket
+ *
+ * @param node The node to copy into the table
+ */
+void HashTable::Place(Node node) {
+    Place(node, kernels.hash(node.course.courseId.data(), node.course.courseId.size()));
+}
+
+/**
+ * Link a node into the bucket of an already computed ID hash
+ *
+ * @param node The node to copy into the table
+ * @param idHash kernels.hash of the node's course ID
+ */
+void HashTable::Place(Node node, uint32_t idHash) {
+    // create the key for the given course
+    int key = idHash % nodes.size();
+    node.key = key;
+    node.next = nullptr;
+    // retrieve node using key
+    Node* current = &nodes[key];
+    // if no entry found for the key
+    if (current->key == UINT_MAX) {
+        // assign this node to the key position
+        nodes[key] = node;
+    }
+    // else find the next open node
+    else {
+        // While the current node is pointing to something
+        while (current->next != nullptr) {
+            // Move to next node
+            current = current->next;
+        }
+        // Once the current node is not pointing to anything,
+        // Append newNode to bucket's linked list
+        current->next = new Node(node);
+    }
+    numEntries += 1;
+}
+
+/**
+ * Grow the table once it holds as many entries as buckets
+ */
+void HashTable::CheckLoad() {
+    // Check if hash table is sufficient size
+    //Determine load factor
+    loadFactor = double(numEntries) / tableSize;
+    // If the load factor is too great
+    if (loadFactor >= 1.0) {
+        // Resize hash table
+        Resize();
+    }
+}
+
+/**
+ * Append a node's plain title to an output buffer, decompressing it
+ * in place when titles are compressed
+ *
+ * @param node The node holding the title
+ * @param out The buffer to append to
+ */
+void HashTable::AppendTitle(Node* node, string& out) {
+    Materialize(node);
+    if (titleCodec != nullptr) {
+        titleCodec->DecodeAppend(node->course.courseTitle, out);
+    }
+    else {
+        out.append(node->course.courseTitle);
+    }
+    DropOversized();
+}
+
+/**
+ * Copy of a node's course with its title decompressed
+ *
+ * @param node The node holding the course
+ * @return The course as callers see it
+ */
+Course HashTable::CourseOf(Node* node) {
+    Materialize(node);
+    Course course;
+    if (titleCodec == nullptr) {
+        course = node->course;
+    }
+    else {
+        course.courseId = node->course.courseId;
+        titleCodec->DecodeAppend(node->course.courseTitle, course.courseTitle);
+        course.prerequisites = node->course.prerequisites;
+    }
+    DropOversized();
+    return course;
+}
+
+/**
+ * Train a title symbol table on the titles loaded so far and store
+ * every title compressed from now on. Lazy rows are compressed when
+ * they are first parsed. Training happens once; later calls keep the
+ * existing table so stored titles stay decodable.
+ */
+void HashTable::CompressTitles() {
+    if (titleCodec != nullptr) {
+        return;
+    }
+    // every few resident titles, up to the sample size
+    vector<string> sample;
+    size_t step = max(1, numEntries / int(TITLE_SAMPLE_SIZE));
+    size_t seen = 0;
+    for (size_t i = 0; i < nodes.size() && sample.size() < TITLE_SAMPLE_SIZE; i++) {
+        if (nodes[i].key == UINT_MAX) {
+            continue;
+        }
+        for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+            if (seen++ % step == 0) {
+                Materialize(current);
+                sample.push_back(current->course.courseTitle);
+                DropOversized();
+            }
+        }
+    }
+    TitleCodec* codec = new TitleCodec();
+    codec->Train(sample);
+
+    size_t before = 0;
+    size_t after = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key == UINT_MAX) {
+            continue;
+        }
+        for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+            if (current->loaded) {
+                before += current->course.courseTitle.size();
+                current->course.courseTitle = codec->Encode(current->course.courseTitle);
+                after += current->course.courseTitle.size();
+            }
+        }
+    }
+    titleCodec = codec;
+    // compressed titles are smaller, so the clock's totals changed
+    RebuildClock();
+    cout << "Compressed titles from " << before << " to " << after << " bytes using "
+        << codec->SymbolCount() << " symbols" << endl;
+}
+
+/**
+ * Approximate heap bytes held by a course's title and prerequisites
+ *
+ * @param course The course to measure
+ * @return The body size in bytes
+ */
+size_t courseBodyBytes(const Course& course) {
+    size_t bytes = course.courseTitle.capacity()
+        + course.prerequisites.capacity() * sizeof(string);
+    for (size_t i = 0; i < course.prerequisites.size(); i++) {
+        bytes += course.prerequisites[i].capacity();
+    }
+    return bytes;
+}
+
+/**
+ * Parse the title and prerequisites of a lazy node from its source row
+ *
+ * @param node The node to fill in
+ */
+void HashTable::Materialize(Node* node) {
+    // a resident body only needs its reference bit set
+    node->referenced = true;
+    if (node->loaded) {
+        if (metricsEnabled) {
+            metrics.Count(BODY_HITS);
+        }
+        return;
+    }
+    if (metricsEnabled) {
+        metrics.Count(BODY_MISSES);
+    }
+    MappedFile* file = sources[node->source];
+    vector<string> fields;
+    parseCsvRow(file->Data(), file->Size(), node->offset, fields);
+    if (fields.size() > 1) {
+        node->course.courseTitle = titleCodec != nullptr ? titleCodec->Encode(fields[1]) : fields[1];
+    }
+    // the collation key is index data, it stays when the body is evicted
+    if (!node->titleKeyed) {
+        setTitleKey(fields.size() > 1 ? fields[1] : string(), node->titlePrefix, node->titleKeyRest);
+        node->titleKeyed = true;
+    }
+    // checks for prerequisistes and adds them
+    for (size_t j = 2; j < fields.size(); j++) {
+        node->course.prerequisites.push_back(fields[j]);
+    }
+    // keep the parsed row so later lookups skip the parse
+    node->loaded = true;
+
+    // under a memory cap, make room before this body joins the clock;
+    // one that could never fit is dropped again once the caller is done
+    if (bodyBudget > 0) {
+        size_t needed = courseBodyBytes(node->course);
+        if (needed > bodyBudget) {
+            oversized = node;
+            return;
+        }
+        Evict(needed);
+        bodyBytes += needed;
+        clock.push_back(node);
+    }
+}
+
+/**
+ * Release the body Materialize would not cache, so the budget holds
+ * between calls. Every caller of Materialize calls this once it has
+ * copied what it needs from the node.
+ */
+void HashTable::DropOversized() {
+    if (oversized == nullptr) {
+        return;
+    }
+    string().swap(oversized->course.courseTitle);
+    vector<string>().swap(oversized->course.prerequisites);
+    oversized->loaded = false;
+    oversized = nullptr;
+}
+
+/**
+ * Drop cold course bodies until the new body fits the budget. The
+ * CLOCK hand gives recently used bodies a second chance by clearing
+ * their reference bit before they can be evicted.
+ *
+ * @param needed Bytes about to be added
+ */
+void HashTable::Evict(size_t needed) {
+    while (bodyBytes + needed > bodyBudget && !clock.empty()) {
+        if (clockHand >= clock.size()) {
+            clockHand = 0;
+        }
+        Node* victim = clock[clockHand];
+        if (victim->referenced) {
+            victim->referenced = false;
+            clockHand += 1;
+            continue;
+        }
+        bodyBytes -= courseBodyBytes(victim->course);
+        // swap with empty strings so the memory is actually returned
+        string().swap(victim->course.courseTitle);
+        vector<string>().swap(victim->course.prerequisites);
+        victim->loaded = false;
+        if (metricsEnabled) {
+            metrics.Count(EVICTIONS);
+        }
+        // the last entry takes the freed slot, the hand stays put
+        clock[clockHand] = clock.back();
+        clock.pop_back();
+    }
+}
+
+/**
+ * Cap the memory used by lazily parsed course bodies. Bodies parsed
+ * from a mapped CSV are evicted when over the cap and parsed again on
+ * their next lookup; the course IDs and row offsets stay resident. A
+ * body bigger than the whole cap is never cached. Bodies set by Update,
+ * and those of eagerly loaded courses, have no row to be parsed from
+ * again, so they stay resident and are not counted against the cap.
+ *
+ * @param bytes The budget in bytes, 0 for no limit
+ */
+void HashTable::SetBodyBudget(size_t bytes) {
+    bodyBudget = bytes;
+    RebuildClock();
+    if (bodyBudget > 0) {
+        Evict(0);
+    }
+}
+
+/**
+ * Collect the evictable resident bodies. Node addresses change when
+ * the table is resized, so the clock is rebuilt afterwards.
+ */
+void HashTable::RebuildClock() {
+    clock.clear();
+    clockHand = 0;
+    bodyBytes = 0;
+    if (bodyBudget == 0) {
+        return;
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key == UINT_MAX) {
+            continue;
+        }
+        for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+            // eagerly loaded courses have no row to come back from
+            if (current->loaded && current->offset != NO_OFFSET) {
+                bodyBytes += courseBodyBytes(current->course);
+                clock.push_back(current);
+            }
+        }
+    }
+}
+
+/**
+ * Collect node pointers in listing order. Sorting pointers rather than
+ * course copies means a bounded table never holds more than one extra
+ * body at a time.
+ *
+ * @param sortedNodes Receives the nodes
+ * @param order By course ID, or by title collation key
+ */
+void HashTable::SortNodes(vector<Node*>& sortedNodes, CourseOrder order) {
+    sortedNodes.clear();
+    sortedNodes.reserve(numEntries);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key != UINT_MAX) {
+            for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+                if (order == BY_TITLE && !current->titleKeyed) {
+                    // a lazy row's title has to be read once to key it
+                    Materialize(current);
+                    DropOversized();
+                }
+                sortedNodes.push_back(current);
+            }
+        }
+    }
+    if (order == BY_ID) {
+        sort(sortedNodes.begin(), sortedNodes.end(), [](Node* a, Node* b) {
+            return a->course.courseId < b->course.courseId;
+        });
+        return;
+    }
+    // integer prefixes settle most comparisons without touching strings
+    sort(sortedNodes.begin(), sortedNodes.end(), [](Node* a, Node* b) {
+        if (a->titlePrefix != b->titlePrefix) {
+            return a->titlePrefix < b->titlePrefix;
+        }
+        int rest = a->titleKeyRest.compare(b->titleKeyRest);
+        if (rest != 0) {
+            return rest < 0;
+        }
+        return a->course.courseId < b->course.courseId;
+    });
+}
+
+/**
+ * Print all courses
+ *
+ * @param order By course ID, or by title ignoring case and articles
+ */
+void HashTable::PrintAll(CourseOrder order) {
+    // Logic to print all courses
+    vector<Node*> sortedNodes;
+    SortNodes(sortedNodes, order);
+
+    // Iterate over entire nodes vector
+    string line;
+    for (size_t i = 0; i < sortedNodes.size(); i++) {
+        // Output course information, decoding the title into the line
+        line = " ";
+        line.append(sortedNodes[i]->course.courseId);
+        line.append(", ");
+        AppendTitle(sortedNodes[i], line);
+        cout << line << endl;
+    }
+}
+
+void HashTable::Sort(vector<Course> &sortCourses)
+{
+    // Create new vector that isolates all courses
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key != UINT_MAX) {
+            Node* current = &nodes[i];
+            while (current != nullptr) {
+                // lazy rows are parsed, compressed titles decoded
+                sortCourses.push_back(CourseOf(current));
+                current = current->next;
+            }
+        }
+    }
+
+    // Sort vector of courses; stable, so of a repeated ID the copy
+    // Search finds, being earlier in its chain, stays first
+    stable_sort(sortCourses.begin(), sortCourses.end(), less_than_key());
+}
+
+/**
+ * Collect every course ID in ascending order without parsing any
+ * lazily loaded rows
+ *
+ * @param ids Receives the sorted, de-duplicated IDs
+ */
+void HashTable::SortedIds(vector<string>& ids) {
+    ids.clear();
+    ids.reserve(numEntries);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key != UINT_MAX) {
+            for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+                ids.push_back(current->course.courseId);
+            }
+        }
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+}
+
+/**
+ * Copy every course out unsorted, for building derived structures on
+ * another thread. Chains are walked from their heads, so of a repeated
+ * ID the copy Search finds comes first.
+ *
+ * @param courses Receives the courses
+ * @param bodies False to copy IDs only, leaving lazy rows unparsed
+ */
+void HashTable::Snapshot(vector<Course>& courses, bool bodies) {
+    courses.clear();
+    courses.reserve(numEntries);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key != UINT_MAX) {
+            for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+                if (bodies) {
+                    courses.push_back(CourseOf(current));
+                }
+                else {
+                    courses.push_back(Course());
+                    courses.back().courseId = current->course.courseId;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Scan for the course IDs starting with a prefix, for when no sorted
+ * index is at hand. Lazy rows are not parsed.
+ *
+ * @param prefix The start of the IDs to find
+ * @param ids Receives the sorted, de-duplicated IDs
+ */
+void HashTable::IdsWithPrefix(const string& prefix, vector<string>& ids) {
+    ids.clear();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key != UINT_MAX) {
+            for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+                if (current->course.courseId.compare(0, prefix.size(), prefix) == 0) {
+                    ids.push_back(current->course.courseId);
+                }
+            }
+        }
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+}
+
+/**
+ * Search for the specified courseId
+ *
+ * @param courseId The course ID to search for
+ */
+Course HashTable::Search(string courseId) {
+    // Create empty course
+    Course course;
+
+    // timed only with metrics on, so the default path is unchanged
+    chrono::steady_clock::time_point start;
+    if (metricsEnabled) {
+        start = chrono::steady_clock::now();
+    }
+
+    // Logic to search for and return a bid
+    Node* node = Find(courseId);
+
+    // if no entry found for the key
+    if (node == nullptr) {
+        if (metricsEnabled) {
+            metrics.Count(LOOKUP_MISSES);
+            metrics.Observe(LOOKUP_SECONDS, nanosSince(start));
+        }
+        // return course
+        return course;
+    }
+
+    //return node course, parsing it first if loaded lazily
+    course = CourseOf(node);
+    if (metricsEnabled) {
+        metrics.Count(LOOKUP_HITS);
+        metrics.Observe(LOOKUP_SECONDS, nanosSince(start));
+    }
+    return course;
+}
+
+/**
+ * Find the node holding a course ID
+ *
+ * @param courseId The course ID to search for
+ * @return The first node with the ID, or nullptr
+ */
+HashTable::Node* HashTable::Find(const string& courseId) {
+    // create the key for the given course
+    int key = hash(courseId);
+
+    // retrieve node using key
+    Node* current = &nodes[key];
+
+    // if no entry found for the key
+    if (current->key == UINT_MAX) {
+        return nullptr;
+    }
+
+    // while node not equal to nullptr
+    while (current != nullptr) {
+        // if the current node matches, return it
+        if (sameId(current->course.courseId, courseId)) {
+            return current;
+        }
+        //node is equal to next node
+        current = current->next;
+    }
+    // Otherwise, no match found
+    return nullptr;
+}
+
+/**
+ * Find courses whose title contains some text, ignoring case. Each
+ * title is decoded into one reused buffer rather than a new string.
+ *
+ * @param text The text to look for
+ * @param matches Receives the matching courses in ID order
+ */
+void HashTable::SearchTitles(string text, vector<Course>& matches) {
+    matches.clear();
+    kernels.changeCase(&text[0], text.size(), false);
+    string title;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key == UINT_MAX) {
+            continue;
+        }
+        for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+            title.clear();
+            AppendTitle(current, title);
+            kernels.changeCase(&title[0], title.size(), false);
+            if (title.find(text) != string::npos) {
+                matches.push_back(CourseOf(current));
+            }
+        }
+    }
+    sort(matches.begin(), matches.end(), less_than_key());
+}
+
+/**
+ * Append a CSV field, quoting it if it holds a comma or quote
+ */
+void appendCsvField(string& line, const char* field, size_t length) {
+    if (memchr(field, ',', length) == nullptr && memchr(field, '"', length) == nullptr) {
+        line.append(field, length);
+        return;
+    }
+    line.push_back('"');
+    for (size_t i = 0; i < length; i++) {
+        if (field[i] == '"') {
+            line.push_back('"');
+        }
+        line.push_back(field[i]);
+    }
+    line.push_back('"');
+}
+
+/**
+ * Write every course to a CSV file in the same layout loadCourses
+ * reads. Titles are decoded into the row buffer directly.
+ *
+ * @param csvPath the path of the CSV file to write
+ * @param order By course ID, or by title ignoring case and articles
+ * @return true if the file was written
+ */
+bool HashTable::ExportCsv(string csvPath, CourseOrder order) {
+    ofstream out(csvPath.c_str(), ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    vector<Node*> sortedNodes;
+    SortNodes(sortedNodes, order);
+
+    // loadCourses skips the first line, so write a header
+    out << "courseId,courseTitle,prerequisites" << "\n";
+    string line;
+    string title;
+    for (size_t i = 0; i < sortedNodes.size(); i++) {
+        Node* node = sortedNodes[i];
+        title.clear();
+        AppendTitle(node, title);
+        line.clear();
+        appendCsvField(line, node->course.courseId.data(), node->course.courseId.size());
+        line.push_back(',');
+        appendCsvField(line, title.data(), title.size());
+        for (size_t j = 0; j < node->course.prerequisites.size(); j++) {
+            line.push_back(',');
+            appendCsvField(line, node->course.prerequisites[j].data(), node->course.prerequisites[j].size());
+        }
+        line.push_back('\n');
+        out.write(line.data(), line.size());
+    }
+    out.close();
+    return !out.fail();
+}
+
+/** 
+* Checks load factor of hash table,
+* resizes if necessary by doubling size
+* then finding next prime
+*/
+void HashTable::Resize() {
+    // Initialize newSize with double current size
+    unsigned int newSize = tableSize * 2;
+    // Initialize isPrime boolean to false
+    bool isPrime = false;
+    // While newSize is not a prime number
+    while (!isPrime) {
+        // For loop that checks newSize for remainders
+        for (int i = 2; i <= newSize / 2; ++i) {
+            // If newSize is evenly divisible
+            if (newSize % i == 0) {
+                // Increment newSize
+                newSize += 1;
+                // Jump to new iteration of while loop
+                continue;
+            }
+        }
+        // newSize not divisible, so is a prime number
+        isPrime = true;
+    }
+    Rehash(newSize);
+}
+
+/**
+ * Move every entry into a bucket array of a new size
+ *
+ * @param newSize Number of buckets
+ */
+void HashTable::Rehash(unsigned int newSize) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Create temporary vector to copy existing hash table
+    vector<Node> temp = nodes;
+    // resize tableSize
+    tableSize = newSize;
+    // resize nodes size
+    nodes.resize(tableSize);
+    // initialize new vector nodes full of empty Nodes
+    for (int i = 0; i < nodes.size(); i++) {
+        nodes[i] = Node();
+    }
+    // Reset numEntries so entries are not counted twice
+    numEntries = 0;
+    Node* tempNode;
+    Node* orphan;
+    // Fill new vector with existing entries, keeping lazy row offsets
+    for (int i = 0; i < temp.size(); i++) {
+        if (temp[i].key != UINT_MAX) {
+            Place(temp[i]);
+            tempNode = temp[i].next;
+            while (tempNode != nullptr) {
+                Place(*tempNode);
+                // the old chained node has been copied, free it
+                orphan = tempNode;
+                tempNode = tempNode->next;
+                delete orphan;
+            }
+        }
+    }
+    loadFactor = double(numEntries) / tableSize;
+    // nodes moved, so the eviction clock must point at the new copies
+    RebuildClock();
+    if (metricsEnabled) {
+        metrics.Count(RESIZES);
+        metrics.Observe(RESIZE_SECONDS, nanosSince(start));
+    }
+    return;
+}
+
+/**
+ * Publish the table's size and memory gauges. Gauges are set by the
+ * thread that owns the table, so exporters never read the table itself.
+ */
+void HashTable::PublishMetrics() {
+    size_t chained = 0;
+    size_t bodies = bodyBytes;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key == UINT_MAX) {
+            continue;
+        }
+        for (Node* current = &nodes[i]; current != nullptr; current = current->next) {
+            if (current != &nodes[i]) {
+                chained++;
+            }
+            // without a budget, bodies are not tracked as they load
+            if (bodyBudget == 0 && current->loaded) {
+                bodies += courseBodyBytes(current->course);
+            }
+        }
+    }
+    metrics.SetGauge(TABLE_ENTRIES, numEntries);
+    metrics.SetGauge(TABLE_BUCKETS, tableSize);
+    metrics.SetGauge(TABLE_LOAD_FACTOR, double(numEntries) / tableSize);
+    metrics.SetGauge(BUCKET_BYTES, (nodes.capacity() + chained) * sizeof(Node));
+    metrics.SetGauge(RESIDENT_BODY_BYTES, bodies);
+    metrics.SetGauge(BODY_BUDGET_BYTES, bodyBudget);
+}
+
+//============================================================================
+// Front-coded course ID dictionary
+//============================================================================
+
+// IDs per block; each block starts with one uncompressed anchor. An
+// inserted ID can grow a block to twice this before it splits.
+const unsigned int FRONT_CODE_BLOCK = 16;
+
+/**
+ * Sorted, block-compressed set of course IDs. Sorted IDs share long
+ * prefixes ("CSCI3..."), so within a block each ID after the anchor is
+ * stored as the length shared with the previous ID plus the remaining
+ * suffix. Lookups binary search the anchors, then decode one block.
+ */
+class FrontCodedIds {
+
+private:
+    // encoded blocks, lengths are stored as varints
+    vector<unsigned char> bytes;
+    // where each block starts in bytes
+    vector<unsigned int> blockStarts;
+    // rank of each block's anchor
+    vector<unsigned int> blockRanks;
+    size_t count = 0;
+
+    static void PutVarint(vector<unsigned char>& out, unsigned int value);
+    static unsigned int GetVarint(const unsigned char*& in);
+    static void EncodeBlock(const string* ids, size_t length, vector<unsigned char>& out);
+    string Anchor(size_t block) const;
+    size_t LowerBoundRank(const string& key, string* found) const;
+    size_t BlockOf(size_t rank) const;
+    void ReplaceBlock(size_t block, const vector<string>& ids);
+
+public:
+    void Build(const vector<string>& sortedIds);
+    bool Insert(const string& courseId);
+    bool Remove(const string& courseId);
+    size_t Count() const { return count; }
+    size_t MemoryBytes() const;
+    string Get(size_t rank) const;
+    bool Find(const string& courseId, size_t& rank) const;
+    void PrefixRange(const string& prefix, size_t& first, size_t& last) const;
+    void Decode(size_t first, size_t last, vector<string>& ids) const;
+};
+
+/**
+ * Append an unsigned value as a little-endian base-128 varint
+ */
+void FrontCodedIds::PutVarint(vector<unsigned char>& out, unsigned int value) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+/**
+ * Read a varint and advance the cursor past it
+ */
+unsigned int FrontCodedIds::GetVarint(const unsigned char*& in) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= (unsigned int)(*in & 0x7F) << shift;
+        shift += 7;
+        in++;
+    }
+    value |= (unsigned int)(*in) << shift;
+    in++;
+    return value;
+}
+
+/**
+ * Encode a sorted list of unique IDs
+ *
+ * @param sortedIds IDs in ascending order without duplicates
+ */
+void FrontCodedIds::Build(const vector<string>& sortedIds) {
+    bytes.clear();
+    blockStarts.clear();
+    blockRanks.clear();
+    count = sortedIds.size();
+    for (size_t i = 0; i < sortedIds.size(); i += FRONT_CODE_BLOCK) {
+        blockStarts.push_back(bytes.size());
+        blockRanks.push_back(i);
+        EncodeBlock(&sortedIds[i], min(sortedIds.size() - i, size_t(FRONT_CODE_BLOCK)), bytes);
+    }
+    bytes.shrink_to_fit();
+    blockStarts.shrink_to_fit();
+    blockRanks.shrink_to_fit();
+}
+
+/**
+ * Append one block: the anchor's length and full key, then for each
+ * later ID the prefix it shares with the one before and the new suffix
+ */
+void FrontCodedIds::EncodeBlock(const string* ids, size_t length, vector<unsigned char>& out) {
+    PutVarint(out, ids[0].size());
+    out.insert(out.end(), ids[0].begin(), ids[0].end());
+    for (size_t i = 1; i < length; i++) {
+        const string& previous = ids[i - 1];
+        const string& id = ids[i];
+        size_t shared = 0;
+        size_t limit = min(previous.size(), id.size());
+        while (shared < limit && previous[shared] == id[shared]) {
+            shared++;
+        }
+        PutVarint(out, shared);
+        PutVarint(out, id.size() - shared);
+        out.insert(out.end(), id.begin() + shared, id.end());
+    }
+}
+
+/**
+ * The block holding a rank; a rank one past the end falls in the last
+ * block
+ */
+size_t FrontCodedIds::BlockOf(size_t rank) const {
+    return upper_bound(blockRanks.begin(), blockRanks.end(), rank) - blockRanks.begin() - 1;
+}
+
+/**
+ * Re-encode a block with new contents, splitting it in two if it has
+ * grown past twice FRONT_CODE_BLOCK, or dropping it if it is empty.
+ * Later blocks move in place; count is left to the caller.
+ *
+ * @param block The block to replace
+ * @param ids Its new IDs, in order
+ */
+void FrontCodedIds::ReplaceBlock(size_t block, const vector<string>& ids) {
+    vector<unsigned char> encoded;
+    size_t split = ids.size() > 2 * FRONT_CODE_BLOCK ? ids.size() / 2 : ids.size();
+    if (split > 0) {
+        EncodeBlock(ids.data(), split, encoded);
+    }
+    size_t second = encoded.size();
+    if (split < ids.size()) {
+        EncodeBlock(ids.data() + split, ids.size() - split, encoded);
+    }
+
+    size_t start = blockStarts[block];
+    size_t end = block + 1 < blockStarts.size() ? blockStarts[block + 1] : bytes.size();
+    bytes.erase(bytes.begin() + start, bytes.begin() + end);
+    bytes.insert(bytes.begin() + start, encoded.begin(), encoded.end());
+    long long moved = (long long)encoded.size() - (long long)(end - start);
+    // the block's own rank stays, later ones shift by the change in size
+    long long shift = (long long)ids.size() - (long long)(block + 1 < blockRanks.size()
+        ? blockRanks[block + 1] - blockRanks[block] : count - blockRanks[block]);
+    for (size_t b = block + 1; b < blockStarts.size(); b++) {
+        blockStarts[b] += moved;
+        blockRanks[b] += shift;
+    }
+    if (ids.empty()) {
+        blockStarts.erase(blockStarts.begin() + block);
+        blockRanks.erase(blockRanks.begin() + block);
+    }
+    else if (split < ids.size()) {
+        blockStarts.insert(blockStarts.begin() + block + 1, start + second);
+        blockRanks.insert(blockRanks.begin() + block + 1, blockRanks[block] + split);
+    }
+}
+
+/**
+ * Add an ID, re-encoding only the block it lands in
+ *
+ * @return false if the ID was already there
+ */
+bool FrontCodedIds::Insert(const string& courseId) {
+    string found;
+    size_t rank = LowerBoundRank(courseId, &found);
+    if (rank < count && found == courseId) {
+        return false;
+    }
+    if (count == 0) {
+        Build(vector<string>(1, courseId));
+        return true;
+    }
+    size_t block = BlockOf(rank);
+    vector<string> ids;
+    size_t end = block + 1 < blockRanks.size() ? blockRanks[block + 1] : count;
+    Decode(blockRanks[block], end, ids);
+    ids.insert(ids.begin() + (rank - blockRanks[block]), courseId);
+    ReplaceBlock(block, ids);
+    count++;
+    return true;
+}
+
+/**
+ * Take an ID out, re-encoding only the block it was in
+ *
+ * @return false if the ID was not there
+ */
+bool FrontCodedIds::Remove(const string& courseId) {
+    size_t rank;
+    if (!Find(courseId, rank)) {
+        return false;
+    }
+    size_t block = BlockOf(rank);
+    vector<string> ids;
+    size_t end = block + 1 < blockRanks.size() ? blockRanks[block + 1] : count;
+    Decode(blockRanks[block], end, ids);
+    ids.erase(ids.begin() + (rank - blockRanks[block]));
+    ReplaceBlock(block, ids);
+    count--;
+    return true;
+}
+
+/**
+ * Bytes used by the encoded dictionary
+ */
+size_t FrontCodedIds::MemoryBytes() const {
+    return sizeof(*this) + bytes.capacity() + (blockStarts.capacity() + blockRanks.capacity()) * sizeof(unsigned int);
+}
+
+/**
+ * Full key of a block's anchor
+ */
+string FrontCodedIds::Anchor(size_t block) const {
+    const unsigned char* in = bytes.data() + blockStarts[block];
+    unsigned int length = GetVarint(in);
+    return string((const char*)in, length);
+}
+
+/**
+ * Rank of the first ID not less than key
+ *
+ * @param key The key to position
+ * @param found Receives the ID at that rank, if there is one
+ * @return The rank, or Count() if every ID is less than key
+ */
+size_t FrontCodedIds::LowerBoundRank(const string& key, string* found) const {
+    if (count == 0) {
+        return 0;
+    }
+    // binary search for the last block whose anchor is <= key
+    size_t low = 0;
+    size_t high = blockStarts.size();
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (Anchor(middle) <= key) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    // decode the block front to back until an ID reaches key
+    const unsigned char* in = bytes.data() + blockStarts[low];
+    const unsigned char* end = low + 1 < blockStarts.size()
+        ? bytes.data() + blockStarts[low + 1] : bytes.data() + bytes.size();
+    unsigned int length = GetVarint(in);
+    string current((const char*)in, length);
+    in += length;
+    size_t rank = blockRanks[low];
+    while (current < key) {
+        rank++;
+        if (in == end) {
+            // key sorts after this whole block, so the next anchor is it
+            if (found != nullptr && rank < count) {
+                *found = Anchor(low + 1);
+            }
+            return rank;
+        }
+        unsigned int shared = GetVarint(in);
+        unsigned int suffix = GetVarint(in);
+        current.resize(shared);
+        current.append((const char*)in, suffix);
+        in += suffix;
+    }
+    if (found != nullptr) {
+        *found = current;
+    }
+    return rank;
+}
+
+/**
+ * Decode the ID at a rank
+ *
+ * @param rank Position in sorted order, below Count()
+ * @return The ID
+ */
+string FrontCodedIds::Get(size_t rank) const {
+    vector<string> ids;
+    Decode(rank, rank + 1, ids);
+    return ids.empty() ? string() : ids[0];
+}
+
+/**
+ * Look up an ID
+ *
+ * @param courseId The ID to find
+ * @param rank Receives its position in sorted order
+ * @return true if the ID is in the dictionary
+ */
+bool FrontCodedIds::Find(const string& courseId, size_t& rank) const {
+    string found;
+    rank = LowerBoundRank(courseId, &found);
+    return rank < count && found == courseId;
+}
+
+/**
+ * Ranks of the IDs starting with a prefix, as the half-open range
+ * [first, last)
+ */
+void FrontCodedIds::PrefixRange(const string& prefix, size_t& first, size_t& last) const {
+    first = LowerBoundRank(prefix, nullptr);
+    // the smallest key above every ID with the prefix
+    string upper = prefix;
+    while (!upper.empty() && (unsigned char)upper.back() == 0xFF) {
+        upper.pop_back();
+    }
+    if (upper.empty()) {
+        last = count;
+        return;
+    }
+    upper.back() = (char)((unsigned char)upper.back() + 1);
+    last = LowerBoundRank(upper, nullptr);
+}
+
+/**
+ * Decode the IDs with ranks in [first, last) in order
+ *
+ * @param ids Receives the IDs
+ */
+void FrontCodedIds::Decode(size_t first, size_t last, vector<string>& ids) const {
+    ids.clear();
+    last = min(last, count);
+    if (first >= last) {
+        return;
+    }
+    size_t block = BlockOf(first);
+    const unsigned char* in = bytes.data() + blockStarts[block];
+    string current;
+    for (size_t rank = blockRanks[block]; rank < last; rank++) {
+        if (block < blockStarts.size() && in == bytes.data() + blockStarts[block]) {
+            block++;
+            unsigned int length = GetVarint(in);
+            current.assign((const char*)in, length);
+            in += length;
+        }
+        else {
+            unsigned int shared = GetVarint(in);
+            unsigned int suffix = GetVarint(in);
+            current.resize(shared);
+            current.append((const char*)in, suffix);
+            in += suffix;
+        }
+        if (rank >= first) {
+            ids.push_back(current);
+        }
+    }
+}
+
+//============================================================================
+// Learned index over natural course sort keys
+//============================================================================
+
+// maximum distance between a predicted and an actual position
+const unsigned int LEARNED_EPSILON = 16;
+
+/**
+ * Natural sort key of a course ID: the department letters as a base-27
+ * number above the course number, so "CSCI99" sorts before "CSCI100"
+ * and the numbers of one department are dense. Characters after the
+ * number do not contribute; equal keys are told apart by the full ID.
+ *
+ * @param courseId The ID to convert
+ * @return The 64-bit key
+ */
+uint64_t naturalSortKey(const string& courseId) {
+    uint64_t department = 0;
+    size_t i = 0;
+    for (int letters = 0; letters < 6; letters++) {
+        department *= 27;
+        if (i < courseId.size() && isalpha((unsigned char)courseId[i])) {
+            department += toupper((unsigned char)courseId[i]) - 'A' + 1;
+            i++;
+        }
+    }
+    uint64_t number = 0;
+    for (int digits = 0; digits < 10 && i < courseId.size() && isdigit((unsigned char)courseId[i]); digits++) {
+        number = number * 10 + (courseId[i] - '0');
+        i++;
+    }
+    return (department << 34) | min(number, (uint64_t(1) << 34) - 1);
+}
+
+/**
+ * Read-only ordered index for a frozen catalog. IDs are kept sorted by
+ * natural key, and a piecewise linear model (PGM-style) maps a key to
+ * its position within LEARNED_EPSILON, so a lookup is a search over
+ * the segments followed by a search in a window of 2 * epsilon keys.
+ * The course list uses it with --natural-order; since it cannot take
+ * an insert, adding or removing a course drops it until the next list.
+ */
+class LearnedIndex {
+
+private:
+    // one linear piece of the model, valid from firstKey onwards
+    struct Segment {
+        uint64_t firstKey;
+        double slope;
+        size_t firstPosition;
+    };
+
+    vector<uint64_t> keys;
+    vector<string> ids;
+    vector<Segment> segments;
+
+public:
+    void Build(const vector<string>& courseIds);
+    bool Find(const string& courseId, size_t& rank) const;
+    const string& Get(size_t rank) const { return ids[rank]; }
+    size_t Count() const { return ids.size(); }
+    size_t SegmentCount() const { return segments.size(); }
+    size_t ModelBytes() const { return segments.capacity() * sizeof(Segment); }
+};
+
+/**
+ * Sort the IDs by natural key and fit the segments
+ *
+ * @param courseIds The IDs to index, in any order
+ */
+void LearnedIndex::Build(const vector<string>& courseIds) {
+    vector<pair<uint64_t, string>> sorted;
+    sorted.reserve(courseIds.size());
+    for (size_t i = 0; i < courseIds.size(); i++) {
+        sorted.push_back(make_pair(naturalSortKey(courseIds[i]), courseIds[i]));
+    }
+    sort(sorted.begin(), sorted.end());
+    keys.clear();
+    ids.clear();
+    segments.clear();
+    for (size_t i = 0; i < sorted.size(); i++) {
+        keys.push_back(sorted[i].first);
+        ids.push_back(sorted[i].second);
+    }
+
+    // Greedy shrinking cone: extend a segment while some slope keeps
+    // every distinct key's first position within epsilon of the line
+    size_t i = 0;
+    while (i < keys.size()) {
+        Segment segment;
+        segment.firstKey = keys[i];
+        segment.firstPosition = i;
+        double lowSlope = 0.0;
+        double highSlope = 1e300;
+        size_t j = i + 1;
+        while (j < keys.size()) {
+            // only the first of a run of equal keys is ever predicted
+            if (keys[j] == keys[j - 1]) {
+                j++;
+                continue;
+            }
+            double dx = double(keys[j] - segment.firstKey);
+            double dy = double(j - i);
+            double low = max(lowSlope, (dy - LEARNED_EPSILON) / dx);
+            double high = min(highSlope, (dy + LEARNED_EPSILON) / dx);
+            if (low > high) {
+                break;
+            }
+            lowSlope = low;
+            highSlope = high;
+            j++;
+        }
+        segment.slope = highSlope >= 1e300 ? 0.0 : (lowSlope + highSlope) / 2;
+        segments.push_back(segment);
+        i = j;
+    }
+    segments.shrink_to_fit();
+}
+
+/**
+ * Look up an ID
+ *
+ * @param courseId The ID to find
+ * @param rank Receives its position in natural order
+ * @return true if the ID is in the index
+ */
+bool LearnedIndex::Find(const string& courseId, size_t& rank) const {
+    if (keys.empty()) {
+        return false;
+    }
+    uint64_t key = naturalSortKey(courseId);
+    // last segment starting at or before the key
+    size_t low = 0;
+    size_t high = segments.size();
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (segments[middle].firstKey <= key) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    const Segment& segment = segments[low];
+    double predicted = segment.firstPosition;
+    if (key > segment.firstKey) {
+        predicted += segment.slope * double(key - segment.firstKey);
+    }
+
+    // the true position is within epsilon of the prediction
+    size_t position = size_t(max(predicted, 0.0));
+    size_t first = position > LEARNED_EPSILON ? position - LEARNED_EPSILON : 0;
+    size_t last = min(keys.size(), position + LEARNED_EPSILON + 2);
+    first = min(first, keys.size());
+    rank = lower_bound(keys.begin() + first, keys.begin() + last, key) - keys.begin();
+    // equal keys are separated by the full ID
+    while (rank < keys.size() && keys[rank] == key) {
+        if (ids[rank] == courseId) {
+            return true;
+        }
+        rank++;
+    }
+    return false;
+}
+
+/**
+ * Print every course in natural ID order, so CSCI99 comes before CSCI100
+ *
+ * @param natural The index over the table's IDs
+ * @param hashTable The table to take titles from
+ */
+void printCoursesInNaturalOrder(const LearnedIndex& natural, HashTable* hashTable) {
+    for (size_t rank = 0; rank < natural.Count(); rank++) {
+        Course course = hashTable->Search(natural.Get(rank));
+        cout << " " << course.courseId << ", " << course.courseTitle << endl;
+    }
+}
+
+//============================================================================
+// Catalog snapshots and diffs
+//============================================================================
+
+// identifies a catalog snapshot file and its layout version
+const char SNAPSHOT_MAGIC[8] = { 'A', 'B', 'C', 'U', 'S', 'N', 'P', '1' };
+
+/**
+ * Hash of everything in a course except its ID, so two versions of a
+ * course can be compared without looking at their fields
+ *
+ * @param course The course to hash
+ * @return The content hash
+ */
+uint64_t courseContentHash(const Course& course) {
+    uint64_t hash = hashBytes(course.courseTitle.data(), course.courseTitle.size(), 14695981039346656037ULL);
+    for (size_t i = 0; i < course.prerequisites.size(); i++) {
+        // a separator keeps ("AB", "C") apart from ("A", "BC")
+        hash = hashBytes("", 1, hash);
+        hash = hashBytes(course.prerequisites[i].data(), course.prerequisites[i].size(), hash);
+    }
+    return hash;
+}
+
+/**
+ * Append a length-prefixed string to a snapshot record
+ */
+template <typename Length>
+void putSnapshotString(string& out, const string& text) {
+    Length length = (Length)text.size();
+    out.append((const char*)&length, sizeof(length));
+    out.append(text.data(), length);
+}
+
+/**
+ * Read a length-prefixed string from a snapshot record
+ *
+ * @return false if the record ends early
+ */
+template <typename Length>
+bool getSnapshotString(const char*& in, const char* end, string& text) {
+    Length length;
+    if (end - in < (ptrdiff_t)sizeof(length)) {
+        return false;
+    }
+    memcpy(&length, in, sizeof(length));
+    in += sizeof(length);
+    if (end - in < (ptrdiff_t)length) {
+        return false;
+    }
+    text.assign(in, length);
+    in += length;
+    return true;
+}
+
+/**
+ * Append a course's ID, title and prerequisites in snapshot row encoding
+ */
+void encodeSnapshotRow(const Course& course, string& out) {
+    uint16_t prerequisites = (uint16_t)course.prerequisites.size();
+    putSnapshotString<uint16_t>(out, course.courseId);
+    putSnapshotString<uint32_t>(out, course.courseTitle);
+    out.append((const char*)&prerequisites, sizeof(prerequisites));
+    for (int j = 0; j < prerequisites; j++) {
+        putSnapshotString<uint16_t>(out, course.prerequisites[j]);
+    }
+}
+
+/**
+ * Read a course written by encodeSnapshotRow
+ *
+ * @return false if the row ends early
+ */
+bool decodeSnapshotRow(const char*& in, const char* end, Course& course) {
+    uint16_t prerequisites;
+    if (!getSnapshotString<uint16_t>(in, end, course.courseId)
+        || !getSnapshotString<uint32_t>(in, end, course.courseTitle)
+        || end - in < (ptrdiff_t)sizeof(prerequisites)) {
+        return false;
+    }
+    memcpy(&prerequisites, in, sizeof(prerequisites));
+    in += sizeof(prerequisites);
+    course.prerequisites.resize(prerequisites);
+    for (int j = 0; j < prerequisites; j++) {
+        if (!getSnapshotString<uint16_t>(in, end, course.prerequisites[j])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Flush a file that was written through a stream to stable storage
+ *
+ * @return true if the file could be synced
+ */
+bool syncPath(string path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Directory part of a path, for syncing renames into it
+ */
+string directoryOf(string path) {
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? string(".") : slash == 0 ? string("/") : path.substr(0, slash);
+}
+
+/**
+ * Write every course to a snapshot file in ID order.
+ *
+ * Layout: magic, row count, then per row an 8-byte content hash, the
+ * ID (2-byte length), the title (4-byte length), a 2-byte prerequisite
+ * count and each prerequisite (2-byte length). Integers are in host
+ * byte order. The file is synced and renamed into place once
+ * complete, then its directory is synced. A repeated ID is written
+ * once, as the copy Search finds.
+ *
+ * @param hashTable The table to save
+ * @param path The snapshot path
+ * @return true if the snapshot was written
+ */
+bool saveSnapshot(HashTable* hashTable, string path) {
+    vector<Course> courses;
+    hashTable->Snapshot(courses, true);
+    // stable, so of a repeated ID the copy Search finds stays first
+    stable_sort(courses.begin(), courses.end(), less_than_key());
+    courses.erase(unique(courses.begin(), courses.end(), [](const Course& a, const Course& b) {
+        return a.courseId == b.courseId;
+    }), courses.end());
+    string tempPath = path + ".tmp";
+    ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    uint64_t count = courses.size();
+    out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    out.write((const char*)&count, sizeof(count));
+    string record;
+    for (size_t i = 0; i < courses.size(); i++) {
+        const Course& course = courses[i];
+        uint64_t hash = courseContentHash(course);
+        record.clear();
+        record.append((const char*)&hash, sizeof(hash));
+        encodeSnapshotRow(course, record);
+        out.write(record.data(), record.size());
+    }
+    out.close();
+    if (out.fail() || !syncPath(tempPath)) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return rename(tempPath.c_str(), path.c_str()) == 0 && syncPath(directoryOf(path));
+}
+
+// one course as seen by a diff: its ID and content hash
+struct CatalogRow {
+    string courseId;
+    uint64_t contentHash;
+};
+
+/**
+ * Courses of one catalog version in ascending ID order, one at a time.
+ * Only the ID and content hash are produced up front; the full course
+ * is read back only when a diff needs its fields.
+ */
+class CatalogStream {
+
+public:
+    virtual ~CatalogStream() { }
+    virtual bool Next(CatalogRow& row) = 0;
+    virtual Course Current() = 0;
+    // true if Next stopped at a damaged row rather than the end
+    virtual bool Damaged() const { return false; }
+};
+
+/**
+ * Streams a snapshot file front to back straight from the mapping
+ */
+class SnapshotStream : public CatalogStream {
+
+private:
+    MappedFile file;
+    const char* cursor = nullptr;
+    const char* end = nullptr;
+    // start of the row Next last returned
+    const char* current = nullptr;
+    // ID of that row, so a repeat of it is skipped
+    string previousId;
+    bool started = false;
+    // row count from the header, and rows read so far
+    uint64_t rows = 0;
+    uint64_t read = 0;
+    bool damaged = false;
+
+    bool ReadRow(const char*& in, Course* course, uint64_t* hash);
+    bool ReadNext(Course& course, uint64_t* hash);
+
+public:
+    bool Open(string path, bool readAhead = false);
+    bool Next(CatalogRow& row);
+    Course Current();
+    bool Read(Course& course);
+    bool Damaged() const { return damaged; }
+};
+
+/**
+ * Map a snapshot and check its header
+ *
+ * @param readAhead true to read the whole file up front with batched
+ *        reads, when every row is about to be loaded
+ * @return true if path is a snapshot
+ */
+bool SnapshotStream::Open(string path, bool readAhead) {
+    if (!(readAhead ? file.Read(path) : file.Open(path)) || file.Size() < sizeof(SNAPSHOT_MAGIC) + sizeof(uint64_t)
+        || memcmp(file.Data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return false;
+    }
+    memcpy(&rows, file.Data() + sizeof(SNAPSHOT_MAGIC), sizeof(rows));
+    cursor = file.Data() + sizeof(SNAPSHOT_MAGIC) + sizeof(uint64_t);
+    end = file.Data() + file.Size();
+    return true;
+}
+
+/**
+ * Decode one row and advance past it
+ *
+ * @param in Cursor at the start of the row
+ * @param course Receives the course, if not null
+ * @param hash Receives the content hash, if not null
+ * @return false at the end of the file or on a truncated row
+ */
+bool SnapshotStream::ReadRow(const char*& in, Course* course, uint64_t* hash) {
+    Course row;
+    uint64_t contentHash;
+    if (end - in < (ptrdiff_t)sizeof(contentHash)) {
+        return false;
+    }
+    memcpy(&contentHash, in, sizeof(contentHash));
+    in += sizeof(contentHash);
+    if (!decodeSnapshotRow(in, end, row)) {
+        return false;
+    }
+    if (course != nullptr) {
+        *course = row;
+    }
+    if (hash != nullptr) {
+        *hash = contentHash;
+    }
+    return true;
+}
+
+/**
+ * Read the next row with a new ID, checking the rows against the header:
+ * a short or garbled row, fewer rows than the header counts or bytes
+ * after the last row mark the snapshot damaged
+ *
+ * @return false at the end of the snapshot or at damage
+ */
+bool SnapshotStream::ReadNext(Course& course, uint64_t* hash) {
+    do {
+        if (damaged) {
+            return false;
+        }
+        if (read == rows) {
+            damaged = cursor != end;
+            return false;
+        }
+        current = cursor;
+        if (!ReadRow(cursor, &course, hash)) {
+            damaged = true;
+            return false;
+        }
+        read++;
+    } while (started && course.courseId == previousId);
+    started = true;
+    previousId = course.courseId;
+    return true;
+}
+
+/**
+ * Rows are in ID order; when an ID repeats, as in snapshots of tables
+ * holding duplicates, the first row wins
+ */
+bool SnapshotStream::Next(CatalogRow& row) {
+    Course course;
+    if (!ReadNext(course, &row.contentHash)) {
+        return false;
+    }
+    row.courseId = course.courseId;
+    return true;
+}
+
+Course SnapshotStream::Current() {
+    Course course;
+    const char* in = current;
+    ReadRow(in, &course, nullptr);
+    return course;
+}
+
+/**
+ * Read the next whole course, for loading rather than diffing
+ *
+ * @return false at the end of the snapshot or at damage
+ */
+bool SnapshotStream::Read(Course& course) {
+    return ReadNext(course, nullptr);
+}
+
+/**
+ * Streams a CSV in ID order. One pass over the mapping records each
+ * row's ID, content hash and offset; those small entries are sorted and
+ * the row itself is only parsed again for the fields of a modified
+ * course. When an ID repeats, the first row wins, as with Search.
+ */
+class CsvStream : public CatalogStream {
+
+private:
+    struct Entry {
+        string courseId;
+        uint64_t contentHash;
+        size_t offset;
+    };
+
+    MappedFile file;
+    vector<Entry> entries;
+    size_t position = 0;
+
+public:
+    bool Open(string path);
+    bool Next(CatalogRow& row);
+    Course Current();
+};
+
+/**
+ * Index every row of the CSV
+ *
+ * @return true if the file could be read
+ */
+bool CsvStream::Open(string path) {
+    if (!file.Open(path)) {
+        return false;
+    }
+    const char* data = file.Data();
+    size_t size = file.Size();
+    // first line is the header, the same as csv::Parser treats it
+    size_t offset = findLineEnd(data, size, 0);
+    offset = offset < size ? offset + 1 : size;
+    vector<string> fields;
+    while (offset < size) {
+        size_t next = parseCsvRow(data, size, offset, fields);
+        if (!fields[0].empty()) {
+            Course course;
+            course.courseTitle = fields.size() > 1 ? fields[1] : string();
+            course.prerequisites.assign(fields.begin() + min(fields.size(), size_t(2)), fields.end());
+            Entry entry;
+            entry.courseId = fields[0];
+            entry.contentHash = courseContentHash(course);
+            entry.offset = offset;
+            entries.push_back(entry);
+        }
+        offset = next;
+    }
+    stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.courseId < b.courseId;
+    });
+    return true;
+}
+
+bool CsvStream::Next(CatalogRow& row) {
+    // skip later rows that repeat an ID
+    while (position > 0 && position < entries.size()
+        && entries[position].courseId == entries[position - 1].courseId) {
+        position++;
+    }
+    if (position >= entries.size()) {
+        return false;
+    }
+    row.courseId = entries[position].courseId;
+    row.contentHash = entries[position].contentHash;
+    position++;
+    return true;
+}
+
+Course CsvStream::Current() {
+    vector<string> fields;
+    parseCsvRow(file.Data(), file.Size(), entries[position - 1].offset, fields);
+    Course course;
+    course.courseId = fields[0];
+    if (fields.size() > 1) {
+        course.courseTitle = fields[1];
+    }
+    for (size_t j = 2; j < fields.size(); j++) {
+        course.prerequisites.push_back(fields[j]);
+    }
+    return course;
+}
+
+/**
+ * Open a catalog version as a stream, as a snapshot if the file has the
+ * snapshot header and as a CSV otherwise
+ *
+ * @param path The snapshot or CSV path
+ * @return The stream, or nullptr if the file cannot be read
+ */
+CatalogStream* openCatalogStream(string path) {
+    SnapshotStream* snapshot = new SnapshotStream();
+    if (snapshot->Open(path)) {
+        return snapshot;
+    }
+    delete snapshot;
+    CsvStream* csv = new CsvStream();
+    if (csv->Open(path)) {
+        return csv;
+    }
+    delete csv;
+    return nullptr;
+}
+
+/**
+ * Print the fields that differ between two versions of a course
+ */
+void printCourseChanges(const Course& before, const Course& after) {
+    cout << "~ " << after.courseId << endl;
+    if (before.courseTitle != after.courseTitle) {
+        cout << "    title: \"" << before.courseTitle << "\" -> \"" << after.courseTitle << "\"" << endl;
+    }
+    vector<string> oldPrerequisites = before.prerequisites;
+    vector<string> newPrerequisites = after.prerequisites;
+    sort(oldPrerequisites.begin(), oldPrerequisites.end());
+    sort(newPrerequisites.begin(), newPrerequisites.end());
+    vector<string> added;
+    vector<string> removed;
+    set_difference(newPrerequisites.begin(), newPrerequisites.end(),
+        oldPrerequisites.begin(), oldPrerequisites.end(), back_inserter(added));
+    set_difference(oldPrerequisites.begin(), oldPrerequisites.end(),
+        newPrerequisites.begin(), newPrerequisites.end(), back_inserter(removed));
+    for (size_t i = 0; i < added.size(); i++) {
+        cout << "    prerequisite added: " << added[i] << endl;
+    }
+    for (size_t i = 0; i < removed.size(); i++) {
+        cout << "    prerequisite removed: " << removed[i] << endl;
+    }
+    // same set of prerequisites, listed in a different order
+    if (added.empty() && removed.empty() && before.prerequisites != after.prerequisites) {
+        cout << "    prerequisites reordered" << endl;
+    }
+}
+
+/**
+ * Compare two catalog versions with one merge pass over their sorted
+ * IDs. Rows whose content hashes match are skipped without parsing.
+ *
+ * @param oldPath The earlier snapshot or CSV
+ * @param newPath The later snapshot or CSV
+ * @return false if either version could not be read or is damaged
+ */
+bool diffCatalogs(string oldPath, string newPath) {
+    CatalogStream* before = openCatalogStream(oldPath);
+    CatalogStream* after = openCatalogStream(newPath);
+    if (before == nullptr || after == nullptr) {
+        cout << "Could not read " << (before == nullptr ? oldPath : newPath) << endl;
+        delete before;
+        delete after;
+        return false;
+    }
+
+    size_t added = 0;
+    size_t removed = 0;
+    size_t modified = 0;
+    CatalogRow oldRow;
+    CatalogRow newRow;
+    bool hasOld = before->Next(oldRow);
+    bool hasNew = after->Next(newRow);
+    while ((hasOld || hasNew) && !before->Damaged() && !after->Damaged()) {
+        if (hasOld && (!hasNew || oldRow.courseId < newRow.courseId)) {
+            Course course = before->Current();
+            cout << "- " << course.courseId << ", " << course.courseTitle << endl;
+            removed++;
+            hasOld = before->Next(oldRow);
+        }
+        else if (hasNew && (!hasOld || newRow.courseId < oldRow.courseId)) {
+            Course course = after->Current();
+            cout << "+ " << course.courseId << ", " << course.courseTitle << endl;
+            added++;
+            hasNew = after->Next(newRow);
+        }
+        else {
+            if (oldRow.contentHash != newRow.contentHash) {
+                printCourseChanges(before->Current(), after->Current());
+                modified++;
+            }
+            hasOld = before->Next(oldRow);
+            hasNew = after->Next(newRow);
+        }
+    }
+    if (before->Damaged() || after->Damaged()) {
+        cout << (before->Damaged() ? oldPath : newPath) << " is damaged" << endl;
+        delete before;
+        delete after;
+        return false;
+    }
+    cout << added << " added, " << removed << " removed, " << modified << " modified" << endl;
+    delete before;
+    delete after;
+    return true;
+}
+
+//============================================================================
+// Write-ahead log
+//============================================================================
+
+// identifies a write-ahead log file and its layout version
+const char WAL_MAGIC[8] = { 'A', 'B', 'C', 'U', 'W', 'A', 'L', '1' };
+
+// log record operations
+const char WAL_PUT = 'P';
+const char WAL_ERASE = 'E';
+
+/**
+ * CRC-32 (IEEE) of a byte string
+ */
+uint32_t crc32(const char* data, size_t size) {
+    static uint32_t table[256];
+    static once_flag built;
+    call_once(built, []() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    });
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * Read every course of a snapshot into a table
+ *
+ * @return false if path is not a complete snapshot: it must hold exactly
+ *         the rows its header counts and end after the last one
+ */
+bool loadSnapshot(string path, HashTable* hashTable) {
+    SnapshotStream snapshot;
+    if (!snapshot.Open(path, true)) {
+        return false;
+    }
+    Course course;
+    while (snapshot.Read(course)) {
+        hashTable->Insert(course);
+    }
+    return !snapshot.Damaged();
+}
+
+/**
+ * Makes catalog changes durable. Attached to a table as a listener, it
+ * logs every insert, update and removal before the table applies it,
+ * and refuses the change if the record could not be made durable.
+ *
+ * Files, for a log at path:
+ *   path       magic, then records of: 4-byte length, CRC-32 of the
+ *              body, and a body of 8-byte LSN, operation byte, payload
+ *   path.snap  checkpoint in the snapshot format
+ *   path.ckpt  LSN of the last record included in the checkpoint
+ * A put carries the whole course in snapshot row encoding; an erase
+ * carries the ID. Integers are in host byte order.
+ *
+ * Appends use group commit: the first writer to find no flush in
+ * flight writes and syncs every record queued so far, while later
+ * writers wait for that flush or lead the next one. Concurrent writers
+ * therefore share one fdatasync instead of paying one each.
+ *
+ * A checkpoint saves the table as a snapshot, records its LSN and then
+ * empties the log. Recovery loads the checkpoint and replays only the
+ * records after its LSN. Every record is a whole course or an erase,
+ * so replaying a record the checkpoint already holds is harmless,
+ * which covers a crash between any two steps of a checkpoint. A torn
+ * or corrupt record ends the log and is cut off.
+ */
+class WriteAheadLog : public CatalogListener {
+
+private:
+    string path;
+    int fd = -1;
+    mutex lock;
+    condition_variable flushed;
+    string pending;
+    uint64_t nextLsn = 1;
+    uint64_t pendingLsn = 0;
+    uint64_t durableLsn = 0;
+    bool flushing = false;
+    bool failed = false;
+    // paused while bulk loads go straight into a checkpoint
+    bool logging = true;
+    uint64_t checkpointLsn = 0;
+    size_t syncs = 0;
+
+    uint64_t Append(char operation, const string& payload);
+    bool WriteCheckpointLsn(uint64_t lsn);
+
+public:
+    virtual ~WriteAheadLog() { Close(); }
+    bool Open(string logPath, HashTable* hashTable, size_t& replayed);
+    void Close();
+    bool Accept(const Course* before, const Course* after);
+    void CourseChanged(const Course*, const Course*) { }
+    uint64_t Put(const Course& course);
+    uint64_t Erase(const string& courseId);
+    bool Checkpoint(HashTable* hashTable);
+    void SetLogging(bool enabled) { logging = enabled; }
+    size_t SinceCheckpoint();
+    size_t Syncs();
+};
+
+/**
+ * Recover a table from the checkpoint and log, then open the log for
+ * appending. Attach the log as a listener only after this returns, so
+ * the replay is not logged again.
+ *
+ * @param logPath Path of the log; the files are created if missing
+ * @param hashTable An empty table to recover into
+ * @param replayed Receives the number of log records replayed
+ * @return false if the log could not be opened or written
+ */
+bool WriteAheadLog::Open(string logPath, HashTable* hashTable, size_t& replayed) {
+#ifndef _WIN32
+    path = logPath;
+    replayed = 0;
+    checkpointLsn = 0;
+    ifstream manifest((path + ".ckpt").c_str());
+    if (manifest >> checkpointLsn) {
+        if (!loadSnapshot(path + ".snap", hashTable)) {
+            std::cerr << "Checkpoint " << path << ".snap is missing or damaged" << std::endl;
+            return false;
+        }
+    }
+    nextLsn = checkpointLsn + 1;
+
+    size_t validEnd = sizeof(WAL_MAGIC);
+    MappedFile file;
+    if (file.Open(path) && file.Size() >= sizeof(WAL_MAGIC)) {
+        const char* data = file.Data();
+        size_t size = file.Size();
+        if (memcmp(data, WAL_MAGIC, sizeof(WAL_MAGIC)) != 0) {
+            std::cerr << path << " is not a write-ahead log" << std::endl;
+            return false;
+        }
+        size_t offset = sizeof(WAL_MAGIC);
+        uint32_t length, checksum;
+        uint64_t lsn;
+        while (size - offset >= sizeof(length) + sizeof(checksum)) {
+            memcpy(&length, data + offset, sizeof(length));
+            memcpy(&checksum, data + offset + sizeof(length), sizeof(checksum));
+            const char* body = data + offset + sizeof(length) + sizeof(checksum);
+            if (length < sizeof(lsn) + 1 || size - offset - sizeof(length) - sizeof(checksum) < length
+                || crc32(body, length) != checksum) {
+                break;
+            }
+            memcpy(&lsn, body, sizeof(lsn));
+            char operation = body[sizeof(lsn)];
+            const char* in = body + sizeof(lsn) + 1;
+            const char* end = body + length;
+            if (lsn > checkpointLsn) {
+                Course course;
+                if (operation == WAL_PUT && decodeSnapshotRow(in, end, course)) {
+                    hashTable->Update(course);
+                }
+                else if (operation == WAL_ERASE && getSnapshotString<uint16_t>(in, end, course.courseId)) {
+                    hashTable->Remove(course.courseId);
+                }
+                replayed++;
+            }
+            nextLsn = max(nextLsn, lsn + 1);
+            offset += sizeof(length) + sizeof(checksum) + length;
+        }
+        validEnd = offset;
+        if (validEnd < size) {
+            std::cerr << "Dropped " << (size - validEnd) << " bytes of torn or damaged log at the end of "
+                << path << std::endl;
+        }
+    }
+    file.Close();
+
+    // appends land at the end even after a checkpoint truncates the log
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    if (info.st_size < (off_t)sizeof(WAL_MAGIC)) {
+        if (ftruncate(fd, 0) != 0 || write(fd, WAL_MAGIC, sizeof(WAL_MAGIC)) != (ssize_t)sizeof(WAL_MAGIC)) {
+            return false;
+        }
+        validEnd = sizeof(WAL_MAGIC);
+    }
+    // later appends go after the last good record
+    if (ftruncate(fd, validEnd) != 0 || fdatasync(fd) != 0) {
+        return false;
+    }
+    durableLsn = nextLsn - 1;
+    pendingLsn = durableLsn;
+    return true;
+#else
+    std::cerr << "The write-ahead log is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+/**
+ * Close the log file
+ */
+void WriteAheadLog::Close() {
+#ifndef _WIN32
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+/**
+ * Append one record and wait until it is on stable storage
+ *
+ * @return The record's LSN, or 0 if the log could not be written
+ */
+uint64_t WriteAheadLog::Append(char operation, const string& payload) {
+#ifndef _WIN32
+    unique_lock<mutex> guard(lock);
+    if (failed || fd < 0) {
+        return 0;
+    }
+    uint64_t lsn = nextLsn++;
+    string body;
+    body.append((const char*)&lsn, sizeof(lsn));
+    body.push_back(operation);
+    body.append(payload);
+    uint32_t length = body.size();
+    uint32_t checksum = crc32(body.data(), body.size());
+    pending.append((const char*)&length, sizeof(length));
+    pending.append((const char*)&checksum, sizeof(checksum));
+    pending.append(body);
+    pendingLsn = lsn;
+
+    while (durableLsn < lsn && !failed) {
+        if (flushing) {
+            flushed.wait(guard);
+            continue;
+        }
+        // lead a flush of everything queued so far
+        flushing = true;
+        string batch;
+        batch.swap(pending);
+        uint64_t batchLsn = pendingLsn;
+        guard.unlock();
+        bool written = true;
+        for (size_t sent = 0; written && sent < batch.size(); ) {
+            ssize_t wrote = write(fd, batch.data() + sent, batch.size() - sent);
+            written = wrote > 0;
+            sent += written ? wrote : 0;
+        }
+        written = written && fdatasync(fd) == 0;
+        guard.lock();
+        flushing = false;
+        syncs++;
+        if (written) {
+            durableLsn = batchLsn;
+        }
+        else {
+            failed = true;
+            std::cerr << "Write-ahead log " << path << " failed: " << strerror(errno) << std::endl;
+        }
+        flushed.notify_all();
+    }
+    return failed ? 0 : lsn;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Log a course as it should now read
+ */
+uint64_t WriteAheadLog::Put(const Course& course) {
+    string payload;
+    encodeSnapshotRow(course, payload);
+    return Append(WAL_PUT, payload);
+}
+
+/**
+ * Log the removal of a course
+ */
+uint64_t WriteAheadLog::Erase(const string& courseId) {
+    string payload;
+    putSnapshotString<uint16_t>(payload, courseId);
+    return Append(WAL_ERASE, payload);
+}
+
+/**
+ * Log a change before the table applies it
+ *
+ * @return false if the record could not be made durable
+ */
+bool WriteAheadLog::Accept(const Course* before, const Course* after) {
+    if (!logging) {
+        return true;
+    }
+    return (after != nullptr ? Put(*after) : Erase(before->courseId)) != 0;
+}
+
+/**
+ * Records logged since the last checkpoint
+ */
+size_t WriteAheadLog::SinceCheckpoint() {
+    lock_guard<mutex> guard(lock);
+    return nextLsn - 1 - checkpointLsn;
+}
+
+/**
+ * Number of fdatasync calls made for appends so far
+ */
+size_t WriteAheadLog::Syncs() {
+    lock_guard<mutex> guard(lock);
+    return syncs;
+}
+
+/**
+ * Durably record the LSN a checkpoint covers
+ */
+bool WriteAheadLog::WriteCheckpointLsn(uint64_t lsn) {
+    string manifestPath = path + ".ckpt";
+    string tempPath = manifestPath + ".tmp";
+    ofstream out(tempPath.c_str(), ios::trunc);
+    out << lsn << "\n";
+    out.close();
+    if (out.fail() || !syncPath(tempPath) || rename(tempPath.c_str(), manifestPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return syncPath(directoryOf(manifestPath));
+}
+
+/**
+ * Save the table as the new checkpoint and empty the log. Call it from
+ * the thread that changes the table, between changes, so the table
+ * holds exactly the records logged so far.
+ *
+ * @return true if the checkpoint was written
+ */
+bool WriteAheadLog::Checkpoint(HashTable* hashTable) {
+#ifndef _WIN32
+    if (fd < 0) {
+        return false;
+    }
+    uint64_t lsn;
+    {
+        lock_guard<mutex> guard(lock);
+        lsn = nextLsn - 1;
+    }
+    string snapshotPath = path + ".snap";
+    if (!saveSnapshot(hashTable, snapshotPath) || !WriteCheckpointLsn(lsn)) {
+        std::cerr << "Could not write checkpoint " << snapshotPath << std::endl;
+        return false;
+    }
+    // everything logged is in the checkpoint, so the log starts over
+    lock_guard<mutex> guard(lock);
+    checkpointLsn = lsn;
+    if (ftruncate(fd, sizeof(WAL_MAGIC)) != 0 || fdatasync(fd) != 0) {
+        std::cerr << "Could not truncate " << path << std::endl;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Measure group commit: several threads each log a run of updates to
+ * a scratch log and the number of syncs they shared is reported
+ *
+ * @param scratchPath Where to put the scratch log, removed afterwards
+ */
+void benchmarkWriteAheadLog(string scratchPath) {
+    const int perThread = 200;
+    int threads = max(4u, thread::hardware_concurrency());
+    remove(scratchPath.c_str());
+    remove((scratchPath + ".ckpt").c_str());
+    remove((scratchPath + ".snap").c_str());
+    HashTable scratch;
+    WriteAheadLog log;
+    size_t replayed;
+    if (!log.Open(scratchPath, &scratch, replayed)) {
+        return;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&log, t, perThread]() {
+            Course course;
+            course.courseTitle = "Write-ahead log benchmark";
+            course.prerequisites.push_back("CSCI100");
+            for (int i = 0; i < perThread; i++) {
+                course.courseId = "WAL" + to_string(t) + "-" + to_string(i);
+                log.Put(course);
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t records = size_t(threads) * perThread;
+    size_t syncs = max(log.Syncs(), size_t(1));
+    cout << threads << " threads logged " << records << " updates in " << llround(seconds * 1000)
+        << " milliseconds, " << llround(records / max(seconds, 1e-9)) << " commits/sec" << endl;
+    cout << syncs << " syncs, " << double(records) / syncs << " records per sync" << endl;
+
+    log.Close();
+    HashTable recovered;
+    WriteAheadLog check;
+    check.Open(scratchPath, &recovered, replayed);
+    check.Close();
+    cout << "Recovery replayed " << replayed << " records" << endl;
+    remove(scratchPath.c_str());
+
+    // a change, a checkpoint, another change, then a crash: closing
+    // without a checkpoint leaves the files as a crash would
+    HashTable table;
+    WriteAheadLog crashed;
+    if (!crashed.Open(scratchPath, &table, replayed)) {
+        return;
+    }
+    table.AddListener(&crashed);
+    Course course;
+    course.courseTitle = "Write-ahead log benchmark";
+    course.courseId = "WALBEFORE";
+    table.Update(course);
+    crashed.Checkpoint(&table);
+    course.courseId = "WALAFTER";
+    table.Update(course);
+    crashed.Close();
+    HashTable restarted;
+    WriteAheadLog reopened;
+    reopened.Open(scratchPath, &restarted, replayed);
+    reopened.Close();
+    bool kept = !restarted.Search("WALBEFORE").courseId.empty() && !restarted.Search("WALAFTER").courseId.empty();
+    cout << "Change, checkpoint, change, crash: " << (kept ? "both changes recovered" : "CHANGES LOST") << endl;
+    remove(scratchPath.c_str());
+    remove((scratchPath + ".ckpt").c_str());
+    remove((scratchPath + ".snap").c_str());
+}
+
+//============================================================================
+// Prerequisite graph
+//============================================================================
+
+// fewest items worth starting a thread for
+const size_t PARALLEL_GRAIN = 256;
+
+/**
+ * Split the range [0, count) into one contiguous chunk per hardware
+ * thread and run body(begin, end) on each chunk in parallel. Each
+ * thread gets at least grain items, so small ranges, such as most
+ * height levels of a catalog, run on the calling thread.
+ *
+ * @param count Number of items
+ * @param body Work for one chunk of items
+ * @param grain Fewest items per thread
+ */
+void parallelFor(size_t count, function<void(size_t, size_t)> body, size_t grain = PARALLEL_GRAIN) {
+    size_t threads = max(1u, thread::hardware_concurrency());
+    threads = min(threads, max((count + grain - 1) / grain, size_t(1)));
+    if (threads == 1) {
+        body(0, count);
+        return;
+    }
+    vector<thread> workers;
+    size_t chunk = (count + threads - 1) / threads;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        workers.push_back(thread(body, begin, min(count, begin + chunk)));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+/**
+ * Courses as numbered vertices with prerequisite edges resolved to
+ * vertex numbers, stored in compressed (CSR) adjacency arrays in both
+ * directions. Vertices are numbered in course ID order. Prerequisites
+ * that name no course in the catalog are left out.
+ */
+class CourseGraph {
+
+public:
+    vector<string> ids;
+    vector<string> titles;
+    // prerequisites of v are prereqs[prereqStart[v] .. prereqStart[v + 1])
+    vector<unsigned int> prereqStart;
+    vector<unsigned int> prereqs;
+    // courses listing v as a prerequisite, in the same layout
+    vector<unsigned int> dependentStart;
+    vector<unsigned int> dependents;
+    size_t unresolved = 0;
+
+    void Build(HashTable* hashTable);
+    void Build(const vector<Course>& courses);
+    size_t Count() const { return ids.size(); }
+    int IndexOf(const string& courseId) const;
+    size_t Heights(vector<unsigned int>& height) const;
+};
+
+/**
+ * Build the graph from every course in a table
+ */
+void CourseGraph::Build(HashTable* hashTable) {
+    vector<Course> courses;
+    hashTable->Sort(courses);
+    Build(courses);
+}
+
+/**
+ * Build the graph from courses sorted by ID
+ *
+ * @param courses The courses, in ascending ID order
+ */
+void CourseGraph::Build(const vector<Course>& courses) {
+    ids.clear();
+    titles.clear();
+    for (size_t i = 0; i < courses.size(); i++) {
+        // a repeated ID keeps its first course, as Search does
+        if (!ids.empty() && ids.back() == courses[i].courseId) {
+            continue;
+        }
+        ids.push_back(courses[i].courseId);
+        titles.push_back(courses[i].courseTitle);
+    }
+
+    prereqStart.assign(1, 0);
+    prereqs.clear();
+    unresolved = 0;
+    vector<unsigned int> dependentCount(ids.size(), 0);
+    size_t vertex = 0;
+    for (size_t i = 0; i < courses.size(); i++) {
+        if (i > 0 && courses[i].courseId == courses[i - 1].courseId) {
+            continue;
+        }
+        for (size_t j = 0; j < courses[i].prerequisites.size(); j++) {
+            int prerequisite = IndexOf(courses[i].prerequisites[j]);
+            if (prerequisite < 0) {
+                unresolved++;
+                continue;
+            }
+            prereqs.push_back(prerequisite);
+            dependentCount[prerequisite]++;
+        }
+        prereqStart.push_back(prereqs.size());
+        vertex++;
+    }
+
+    // reverse edges by counting sort on the prerequisite side
+    dependentStart.assign(ids.size() + 1, 0);
+    for (size_t v = 0; v < ids.size(); v++) {
+        dependentStart[v + 1] = dependentStart[v] + dependentCount[v];
+    }
+    dependents.assign(prereqs.size(), 0);
+    vector<unsigned int> fill(dependentStart.begin(), dependentStart.end() - 1);
+    for (size_t v = 0; v < ids.size(); v++) {
+        for (unsigned int e = prereqStart[v]; e < prereqStart[v + 1]; e++) {
+            dependents[fill[prereqs[e]]++] = v;
+        }
+    }
+}
+
+/**
+ * Vertex number of a course
+ *
+ * @return The vertex, or -1 if the course is not in the graph
+ */
+int CourseGraph::IndexOf(const string& courseId) const {
+    vector<string>::const_iterator it = lower_bound(ids.begin(), ids.end(), courseId);
+    if (it == ids.end() || *it != courseId) {
+        return -1;
+    }
+    return it - ids.begin();
+}
+
+/**
+ * Height of every vertex: the longest chain of dependents below it, so
+ * a course nothing depends on has height 0 and every dependent of a
+ * course is strictly lower than the course itself. Vertices on or above
+ * a prerequisite cycle have no height and get UINT_MAX.
+ *
+ * @param height Receives the height of each vertex
+ * @return The number of vertices without a height
+ */
+size_t CourseGraph::Heights(vector<unsigned int>& height) const {
+    size_t count = ids.size();
+    height.assign(count, UINT_MAX);
+    // Kahn's algorithm from the courses nothing depends on upwards
+    vector<unsigned int> pending(count);
+    vector<unsigned int> ready;
+    for (size_t v = 0; v < count; v++) {
+        pending[v] = dependentStart[v + 1] - dependentStart[v];
+        if (pending[v] == 0) {
+            height[v] = 0;
+            ready.push_back(v);
+        }
+    }
+    size_t done = 0;
+    while (!ready.empty()) {
+        unsigned int v = ready.back();
+        ready.pop_back();
+        done++;
+        for (unsigned int e = prereqStart[v]; e < prereqStart[v + 1]; e++) {
+            unsigned int prerequisite = prereqs[e];
+            if (height[prerequisite] == UINT_MAX || height[prerequisite] < height[v] + 1) {
+                height[prerequisite] = height[v] + 1;
+            }
+            if (--pending[prerequisite] == 0) {
+                ready.push_back(prerequisite);
+            }
+        }
+    }
+    // anything never released sits on or above a cycle
+    for (size_t v = 0; v < count; v++) {
+        if (pending[v] != 0) {
+            height[v] = UINT_MAX;
+        }
+    }
+    return count - done;
+}
+
+//============================================================================
+// Unlock count ranking
+//============================================================================
+
+// graphs up to this many courses get exact bitset counts (128 MB)
+const size_t EXACT_UNLOCK_LIMIT = 1 << 15;
+// HyperLogLog registers per course are 2^precision, about 9% error
+const unsigned int HLL_PRECISION = 7;
+
+/**
+ * 64-bit finalizer used to spread vertex numbers for HyperLogLog
+ */
+uint64_t mixBits(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Cardinality estimate of a HyperLogLog sketch
+ *
+ * @param registers The sketch's 2^HLL_PRECISION registers
+ * @return The estimated number of distinct items
+ */
+double estimateHll(const unsigned char* registers) {
+    const size_t m = size_t(1) << HLL_PRECISION;
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t j = 0; j < m; j++) {
+        sum += ldexp(1.0, -int(registers[j]));
+        zeros += registers[j] == 0;
+    }
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    // linear counting is far more accurate for small sets
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(double(m) / zeros);
+    }
+    return estimate;
+}
+
+/**
+ * Number of courses that transitively depend on each course, i.e. how
+ * many courses it unlocks. Courses are processed a height at a time,
+ * lowest first, so every dependent of a course is finished before it;
+ * the courses of one height are independent and run in parallel. Each
+ * course's set is the union of its dependents and their sets: a bitset
+ * for catalogs up to EXACT_UNLOCK_LIMIT courses, a HyperLogLog sketch
+ * (union = register-wise max) beyond that. Courses caught in a cycle
+ * are counted by a breadth-first search of their own.
+ *
+ * @param graph The prerequisite graph
+ * @param counts Receives the (possibly estimated) count per vertex
+ * @return true if the counts are exact
+ */
+bool countUnlocks(const CourseGraph& graph, vector<double>& counts) {
+    size_t count = graph.Count();
+    counts.assign(count, 0.0);
+    vector<unsigned int> height;
+    size_t cyclic = graph.Heights(height);
+
+    // group vertices by height
+    unsigned int tallest = 0;
+    for (size_t v = 0; v < count; v++) {
+        if (height[v] != UINT_MAX) {
+            tallest = max(tallest, height[v]);
+        }
+    }
+    vector<vector<unsigned int>> levels(count > 0 ? tallest + 1 : 0);
+    for (size_t v = 0; v < count; v++) {
+        if (height[v] != UINT_MAX) {
+            levels[height[v]].push_back(v);
+        }
+    }
+
+    bool exact = count <= EXACT_UNLOCK_LIMIT;
+    if (exact) {
+        size_t words = (count + 63) / 64;
+        vector<uint64_t> reach(count * words, 0);
+        for (size_t level = 0; level < levels.size(); level++) {
+            const vector<unsigned int>& members = levels[level];
+            parallelFor(members.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    unsigned int v = members[i];
+                    uint64_t* bits = &reach[v * words];
+                    for (unsigned int e = graph.dependentStart[v]; e < graph.dependentStart[v + 1]; e++) {
+                        unsigned int d = graph.dependents[e];
+                        bits[d / 64] |= uint64_t(1) << (d % 64);
+                        kernels.bitsetOr(bits, &reach[d * words], words);
+                    }
+                    counts[v] = kernels.bitsetCount(bits, words);
+                }
+            });
+        }
+    }
+    else {
+        const size_t m = size_t(1) << HLL_PRECISION;
+        vector<unsigned char> sketches(count * m, 0);
+        for (size_t level = 0; level < levels.size(); level++) {
+            const vector<unsigned int>& members = levels[level];
+            parallelFor(members.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    unsigned int v = members[i];
+                    unsigned char* registers = &sketches[v * m];
+                    for (unsigned int e = graph.dependentStart[v]; e < graph.dependentStart[v + 1]; e++) {
+                        unsigned int d = graph.dependents[e];
+                        // add the dependent itself
+                        uint64_t hash = mixBits(d);
+                        size_t slot = hash >> (64 - HLL_PRECISION);
+                        uint64_t rest = (hash << HLL_PRECISION) | (uint64_t(1) << (HLL_PRECISION - 1));
+                        unsigned char rank = (unsigned char)(__builtin_clzll(rest) + 1);
+                        registers[slot] = max(registers[slot], rank);
+                        // and everything it unlocks
+                        const unsigned char* other = &sketches[d * m];
+                        for (size_t j = 0; j < m; j++) {
+                            registers[j] = max(registers[j], other[j]);
+                        }
+                    }
+                    bool empty = graph.dependentStart[v] == graph.dependentStart[v + 1];
+                    counts[v] = empty ? 0.0 : estimateHll(registers);
+                }
+            });
+        }
+    }
+
+    // courses with no height are counted one search at a time
+    if (cyclic > 0) {
+        vector<unsigned int> stuck;
+        for (size_t v = 0; v < count; v++) {
+            if (height[v] == UINT_MAX) {
+                stuck.push_back(v);
+            }
+        }
+        parallelFor(stuck.size(), [&](size_t begin, size_t end) {
+            vector<bool> seen(count);
+            vector<unsigned int> queue;
+            for (size_t i = begin; i < end; i++) {
+                fill(seen.begin(), seen.end(), false);
+                queue.assign(1, stuck[i]);
+                size_t reached = 0;
+                for (size_t q = 0; q < queue.size(); q++) {
+                    unsigned int v = queue[q];
+                    for (unsigned int e = graph.dependentStart[v]; e < graph.dependentStart[v + 1]; e++) {
+                        unsigned int d = graph.dependents[e];
+                        if (!seen[d]) {
+                            seen[d] = true;
+                            reached++;
+                            queue.push_back(d);
+                        }
+                    }
+                }
+                counts[stuck[i]] = reached;
+            }
+        }, 1);
+    }
+    return exact;
+}
+
+/**
+ * Print the courses that unlock the most other courses
+ *
+ * @param hashTable The loaded table
+ * @param limit Number of courses to list
+ */
+void rankUnlocks(HashTable* hashTable, size_t limit) {
+    // wall time, since clock() adds up the CPU time of every thread
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    CourseGraph graph;
+    graph.Build(hashTable);
+    vector<double> counts;
+    bool exact = countUnlocks(graph, counts);
+    long long milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    vector<unsigned int> order(graph.Count());
+    for (size_t v = 0; v < order.size(); v++) {
+        order[v] = v;
+    }
+    limit = min(limit, order.size());
+    partial_sort(order.begin(), order.begin() + limit, order.end(), [&](unsigned int a, unsigned int b) {
+        return counts[a] > counts[b] || (counts[a] == counts[b] && a < b);
+    });
+
+    for (size_t i = 0; i < limit; i++) {
+        unsigned int v = order[i];
+        cout << " " << (i + 1) << ". " << graph.ids[v] << ", " << graph.titles[v] << " unlocks "
+            << (exact ? "" : "~") << (size_t)llround(counts[v]) << " courses" << endl;
+    }
+    cout << "Ranked " << graph.Count() << " courses " << (exact ? "exactly" : "by HyperLogLog estimate")
+        << " in " << milliseconds << " milliseconds" << endl;
+}
+
+//============================================================================
+// Reachability index for transitive prerequisite queries
+//============================================================================
+
+// random interval labelings kept per component (GRAIL's k)
+const unsigned int REACH_LABELS = 3;
+
+/**
+ * Answers "is A a (transitive) prerequisite of B" in memory linear in
+ * the graph. Prerequisite cycles are collapsed into strongly connected
+ * components first, giving a DAG whose component numbers are already a
+ * topological order. Each component then gets a depth and REACH_LABELS
+ * GRAIL interval labels from randomized depth-first traversals: if B
+ * reaches A, A's intervals nest inside B's and A is shallower. Most
+ * negative queries fail those checks outright; the rest run a search
+ * that skips every branch whose labels rule A out.
+ */
+class ReachabilityIndex {
+
+private:
+    vector<unsigned int> component;
+    vector<unsigned int> componentSize;
+    // components whose courses require themselves: a cycle of several
+    // courses, or one course listed as its own prerequisite
+    vector<bool> cyclic;
+    // component DAG in CSR form, edges point at prerequisites
+    vector<unsigned int> edgeStart;
+    vector<unsigned int> edges;
+    vector<unsigned int> depth;
+    // per label: [low, post] interval of each component
+    vector<unsigned int> low[REACH_LABELS];
+    vector<unsigned int> post[REACH_LABELS];
+    // per-query visit marks; one query at a time
+    vector<unsigned int> visited;
+    unsigned int epoch = 0;
+
+    bool Contains(unsigned int outer, unsigned int inner) const;
+
+public:
+    void Build(const CourseGraph& graph);
+    bool IsPrerequisite(int prerequisite, int course);
+    size_t ComponentCount() const { return componentSize.size(); }
+    size_t MemoryBytes() const;
+};
+
+/**
+ * Collapse cycles, then label the component DAG
+ */
+void ReachabilityIndex::Build(const CourseGraph& graph) {
+    size_t count = graph.Count();
+    const unsigned int unvisited = UINT_MAX;
+
+    // Tarjan's algorithm with an explicit stack of (vertex, next edge)
+    component.assign(count, unvisited);
+    componentSize.clear();
+    vector<unsigned int> index(count, unvisited);
+    vector<unsigned int> lowLink(count, 0);
+    vector<bool> onStack(count, false);
+    vector<unsigned int> stack;
+    vector<pair<unsigned int, unsigned int>> calls;
+    unsigned int counter = 0;
+    for (size_t root = 0; root < count; root++) {
+        if (index[root] != unvisited) {
+            continue;
+        }
+        calls.push_back(make_pair((unsigned int)root, graph.prereqStart[root]));
+        index[root] = lowLink[root] = counter++;
+        stack.push_back(root);
+        onStack[root] = true;
+        while (!calls.empty()) {
+            unsigned int v = calls.back().first;
+            unsigned int& e = calls.back().second;
+            if (e < graph.prereqStart[v + 1]) {
+                unsigned int w = graph.prereqs[e++];
+                if (index[w] == unvisited) {
+                    index[w] = lowLink[w] = counter++;
+                    stack.push_back(w);
+                    onStack[w] = true;
+                    calls.push_back(make_pair(w, graph.prereqStart[w]));
+                }
+                else if (onStack[w]) {
+                    lowLink[v] = min(lowLink[v], index[w]);
+                }
+                continue;
+            }
+            // v is finished; it roots a component if nothing looped above it
+            if (lowLink[v] == index[v]) {
+                unsigned int id = componentSize.size();
+                unsigned int size = 0;
+                unsigned int w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    onStack[w] = false;
+                    component[w] = id;
+                    size++;
+                } while (w != v);
+                componentSize.push_back(size);
+            }
+            calls.pop_back();
+            if (!calls.empty()) {
+                unsigned int parent = calls.back().first;
+                lowLink[parent] = min(lowLink[parent], lowLink[v]);
+            }
+        }
+    }
+
+    // component edges; prerequisites always have lower numbers
+    size_t components = componentSize.size();
+    cyclic.assign(components, false);
+    for (size_t c = 0; c < components; c++) {
+        cyclic[c] = componentSize[c] > 1;
+    }
+    vector<vector<unsigned int>> adjacency(components);
+    for (size_t v = 0; v < count; v++) {
+        for (unsigned int e = graph.prereqStart[v]; e < graph.prereqStart[v + 1]; e++) {
+            unsigned int w = graph.prereqs[e];
+            if (component[w] != component[v]) {
+                adjacency[component[v]].push_back(component[w]);
+            }
+            else if (w == v) {
+                cyclic[component[v]] = true;
+            }
+        }
+    }
+    edgeStart.assign(1, 0);
+    edges.clear();
+    for (size_t c = 0; c < components; c++) {
+        sort(adjacency[c].begin(), adjacency[c].end());
+        adjacency[c].erase(unique(adjacency[c].begin(), adjacency[c].end()), adjacency[c].end());
+        edges.insert(edges.end(), adjacency[c].begin(), adjacency[c].end());
+        edgeStart.push_back(edges.size());
+        vector<unsigned int>().swap(adjacency[c]);
+    }
+
+    // depth = longest prerequisite chain below, in numbering order
+    depth.assign(components, 0);
+    for (size_t c = 0; c < components; c++) {
+        for (unsigned int e = edgeStart[c]; e < edgeStart[c + 1]; e++) {
+            depth[c] = max(depth[c], depth[edges[e]] + 1);
+        }
+    }
+
+    // randomized post-order traversals for the interval labels
+    mt19937 random(7);
+    vector<unsigned int> roots(components);
+    for (size_t c = 0; c < components; c++) {
+        roots[c] = c;
+    }
+    vector<unsigned int> firstEdge(components);
+    for (size_t k = 0; k < REACH_LABELS; k++) {
+        low[k].assign(components, unvisited);
+        post[k].assign(components, unvisited);
+        shuffle(roots.begin(), roots.end(), random);
+        // each component walks its edges from a random starting point
+        for (size_t c = 0; c < components; c++) {
+            unsigned int degree = edgeStart[c + 1] - edgeStart[c];
+            firstEdge[c] = degree == 0 ? 0 : random() % degree;
+        }
+        unsigned int order = 0;
+        vector<pair<unsigned int, unsigned int>> walk;
+        for (size_t r = 0; r < components; r++) {
+            if (post[k][roots[r]] != unvisited || low[k][roots[r]] != unvisited) {
+                continue;
+            }
+            walk.push_back(make_pair(roots[r], 0u));
+            low[k][roots[r]] = UINT_MAX - 1;
+            while (!walk.empty()) {
+                unsigned int c = walk.back().first;
+                unsigned int& step = walk.back().second;
+                unsigned int degree = edgeStart[c + 1] - edgeStart[c];
+                if (step < degree) {
+                    unsigned int w = edges[edgeStart[c] + (firstEdge[c] + step) % degree];
+                    step++;
+                    if (low[k][w] == unvisited) {
+                        low[k][w] = UINT_MAX - 1;
+                        walk.push_back(make_pair(w, 0u));
+                    }
+                    continue;
+                }
+                post[k][c] = order++;
+                low[k][c] = post[k][c];
+                for (unsigned int e = edgeStart[c]; e < edgeStart[c + 1]; e++) {
+                    low[k][c] = min(low[k][c], low[k][edges[e]]);
+                }
+                walk.pop_back();
+            }
+        }
+    }
+    visited.assign(components, 0);
+    epoch = 0;
+}
+
+/**
+ * True if every label of inner nests inside the same label of outer
+ */
+bool ReachabilityIndex::Contains(unsigned int outer, unsigned int inner) const {
+    for (size_t k = 0; k < REACH_LABELS; k++) {
+        if (low[k][inner] < low[k][outer] || post[k][inner] > post[k][outer]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Is one course a direct or transitive prerequisite of another
+ *
+ * @param prerequisite Vertex of the possible prerequisite (A)
+ * @param course Vertex of the course that may require it (B)
+ * @return true if B needs A
+ */
+bool ReachabilityIndex::IsPrerequisite(int prerequisite, int course) {
+    if (prerequisite < 0 || course < 0) {
+        return false;
+    }
+    unsigned int target = component[prerequisite];
+    unsigned int source = component[course];
+    if (source == target) {
+        // only a cycle, or a self-loop, makes a course require itself
+        // or its partner
+        return cyclic[source];
+    }
+    if (depth[source] <= depth[target] || !Contains(source, target)) {
+        return false;
+    }
+
+    // guided search: only enter components whose labels admit the target
+    if (++epoch == 0) {
+        fill(visited.begin(), visited.end(), 0);
+        epoch = 1;
+    }
+    vector<unsigned int> pending(1, source);
+    visited[source] = epoch;
+    while (!pending.empty()) {
+        unsigned int c = pending.back();
+        pending.pop_back();
+        for (unsigned int e = edgeStart[c]; e < edgeStart[c + 1]; e++) {
+            unsigned int w = edges[e];
+            if (w == target) {
+                return true;
+            }
+            if (visited[w] != epoch && depth[w] > depth[target] && Contains(w, target)) {
+                visited[w] = epoch;
+                pending.push_back(w);
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Bytes held by the index
+ */
+size_t ReachabilityIndex::MemoryBytes() const {
+    size_t words = component.capacity() + componentSize.capacity() + edgeStart.capacity()
+        + edges.capacity() + depth.capacity() + visited.capacity() + cyclic.capacity() / 32;
+    for (size_t k = 0; k < REACH_LABELS; k++) {
+        words += low[k].capacity() + post[k].capacity();
+    }
+    return words * sizeof(unsigned int);
+}
+
+/**
+ * Plain breadth-first answer to the same question, for checking
+ */
+bool isPrerequisiteBySearch(const CourseGraph& graph, int prerequisite, int course) {
+    vector<bool> seen(graph.Count(), false);
+    vector<unsigned int> queue(1, course);
+    for (size_t q = 0; q < queue.size(); q++) {
+        unsigned int v = queue[q];
+        for (unsigned int e = graph.prereqStart[v]; e < graph.prereqStart[v + 1]; e++) {
+            unsigned int w = graph.prereqs[e];
+            if ((int)w == prerequisite) {
+                return true;
+            }
+            if (!seen[w]) {
+                seen[w] = true;
+                queue.push_back(w);
+            }
+        }
+    }
+    return false;
+}
+
+//============================================================================
+// Incrementally maintained dependency structures
+//============================================================================
+
+// level of a course that sits on a prerequisite cycle
+const unsigned int NO_LEVEL = UINT_MAX;
+
+/**
+ * Keeps the transitive closure, levels and dependents of the catalog
+ * current as courses are inserted, updated and removed, instead of
+ * rebuilding them from scratch after each change.
+ *
+ * Every change touches one course. Only that course and the courses
+ * that transitively require it can have a different closure or level,
+ * so just that subgraph is recomputed, in topological order: each
+ * course's closure is the union of {q} and closure(q) over its
+ * prerequisites q, and its level is one more than the deepest of them.
+ * Courses on a prerequisite cycle, and those below one, are settled by
+ * a fixpoint afterwards. Unlock counts are adjusted from the bits that
+ * changed. Prerequisites naming a course not in the catalog are
+ * remembered and connected when that course arrives.
+ */
+class DependencyTracker : public CatalogListener {
+
+private:
+    unordered_map<string, unsigned int> vertexOf;
+    vector<string> ids;
+    vector<bool> present;
+    vector<vector<unsigned int>> prereqsOf;
+    vector<vector<unsigned int>> dependentsOf;
+    // courses listing a prerequisite ID that is not in the catalog
+    unordered_map<string, vector<unsigned int>> waiting;
+    // the missing IDs each course waits on, one per entry in waiting
+    vector<vector<string>> waitsOn;
+    // transitive prerequisites of each course as a bitset
+    vector<vector<uint64_t>> closure;
+    vector<unsigned int> level;
+    // number of courses whose closure holds each course
+    vector<unsigned int> unlocks;
+    size_t words = 0;
+    // scratch kept between changes: a vertex is marked when its mark
+    // equals epoch, so starting a pass never clears the whole vector
+    vector<unsigned int> mark;
+    vector<unsigned int> unsorted;
+    unsigned int epoch = 0;
+
+    unsigned int VertexFor(const string& courseId);
+    void Clear();
+    void NextEpoch();
+    void Connect(unsigned int v, const vector<string>& prerequisites);
+    void Disconnect(unsigned int v);
+    void Affected(const vector<unsigned int>& seeds, vector<unsigned int>& affected);
+    void TopologicalOrder(const vector<unsigned int>& vertices, vector<unsigned int>& order,
+        vector<unsigned int>& rest);
+    bool Close(unsigned int x, vector<uint64_t>& next);
+    unsigned int Depth(unsigned int x) const;
+    void Recompute(const vector<unsigned int>& affected);
+    bool InClosure(unsigned int v, unsigned int bit) const;
+    int Find(const string& courseId) const;
+
+public:
+    void Rebuild(HashTable* hashTable);
+    void Rebuild(const vector<Course>& courses);
+    void CourseChanged(const Course* before, const Course* after);
+    void Reloaded(HashTable* hashTable) { Rebuild(hashTable); }
+    bool Requires(const string& courseId, const string& prerequisiteId) const;
+    unsigned int Level(const string& courseId) const;
+    size_t PrerequisiteCount(const string& courseId) const;
+    size_t UnlockCount(const string& courseId) const;
+    void Dependents(const string& courseId, vector<string>& courseIds) const;
+};
+
+/**
+ * Vertex of a course ID, creating an absent one if needed. Bitsets grow
+ * by doubling so adding courses one at a time stays cheap.
+ */
+unsigned int DependencyTracker::VertexFor(const string& courseId) {
+    unordered_map<string, unsigned int>::iterator it = vertexOf.find(courseId);
+    if (it != vertexOf.end()) {
+        return it->second;
+    }
+    unsigned int v = ids.size();
+    vertexOf[courseId] = v;
+    ids.push_back(courseId);
+    present.push_back(false);
+    prereqsOf.push_back(vector<unsigned int>());
+    dependentsOf.push_back(vector<unsigned int>());
+    waitsOn.push_back(vector<string>());
+    level.push_back(0);
+    unlocks.push_back(0);
+    mark.push_back(0);
+    unsorted.push_back(0);
+    if (ids.size() > words * 64) {
+        words = max(words * 2, size_t(1));
+        for (size_t i = 0; i < closure.size(); i++) {
+            closure[i].resize(words, 0);
+        }
+    }
+    closure.push_back(vector<uint64_t>(words, 0));
+    return v;
+}
+
+/**
+ * Forget every course
+ */
+void DependencyTracker::Clear() {
+    vertexOf.clear();
+    ids.clear();
+    present.clear();
+    prereqsOf.clear();
+    dependentsOf.clear();
+    waiting.clear();
+    waitsOn.clear();
+    closure.clear();
+    level.clear();
+    unlocks.clear();
+    words = 0;
+    mark.clear();
+    unsorted.clear();
+    epoch = 0;
+}
+
+/**
+ * Start a pass over the scratch marks, unmarking every vertex at once
+ */
+void DependencyTracker::NextEpoch() {
+    if (++epoch == 0) {
+        fill(mark.begin(), mark.end(), 0);
+        epoch = 1;
+    }
+}
+
+/**
+ * Vertex of a course in the catalog, or -1
+ */
+int DependencyTracker::Find(const string& courseId) const {
+    unordered_map<string, unsigned int>::const_iterator it = vertexOf.find(courseId);
+    if (it == vertexOf.end() || !present[it->second]) {
+        return -1;
+    }
+    return it->second;
+}
+
+/**
+ * Add the prerequisite edges of a course; missing ones wait
+ */
+void DependencyTracker::Connect(unsigned int v, const vector<string>& prerequisites) {
+    for (size_t i = 0; i < prerequisites.size(); i++) {
+        int p = Find(prerequisites[i]);
+        if (p < 0) {
+            waiting[prerequisites[i]].push_back(v);
+            waitsOn[v].push_back(prerequisites[i]);
+            continue;
+        }
+        prereqsOf[v].push_back(p);
+        dependentsOf[p].push_back(v);
+    }
+}
+
+/**
+ * Drop the prerequisite edges of a course, resolved or waiting
+ */
+void DependencyTracker::Disconnect(unsigned int v) {
+    for (size_t i = 0; i < prereqsOf[v].size(); i++) {
+        vector<unsigned int>& back = dependentsOf[prereqsOf[v][i]];
+        back.erase(find(back.begin(), back.end(), v));
+    }
+    prereqsOf[v].clear();
+    for (size_t i = 0; i < waitsOn[v].size(); i++) {
+        unordered_map<string, vector<unsigned int>>::iterator it = waiting.find(waitsOn[v][i]);
+        it->second.erase(find(it->second.begin(), it->second.end(), v));
+        if (it->second.empty()) {
+            waiting.erase(it);
+        }
+    }
+    waitsOn[v].clear();
+}
+
+/**
+ * The seeds plus every course that transitively requires one of them
+ */
+void DependencyTracker::Affected(const vector<unsigned int>& seeds, vector<unsigned int>& affected) {
+    NextEpoch();
+    affected.clear();
+    for (size_t i = 0; i < seeds.size(); i++) {
+        if (mark[seeds[i]] != epoch) {
+            mark[seeds[i]] = epoch;
+            affected.push_back(seeds[i]);
+        }
+    }
+    for (size_t i = 0; i < affected.size(); i++) {
+        const vector<unsigned int>& next = dependentsOf[affected[i]];
+        for (size_t j = 0; j < next.size(); j++) {
+            if (mark[next[j]] != epoch) {
+                mark[next[j]] = epoch;
+                affected.push_back(next[j]);
+            }
+        }
+    }
+}
+
+/**
+ * Order a set of vertices so each comes after its prerequisites in the
+ * set. Vertices on a cycle, or requiring one, cannot be ordered and are
+ * left in rest.
+ */
+void DependencyTracker::TopologicalOrder(const vector<unsigned int>& vertices, vector<unsigned int>& order,
+    vector<unsigned int>& rest) {
+    NextEpoch();
+    for (size_t i = 0; i < vertices.size(); i++) {
+        mark[vertices[i]] = epoch;
+    }
+    order.clear();
+    rest.clear();
+    for (size_t i = 0; i < vertices.size(); i++) {
+        unsigned int x = vertices[i];
+        unsorted[x] = 0;
+        for (size_t j = 0; j < prereqsOf[x].size(); j++) {
+            unsorted[x] += mark[prereqsOf[x][j]] == epoch;
+        }
+        if (unsorted[x] == 0) {
+            order.push_back(x);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        const vector<unsigned int>& next = dependentsOf[order[i]];
+        for (size_t j = 0; j < next.size(); j++) {
+            if (mark[next[j]] == epoch && --unsorted[next[j]] == 0) {
+                order.push_back(next[j]);
+            }
+        }
+    }
+    for (size_t i = 0; i < vertices.size(); i++) {
+        if (unsorted[vertices[i]] > 0) {
+            rest.push_back(vertices[i]);
+        }
+    }
+}
+
+bool DependencyTracker::InClosure(unsigned int v, unsigned int bit) const {
+    return (closure[v][bit / 64] >> (bit % 64)) & 1;
+}
+
+/**
+ * Set a closure to the union of its prerequisites and their closures,
+ * moving unlock counts by exactly the bits that flipped
+ *
+ * @param next Scratch of words entries
+ * @return true if the closure changed
+ */
+bool DependencyTracker::Close(unsigned int x, vector<uint64_t>& next) {
+    fill(next.begin(), next.end(), 0);
+    for (size_t j = 0; j < prereqsOf[x].size(); j++) {
+        unsigned int q = prereqsOf[x][j];
+        next[q / 64] |= uint64_t(1) << (q % 64);
+        kernels.bitsetOr(next.data(), closure[q].data(), words);
+    }
+    bool changed = false;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t old = closure[x][w];
+        for (uint64_t gained = next[w] & ~old; gained != 0; gained &= gained - 1) {
+            unlocks[w * 64 + __builtin_ctzll(gained)]++;
+        }
+        for (uint64_t lost = old & ~next[w]; lost != 0; lost &= lost - 1) {
+            unlocks[w * 64 + __builtin_ctzll(lost)]--;
+        }
+        changed = changed || next[w] != old;
+    }
+    if (changed) {
+        closure[x].swap(next);
+    }
+    return changed;
+}
+
+/**
+ * Level from the prerequisites' levels: 1 + deepest acyclic one, and
+ * NO_LEVEL on a cycle
+ */
+unsigned int DependencyTracker::Depth(unsigned int x) const {
+    if (InClosure(x, x)) {
+        return NO_LEVEL;
+    }
+    unsigned int depth = 0;
+    for (size_t j = 0; j < prereqsOf[x].size(); j++) {
+        unsigned int q = prereqsOf[x][j];
+        if (level[q] != NO_LEVEL) {
+            depth = max(depth, level[q] + 1);
+        }
+    }
+    return depth;
+}
+
+/**
+ * Recompute closures, unlock counts and levels of an affected set
+ */
+void DependencyTracker::Recompute(const vector<unsigned int>& affected) {
+    vector<unsigned int> order, rest;
+    TopologicalOrder(affected, order, rest);
+
+    // prerequisites come first, so one visit settles each closure
+    vector<uint64_t> next(words);
+    for (size_t i = 0; i < order.size(); i++) {
+        Close(order[i], next);
+    }
+    // cycles settle by a fixpoint from empty closures
+    for (size_t i = 0; i < rest.size(); i++) {
+        vector<uint64_t>& bits = closure[rest[i]];
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t lost = bits[w]; lost != 0; lost &= lost - 1) {
+                unlocks[w * 64 + __builtin_ctzll(lost)]--;
+            }
+            bits[w] = 0;
+        }
+    }
+    bool changed = !rest.empty();
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < rest.size(); i++) {
+            if (Close(rest[i], next)) {
+                changed = true;
+            }
+        }
+    }
+
+    // levels in the same order; below a cycle they need their own order
+    for (size_t i = 0; i < order.size(); i++) {
+        level[order[i]] = Depth(order[i]);
+    }
+    vector<unsigned int> below;
+    for (size_t i = 0; i < rest.size(); i++) {
+        if (InClosure(rest[i], rest[i])) {
+            level[rest[i]] = NO_LEVEL;
+        }
+        else {
+            below.push_back(rest[i]);
+        }
+    }
+    TopologicalOrder(below, order, rest);
+    for (size_t i = 0; i < order.size(); i++) {
+        level[order[i]] = Depth(order[i]);
+    }
+}
+
+/**
+ * Start over from every course in a table
+ */
+void DependencyTracker::Rebuild(HashTable* hashTable) {
+    Clear();
+    vector<Course> courses;
+    hashTable->Sort(courses);
+    vector<unsigned int> all;
+    for (size_t i = 0; i < courses.size(); i++) {
+        unsigned int v = VertexFor(courses[i].courseId);
+        if (!present[v]) {
+            present[v] = true;
+            all.push_back(v);
+        }
+    }
+    for (size_t i = 0; i < all.size(); i++) {
+        // a repeated ID is followed through the copy Search sees
+        unsigned int v = all[i];
+        Connect(v, hashTable->Search(ids[v]).prerequisites);
+    }
+    Recompute(all);
+}
+
+/**
+ * Start over from courses sorted by ID; a repeated ID keeps its first
+ * course. The table is not touched, so this can run on any thread.
+ */
+void DependencyTracker::Rebuild(const vector<Course>& courses) {
+    Clear();
+    vector<unsigned int> all;
+    vector<size_t> first;
+    for (size_t i = 0; i < courses.size(); i++) {
+        unsigned int v = VertexFor(courses[i].courseId);
+        if (!present[v]) {
+            present[v] = true;
+            all.push_back(v);
+            first.push_back(i);
+        }
+    }
+    for (size_t i = 0; i < all.size(); i++) {
+        Connect(all[i], courses[first[i]].prerequisites);
+    }
+    Recompute(all);
+}
+
+/**
+ * Apply one course change
+ *
+ * @param before The course before the change, null if it was added
+ * @param after The course after the change, null if it was removed
+ */
+void DependencyTracker::CourseChanged(const Course* before, const Course* after) {
+    const string& courseId = after != nullptr ? after->courseId : before->courseId;
+    unsigned int v = VertexFor(courseId);
+    vector<unsigned int> seeds(1, v);
+    if (present[v]) {
+        Disconnect(v);
+    }
+    if (after == nullptr) {
+        // courses that required this one now wait for it to come back
+        present[v] = false;
+        for (size_t i = 0; i < dependentsOf[v].size(); i++) {
+            unsigned int x = dependentsOf[v][i];
+            prereqsOf[x].erase(find(prereqsOf[x].begin(), prereqsOf[x].end(), v));
+            waiting[courseId].push_back(x);
+            waitsOn[x].push_back(courseId);
+            seeds.push_back(x);
+        }
+        dependentsOf[v].clear();
+    }
+    else {
+        if (!present[v]) {
+            // courses waiting on this ID get their edge now
+            present[v] = true;
+            unordered_map<string, vector<unsigned int>>::iterator it = waiting.find(courseId);
+            if (it != waiting.end()) {
+                for (size_t i = 0; i < it->second.size(); i++) {
+                    unsigned int x = it->second[i];
+                    prereqsOf[x].push_back(v);
+                    dependentsOf[v].push_back(x);
+                    waitsOn[x].erase(find(waitsOn[x].begin(), waitsOn[x].end(), courseId));
+                }
+                waiting.erase(it);
+            }
+        }
+        Connect(v, after->prerequisites);
+    }
+    vector<unsigned int> affected;
+    Affected(seeds, affected);
+    Recompute(affected);
+}
+
+/**
+ * Does a course directly or transitively require another
+ */
+bool DependencyTracker::Requires(const string& courseId, const string& prerequisiteId) const {
+    int v = Find(courseId);
+    int p = Find(prerequisiteId);
+    return v >= 0 && p >= 0 && InClosure(v, p);
+}
+
+/**
+ * Length of the longest prerequisite chain below a course, NO_LEVEL
+ * for a course on a cycle or not in the catalog
+ */
+unsigned int DependencyTracker::Level(const string& courseId) const {
+    int v = Find(courseId);
+    return v < 0 ? NO_LEVEL : level[v];
+}
+
+/**
+ * Number of courses a course transitively requires
+ */
+size_t DependencyTracker::PrerequisiteCount(const string& courseId) const {
+    int v = Find(courseId);
+    return v < 0 ? 0 : kernels.bitsetCount(closure[v].data(), words);
+}
+
+/**
+ * Number of courses that transitively require a course
+ */
+size_t DependencyTracker::UnlockCount(const string& courseId) const {
+    int v = Find(courseId);
+    return v < 0 ? 0 : unlocks[v];
+}
+
+/**
+ * Courses that list a course as a direct prerequisite, in ID order
+ */
+void DependencyTracker::Dependents(const string& courseId, vector<string>& courseIds) const {
+    courseIds.clear();
+    int v = Find(courseId);
+    if (v < 0) {
+        return;
+    }
+    for (size_t i = 0; i < dependentsOf[v].size(); i++) {
+        courseIds.push_back(ids[dependentsOf[v][i]]);
+    }
+    sort(courseIds.begin(), courseIds.end());
+}
+
+//============================================================================
+// Persistent versioned catalogs
+//============================================================================
+
+// hash bits consumed per trie level; 32 children per node
+const int HAMT_BITS = 5;
+
+/**
+ * A persistent hash array mapped trie of courses. Nodes are immutable
+ * and shared: Set and Erase copy only the nodes on the path to the
+ * changed course (at most seven for a 32-bit hash) and return a new
+ * trie, leaving the old one intact. Each node holds a 32-bit bitmap of
+ * which child slots are in use and a packed array of just those
+ * entries, so a lookup costs one popcount per level. Courses whose
+ * hashes agree in all 32 bits share a collision node at the bottom.
+ */
+class CourseHamt {
+
+public:
+    struct Node;
+    typedef shared_ptr<const Node> NodePtr;
+    typedef shared_ptr<const Course> CoursePtr;
+
+    // a child node, or a course with its hash
+    struct Entry {
+        NodePtr child;
+        CoursePtr course;
+        uint32_t hash = 0;
+    };
+
+    struct Node {
+        uint32_t bitmap = 0;
+        vector<Entry> entries;
+    };
+
+private:
+    NodePtr root;
+    size_t count = 0;
+
+    static NodePtr Set(const NodePtr& node, int shift, const Entry& leaf, bool& added);
+    static NodePtr Erase(const NodePtr& node, int shift, uint32_t hash, const string& courseId, bool& removed);
+    static NodePtr Pair(int shift, const Entry& a, const Entry& b);
+    static void Collect(const NodePtr& node, vector<const Course*>& courses);
+
+public:
+    const Course* Find(const string& courseId) const;
+    CourseHamt Set(const Course& course) const;
+    CourseHamt Erase(const string& courseId) const;
+    size_t Count() const { return count; }
+    void Courses(vector<const Course*>& courses) const;
+    size_t Footprint(unordered_set<const void*>& seen) const;
+};
+
+/**
+ * Slot of a hash at a level, and its position among the used slots
+ */
+inline uint32_t hamtSlot(uint32_t hash, int shift) {
+    return (hash >> shift) & ((1u << HAMT_BITS) - 1);
+}
+
+inline int hamtPosition(uint32_t bitmap, uint32_t slot) {
+    return __builtin_popcount(bitmap & ((1u << slot) - 1));
+}
+
+/**
+ * Look up a course
+ *
+ * @return The course, valid while this trie lives, or nullptr
+ */
+const Course* CourseHamt::Find(const string& courseId) const {
+    uint32_t hash = kernels.hash(courseId.data(), courseId.size());
+    const Node* node = root.get();
+    for (int shift = 0; node != nullptr; shift += HAMT_BITS) {
+        if (shift >= 32) {
+            for (size_t i = 0; i < node->entries.size(); i++) {
+                if (sameId(node->entries[i].course->courseId, courseId)) {
+                    return node->entries[i].course.get();
+                }
+            }
+            return nullptr;
+        }
+        uint32_t slot = hamtSlot(hash, shift);
+        if (!(node->bitmap & (1u << slot))) {
+            return nullptr;
+        }
+        const Entry& entry = node->entries[hamtPosition(node->bitmap, slot)];
+        if (!entry.child) {
+            return sameId(entry.course->courseId, courseId) ? entry.course.get() : nullptr;
+        }
+        node = entry.child.get();
+    }
+    return nullptr;
+}
+
+/**
+ * A node holding two leaves that collided at the level above
+ */
+CourseHamt::NodePtr CourseHamt::Pair(int shift, const Entry& a, const Entry& b) {
+    shared_ptr<Node> node = make_shared<Node>();
+    if (shift >= 32) {
+        node->entries.push_back(a);
+        node->entries.push_back(b);
+        return node;
+    }
+    uint32_t slotA = hamtSlot(a.hash, shift);
+    uint32_t slotB = hamtSlot(b.hash, shift);
+    if (slotA == slotB) {
+        Entry child;
+        child.child = Pair(shift + HAMT_BITS, a, b);
+        node->bitmap = 1u << slotA;
+        node->entries.push_back(child);
+        return node;
+    }
+    node->bitmap = (1u << slotA) | (1u << slotB);
+    node->entries.push_back(slotA < slotB ? a : b);
+    node->entries.push_back(slotA < slotB ? b : a);
+    return node;
+}
+
+/**
+ * Path-copying insert or replace below one node
+ */
+CourseHamt::NodePtr CourseHamt::Set(const NodePtr& node, int shift, const Entry& leaf, bool& added) {
+    if (!node) {
+        shared_ptr<Node> fresh = make_shared<Node>();
+        fresh->bitmap = 1u << hamtSlot(leaf.hash, shift);
+        fresh->entries.push_back(leaf);
+        added = true;
+        return fresh;
+    }
+    shared_ptr<Node> copy = make_shared<Node>(*node);
+    if (shift >= 32) {
+        for (size_t i = 0; i < copy->entries.size(); i++) {
+            if (sameId(copy->entries[i].course->courseId, leaf.course->courseId)) {
+                copy->entries[i] = leaf;
+                return copy;
+            }
+        }
+        copy->entries.push_back(leaf);
+        added = true;
+        return copy;
+    }
+    uint32_t slot = hamtSlot(leaf.hash, shift);
+    int position = hamtPosition(copy->bitmap, slot);
+    if (!(copy->bitmap & (1u << slot))) {
+        copy->bitmap |= 1u << slot;
+        copy->entries.insert(copy->entries.begin() + position, leaf);
+        added = true;
+        return copy;
+    }
+    Entry& entry = copy->entries[position];
+    if (entry.child) {
+        entry.child = Set(entry.child, shift + HAMT_BITS, leaf, added);
+    }
+    else if (sameId(entry.course->courseId, leaf.course->courseId)) {
+        entry = leaf;
+    }
+    else {
+        Entry child;
+        child.child = Pair(shift + HAMT_BITS, entry, leaf);
+        entry = child;
+        added = true;
+    }
+    return copy;
+}
+
+/**
+ * Path-copying removal below one node. A node left with a single
+ * course is folded into its parent so tries stay as shallow as if the
+ * course had never been added.
+ */
+CourseHamt::NodePtr CourseHamt::Erase(const NodePtr& node, int shift, uint32_t hash, const string& courseId,
+    bool& removed) {
+    if (!node) {
+        return node;
+    }
+    if (shift >= 32) {
+        for (size_t i = 0; i < node->entries.size(); i++) {
+            if (sameId(node->entries[i].course->courseId, courseId)) {
+                removed = true;
+                shared_ptr<Node> copy = make_shared<Node>(*node);
+                copy->entries.erase(copy->entries.begin() + i);
+                return copy->entries.empty() ? NodePtr() : NodePtr(copy);
+            }
+        }
+        return node;
+    }
+    uint32_t slot = hamtSlot(hash, shift);
+    if (!(node->bitmap & (1u << slot))) {
+        return node;
+    }
+    int position = hamtPosition(node->bitmap, slot);
+    const Entry& entry = node->entries[position];
+    Entry replacement;
+    bool drop = false;
+    if (entry.child) {
+        NodePtr child = Erase(entry.child, shift + HAMT_BITS, hash, courseId, removed);
+        if (!removed) {
+            return node;
+        }
+        if (!child) {
+            drop = true;
+        }
+        else if (child->entries.size() == 1 && !child->entries[0].child) {
+            replacement = child->entries[0];
+        }
+        else {
+            replacement.child = child;
+        }
+    }
+    else if (sameId(entry.course->courseId, courseId)) {
+        removed = true;
+        drop = true;
+    }
+    else {
+        return node;
+    }
+
+    shared_ptr<Node> copy = make_shared<Node>(*node);
+    if (drop) {
+        copy->bitmap &= ~(1u << slot);
+        copy->entries.erase(copy->entries.begin() + position);
+        if (copy->entries.empty()) {
+            return NodePtr();
+        }
+    }
+    else {
+        copy->entries[position] = replacement;
+    }
+    return copy;
+}
+
+/**
+ * A new trie with a course added or replaced
+ */
+CourseHamt CourseHamt::Set(const Course& course) const {
+    Entry leaf;
+    leaf.course = make_shared<const Course>(course);
+    leaf.hash = kernels.hash(course.courseId.data(), course.courseId.size());
+    bool added = false;
+    CourseHamt next;
+    next.root = Set(root, 0, leaf, added);
+    next.count = count + (added ? 1 : 0);
+    return next;
+}
+
+/**
+ * A new trie without a course; the same trie if it was not there
+ */
+CourseHamt CourseHamt::Erase(const string& courseId) const {
+    bool removed = false;
+    CourseHamt next;
+    next.root = Erase(root, 0, kernels.hash(courseId.data(), courseId.size()), courseId, removed);
+    next.count = count - (removed ? 1 : 0);
+    return next;
+}
+
+void CourseHamt::Collect(const NodePtr& node, vector<const Course*>& courses) {
+    if (!node) {
+        return;
+    }
+    for (size_t i = 0; i < node->entries.size(); i++) {
+        if (node->entries[i].child) {
+            Collect(node->entries[i].child, courses);
+        }
+        else {
+            courses.push_back(node->entries[i].course.get());
+        }
+    }
+}
+
+/**
+ * Every course in the trie, in no particular order
+ */
+void CourseHamt::Courses(vector<const Course*>& courses) const {
+    courses.clear();
+    Collect(root, courses);
+}
+
+/**
+ * Bytes of nodes and courses not already counted in seen, so the
+ * footprint of several versions together counts shared parts once
+ *
+ * @param seen Nodes and courses counted so far, updated
+ * @return Bytes newly counted
+ */
+size_t CourseHamt::Footprint(unordered_set<const void*>& seen) const {
+    size_t bytes = 0;
+    vector<const Node*> pending;
+    if (root && seen.insert(root.get()).second) {
+        pending.push_back(root.get());
+    }
+    while (!pending.empty()) {
+        const Node* node = pending.back();
+        pending.pop_back();
+        bytes += sizeof(Node) + node->entries.capacity() * sizeof(Entry);
+        for (size_t i = 0; i < node->entries.size(); i++) {
+            const Entry& entry = node->entries[i];
+            if (entry.child) {
+                if (seen.insert(entry.child.get()).second) {
+                    pending.push_back(entry.child.get());
+                }
+            }
+            else if (seen.insert(entry.course.get()).second) {
+                bytes += sizeof(Course) + entry.course->courseId.capacity() + courseBodyBytes(*entry.course);
+            }
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Labelled versions of a catalog. Attached to a table it follows every
+ * change into a working trie; tagging a version keeps that trie as it
+ * stands, which costs nothing until later changes copy the paths they
+ * touch.
+ */
+class CatalogVersions : public CatalogListener {
+
+private:
+    CourseHamt working;
+    vector<pair<string, CourseHamt>> versions;
+
+public:
+    void Start(HashTable* hashTable);
+    void CourseChanged(const Course* before, const Course* after);
+    void Reloaded(HashTable* hashTable) { Start(hashTable); }
+    bool Tag(string label);
+    const CourseHamt* Version(string label) const;
+    void PrintVersions() const;
+};
+
+/**
+ * Begin from every course in a table
+ */
+void CatalogVersions::Start(HashTable* hashTable) {
+    vector<string> ids;
+    hashTable->SortedIds(ids);
+    working = CourseHamt();
+    for (size_t i = 0; i < ids.size(); i++) {
+        working = working.Set(hashTable->Search(ids[i]));
+    }
+}
+
+void CatalogVersions::CourseChanged(const Course* before, const Course* after) {
+    working = after != nullptr ? working.Set(*after) : working.Erase(before->courseId);
+}
+
+/**
+ * Keep the catalog as it is now under a label
+ *
+ * @return false if the label is already in use
+ */
+bool CatalogVersions::Tag(string label) {
+    if (Version(label) != nullptr) {
+        return false;
+    }
+    versions.push_back(make_pair(label, working));
+    return true;
+}
+
+/**
+ * A tagged version, or nullptr
+ */
+const CourseHamt* CatalogVersions::Version(string label) const {
+    for (size_t i = 0; i < versions.size(); i++) {
+        if (versions[i].first == label) {
+            return &versions[i].second;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * List the versions and what they cost together versus as full copies
+ */
+void CatalogVersions::PrintVersions() const {
+    unordered_set<const void*> seen;
+    size_t shared = 0;
+    size_t copies = 0;
+    for (size_t i = 0; i < versions.size(); i++) {
+        unordered_set<const void*> alone;
+        shared += versions[i].second.Footprint(seen);
+        copies += versions[i].second.Footprint(alone);
+        cout << " " << versions[i].first << ": " << versions[i].second.Count() << " courses" << endl;
+    }
+    cout << versions.size() << " versions use " << shared << " bytes together, "
+        << copies << " bytes as separate copies" << endl;
+}
+
+//============================================================================
+// Similar course recommendations
+//============================================================================
+
+// MinHash values per course, split into LSH bands of SIMILAR_ROWS each
+const int SIMILAR_HASHES = 64;
+const int SIMILAR_BANDS = 32;
+const int SIMILAR_ROWS = SIMILAR_HASHES / SIMILAR_BANDS;
+// most courses taken from one band bucket per query
+const size_t SIMILAR_BUCKET_LIMIT = 256;
+
+/**
+ * Finds courses similar to a given one by the Jaccard similarity of
+ * their features: the words of the title, lower case and without the
+ * commonest small words, and the prerequisite IDs.
+ *
+ * Every course gets a MinHash signature of SIMILAR_HASHES values; two
+ * signatures agree in each position with probability equal to the
+ * Jaccard similarity of the feature sets. The signature is cut into
+ * SIMILAR_BANDS bands of two values and each band hashed into a sorted
+ * table, so courses sharing any whole band are candidates: a pair at
+ * 0.3 similarity shares one with probability 0.95, while a query only
+ * touches its own buckets. Candidates are then ranked by exact Jaccard
+ * over the stored feature sets. Only the band hashes of a signature are
+ * kept. Features, signatures and bands are built on every hardware
+ * thread.
+ *
+ * Courses are numbered in ID order when built. A change then replaces
+ * only its course's features and band entries, and a new course takes
+ * the next number, so numbers need not follow ID order afterwards.
+ */
+class SimilarCourses {
+
+public:
+    struct Match {
+        uint32_t course;
+        double similarity;
+    };
+
+private:
+    struct BandEntry {
+        uint32_t key;
+        uint32_t course;
+        bool operator<(const BandEntry& other) const {
+            return key < other.key || (key == other.key && course < other.course);
+        }
+    };
+
+    vector<string> ids;
+    vector<string> titles;
+    // indexed courses by number, in ID order
+    vector<uint32_t> byId;
+    // features of course v are features[featureStart[v] .. featureEnd[v]), sorted;
+    // a changed course's old features stay behind until the next build
+    vector<size_t> featureStart;
+    vector<size_t> featureEnd;
+    vector<uint64_t> features;
+    // band hashes of course v are keys[v * SIMILAR_BANDS ..]
+    vector<uint32_t> keys;
+    vector<BandEntry> bands[SIMILAR_BANDS];
+
+    static void Features(const Course& course, vector<uint64_t>& out);
+    static void HashParameters(uint64_t* multipliers, uint64_t* offsets);
+    void Sign(uint32_t course, const uint64_t* multipliers, const uint64_t* offsets);
+    void ChangeBands(uint32_t course, bool add);
+
+public:
+    void Build(HashTable* hashTable);
+    void Build(const vector<Course>& courses);
+    void Update(const Course* before, const Course* after);
+    size_t Count() const { return byId.size(); }
+    int IndexOf(const string& courseId) const;
+    const string& Id(uint32_t course) const { return ids[course]; }
+    const string& Title(uint32_t course) const { return titles[course]; }
+    double Jaccard(uint32_t first, uint32_t second) const;
+    void Similar(uint32_t course, size_t limit, vector<Match>& matches) const;
+};
+
+/**
+ * Build from every course in a table
+ */
+void SimilarCourses::Build(HashTable* hashTable) {
+    vector<Course> courses;
+    hashTable->Sort(courses);
+    Build(courses);
+}
+
+/**
+ * Feature hashes of one course, sorted and without repeats
+ */
+void SimilarCourses::Features(const Course& course, vector<uint64_t>& out) {
+    static const char* const common[] = { "a", "an", "and", "for", "in", "of", "on", "the", "to" };
+    // the leading tag keeps a title word apart from an equal ID
+    static const uint64_t wordSeed = hashBytes("t", 1, 14695981039346656037ULL);
+    static const uint64_t idSeed = hashBytes("p", 1, 14695981039346656037ULL);
+    out.clear();
+    const string& title = course.courseTitle;
+    char word[4];
+    for (size_t i = 0; i < title.size(); ) {
+        if (!isalnum((unsigned char)title[i])) {
+            i++;
+            continue;
+        }
+        // hash the lower-case word as it is scanned
+        uint64_t hash = wordSeed;
+        size_t length = 0;
+        for (; i < title.size() && isalnum((unsigned char)title[i]); i++, length++) {
+            char ch = tolower((unsigned char)title[i]);
+            if (length < sizeof(word)) {
+                word[length] = ch;
+            }
+            hash = (hash ^ (unsigned char)ch) * 1099511628211ULL;
+        }
+        bool skip = false;
+        for (size_t c = 0; !skip && length < sizeof(word) && c < sizeof(common) / sizeof(common[0]); c++) {
+            skip = strlen(common[c]) == length && memcmp(common[c], word, length) == 0;
+        }
+        if (!skip) {
+            out.push_back(hash);
+        }
+    }
+    for (size_t j = 0; j < course.prerequisites.size(); j++) {
+        const string& id = course.prerequisites[j];
+        out.push_back(hashBytes(id.data(), id.size(), idSeed));
+    }
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+}
+
+/**
+ * Build from courses sorted by ID; a repeated ID keeps its first course
+ */
+void SimilarCourses::Build(const vector<Course>& courses) {
+    ids.clear();
+    titles.clear();
+    vector<int> source;
+    for (size_t i = 0; i < courses.size(); i++) {
+        if (!ids.empty() && ids.back() == courses[i].courseId) {
+            continue;
+        }
+        ids.push_back(courses[i].courseId);
+        titles.push_back(courses[i].courseTitle);
+        source.push_back(i);
+    }
+    size_t count = ids.size();
+    byId.resize(count);
+    for (size_t v = 0; v < count; v++) {
+        byId[v] = v;
+    }
+
+    vector<vector<uint64_t> > perCourse(count);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            Features(courses[source[v]], perCourse[v]);
+        }
+    });
+    featureStart.clear();
+    featureEnd.clear();
+    features.clear();
+    for (size_t v = 0; v < count; v++) {
+        featureStart.push_back(features.size());
+        features.insert(features.end(), perCourse[v].begin(), perCourse[v].end());
+        featureEnd.push_back(features.size());
+        vector<uint64_t>().swap(perCourse[v]);
+    }
+
+    uint64_t multipliers[SIMILAR_HASHES];
+    uint64_t offsets[SIMILAR_HASHES];
+    HashParameters(multipliers, offsets);
+    keys.assign(count * SIMILAR_BANDS, 0);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            Sign(v, multipliers, offsets);
+        }
+    });
+
+    // each band is filled and sorted on its own thread, by two stable
+    // radix passes over the key; entries start in course order, so
+    // equal keys stay in course order as the comparison expects
+    parallelFor(SIMILAR_BANDS, [&](size_t begin, size_t end) {
+        vector<BandEntry> scratch;
+        vector<size_t> offsets(1 << 16);
+        for (size_t band = begin; band < end; band++) {
+            vector<BandEntry>& entries = bands[band];
+            entries.clear();
+            entries.reserve(count);
+            for (uint32_t v = 0; v < count; v++) {
+                // a course without features is similar to nothing
+                if (featureEnd[v] > featureStart[v]) {
+                    entries.push_back({ keys[size_t(v) * SIMILAR_BANDS + band], v });
+                }
+            }
+            scratch.resize(entries.size());
+            for (int shift = 0; shift < 32; shift += 16) {
+                fill(offsets.begin(), offsets.end(), 0);
+                for (size_t i = 0; i < entries.size(); i++) {
+                    offsets[(entries[i].key >> shift) & 0xffff]++;
+                }
+                size_t total = 0;
+                for (size_t d = 0; d < offsets.size(); d++) {
+                    size_t digits = offsets[d];
+                    offsets[d] = total;
+                    total += digits;
+                }
+                for (size_t i = 0; i < entries.size(); i++) {
+                    scratch[offsets[(entries[i].key >> shift) & 0xffff]++] = entries[i];
+                }
+                entries.swap(scratch);
+            }
+        }
+    }, 1);
+}
+
+/**
+ * The MinHash functions: hash i of a feature is the top half of
+ * a_i * x + b_i, with odd a_i, drawn from a fixed seed so a course
+ * signed after a build gets the same functions
+ */
+void SimilarCourses::HashParameters(uint64_t* multipliers, uint64_t* offsets) {
+    mt19937_64 random(0x5eed);
+    for (int i = 0; i < SIMILAR_HASHES; i++) {
+        multipliers[i] = random() | 1;
+        offsets[i] = random();
+    }
+}
+
+/**
+ * Compute a course's signature from its features and store its band
+ * hashes in keys
+ */
+void SimilarCourses::Sign(uint32_t course, const uint64_t* multipliers, const uint64_t* offsets) {
+    uint32_t signature[SIMILAR_HASHES];
+    fill(signature, signature + SIMILAR_HASHES, UINT32_MAX);
+    for (size_t f = featureStart[course]; f < featureEnd[course]; f++) {
+        uint64_t feature = features[f];
+        for (int i = 0; i < SIMILAR_HASHES; i++) {
+            signature[i] = min(signature[i], uint32_t((multipliers[i] * feature + offsets[i]) >> 32));
+        }
+    }
+    for (int band = 0; band < SIMILAR_BANDS; band++) {
+        uint64_t hash = hashBytes(reinterpret_cast<const char*>(signature + band * SIMILAR_ROWS),
+            SIMILAR_ROWS * sizeof(uint32_t), 14695981039346656037ULL);
+        keys[size_t(course) * SIMILAR_BANDS + band] = uint32_t(hash ^ (hash >> 32));
+    }
+}
+
+/**
+ * Add a course's entries to every band, or take them out
+ */
+void SimilarCourses::ChangeBands(uint32_t course, bool add) {
+    // a course without features is similar to nothing
+    if (featureEnd[course] == featureStart[course]) {
+        return;
+    }
+    for (int band = 0; band < SIMILAR_BANDS; band++) {
+        BandEntry entry = { keys[size_t(course) * SIMILAR_BANDS + band], course };
+        vector<BandEntry>::iterator it = lower_bound(bands[band].begin(), bands[band].end(), entry);
+        if (add) {
+            bands[band].insert(it, entry);
+        }
+        else if (it != bands[band].end() && it->key == entry.key && it->course == course) {
+            bands[band].erase(it);
+        }
+    }
+}
+
+/**
+ * Follow one change to the catalog, as a CatalogListener reports it:
+ * only the course changed is re-hashed and moved between band buckets
+ *
+ * @param before The course before the change, null if it was added
+ * @param after The course after the change, null if it was removed
+ */
+void SimilarCourses::Update(const Course* before, const Course* after) {
+    const string& courseId = after != nullptr ? after->courseId : before->courseId;
+    vector<uint32_t>::iterator it = lower_bound(byId.begin(), byId.end(), courseId,
+        [this](uint32_t course, const string& key) { return ids[course] < key; });
+    uint32_t course;
+    if (it != byId.end() && ids[*it] == courseId) {
+        course = *it;
+        ChangeBands(course, false);
+        if (after == nullptr) {
+            byId.erase(it);
+            featureEnd[course] = featureStart[course];
+            return;
+        }
+    }
+    else if (after != nullptr) {
+        course = ids.size();
+        ids.push_back(courseId);
+        titles.push_back(string());
+        featureStart.push_back(features.size());
+        featureEnd.push_back(features.size());
+        keys.resize(keys.size() + SIMILAR_BANDS);
+        byId.insert(it, course);
+    }
+    else {
+        return;
+    }
+
+    titles[course] = after->courseTitle;
+    vector<uint64_t> courseFeatures;
+    Features(*after, courseFeatures);
+    featureStart[course] = features.size();
+    features.insert(features.end(), courseFeatures.begin(), courseFeatures.end());
+    featureEnd[course] = features.size();
+    uint64_t multipliers[SIMILAR_HASHES];
+    uint64_t offsets[SIMILAR_HASHES];
+    HashParameters(multipliers, offsets);
+    Sign(course, multipliers, offsets);
+    ChangeBands(course, true);
+}
+
+/**
+ * Exact Jaccard similarity of two courses' feature sets
+ */
+double SimilarCourses::Jaccard(uint32_t first, uint32_t second) const {
+    size_t i = featureStart[first];
+    size_t j = featureStart[second];
+    size_t shared = 0;
+    while (i < featureEnd[first] && j < featureEnd[second]) {
+        if (features[i] == features[j]) {
+            shared++;
+            i++;
+            j++;
+        }
+        else if (features[i] < features[j]) {
+            i++;
+        }
+        else {
+            j++;
+        }
+    }
+    size_t total = featureEnd[first] - featureStart[first] + featureEnd[second] - featureStart[second] - shared;
+    return total == 0 ? 0.0 : double(shared) / total;
+}
+
+/**
+ * Index of a course
+ *
+ * @return The index, or -1 if the course is not indexed
+ */
+int SimilarCourses::IndexOf(const string& courseId) const {
+    vector<uint32_t>::const_iterator it = lower_bound(byId.begin(), byId.end(), courseId,
+        [this](uint32_t course, const string& key) { return ids[course] < key; });
+    if (it == byId.end() || ids[*it] != courseId) {
+        return -1;
+    }
+    return *it;
+}
+
+/**
+ * The courses most similar to one course
+ *
+ * @param course Index of the course
+ * @param limit Most matches to return
+ * @param matches Receives the matches, most similar first, then by ID
+ */
+void SimilarCourses::Similar(uint32_t course, size_t limit, vector<Match>& matches) const {
+    matches.clear();
+    vector<uint32_t> candidates;
+    for (int band = 0; band < SIMILAR_BANDS && featureEnd[course] > featureStart[course]; band++) {
+        BandEntry probe = { keys[size_t(course) * SIMILAR_BANDS + band], 0 };
+        vector<BandEntry>::const_iterator it = lower_bound(bands[band].begin(), bands[band].end(), probe);
+        // a bucket of near-identical courses is sampled, not walked
+        for (size_t taken = 0; it != bands[band].end() && it->key == probe.key && taken < SIMILAR_BUCKET_LIMIT;
+            ++it, taken++) {
+            if (it->course != course) {
+                candidates.push_back(it->course);
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        double similarity = Jaccard(course, candidates[i]);
+        if (similarity > 0) {
+            matches.push_back({ candidates[i], similarity });
+        }
+    }
+    // ties by ID, since numbers stop following ID order after a change
+    sort(matches.begin(), matches.end(), [this](const Match& a, const Match& b) {
+        return a.similarity > b.similarity || (a.similarity == b.similarity && ids[a.course] < ids[b.course]);
+    });
+    if (matches.size() > limit) {
+        matches.resize(limit);
+    }
+}
+
+/**
+ * Print the courses most similar to one course
+ *
+ * @param similar The index to query
+ * @param courseId The course, in upper case
+ */
+void printSimilarCourses(const SimilarCourses& similar, string courseId) {
+    int course = similar.IndexOf(courseId);
+    if (course < 0) {
+        cout << "Course ID " << courseId << " not found." << endl;
+        return;
+    }
+    vector<SimilarCourses::Match> matches;
+    similar.Similar(course, 10, matches);
+    if (matches.empty()) {
+        cout << "No courses are similar to " << courseId << "." << endl;
+        return;
+    }
+    cout << "Courses similar to " << courseId << ", " << similar.Title(course) << ":" << endl;
+    char similarity[16];
+    for (size_t i = 0; i < matches.size(); i++) {
+        snprintf(similarity, sizeof(similarity), "%.2f", matches[i].similarity);
+        cout << " " << similar.Id(matches[i].course) << ", " << similar.Title(matches[i].course) << " (" << similarity
+            << ")" << endl;
+    }
+}
+
+/**
+ * Time building the index, then compare its answers with a full scan
+ * by exact Jaccard for a sample of courses
+ */
+void benchmarkSimilarCourses(HashTable* hashTable) {
+    vector<Course> courses;
+    hashTable->Sort(courses);
+    SimilarCourses similar;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    similar.Build(courses);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Indexed " << similar.Count() << " courses in " << llround(seconds * 1000) << " milliseconds on "
+        << max(1u, thread::hardware_concurrency()) << " hardware threads" << endl;
+
+    // recall of the ten best matches, against scanning every course;
+    // a match counts if it is as similar as the scan's tenth best
+    const int samples = 100;
+    const size_t best = 10;
+    mt19937 random(7);
+    vector<SimilarCourses::Match> matches;
+    vector<double> scanned;
+    size_t expected = 0;
+    size_t found = 0;
+    double querySeconds = 0;
+    for (int s = 0; s < samples && similar.Count() > 1; s++) {
+        uint32_t course = random() % similar.Count();
+        start = chrono::steady_clock::now();
+        similar.Similar(course, best, matches);
+        querySeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        // the scan only visits the feature sets the index already holds
+        scanned.clear();
+        for (uint32_t other = 0; other < similar.Count(); other++) {
+            double similarity = other == course ? 0.0 : similar.Jaccard(course, other);
+            if (similarity > 0) {
+                scanned.push_back(similarity);
+            }
+        }
+        size_t wanted = min(best, scanned.size());
+        if (wanted == 0) {
+            continue;
+        }
+        nth_element(scanned.begin(), scanned.begin() + (wanted - 1), scanned.end(), greater<double>());
+        expected += wanted;
+        for (size_t i = 0; i < matches.size(); i++) {
+            found += matches[i].similarity >= scanned[wanted - 1];
+        }
+    }
+    cout << "Average query " << llround(querySeconds / samples * 1e6) << " microseconds; found " << found << " of "
+        << expected << " top " << best << " matches a full scan finds" << endl;
+}
+
+//============================================================================
+// Background secondary indexes
+//============================================================================
+
+// largest transitive closure built, in the background or on first use;
+// the closure grows with the square of the course count
+const size_t BACKGROUND_CLOSURE_BYTES = 64 << 20;
+
+// the indexes built after a load rather than during it
+enum SecondaryIndex {
+    PREFIX_INDEX,
+    SIMILAR_INDEX,
+    DEPENDENCY_INDEX,
+    NATURAL_INDEX,
+    SECONDARY_INDEXES
+};
+
+/**
+ * Builds the secondary indexes on a worker thread after each load, so
+ * the load returns, and point lookups run, as soon as the table is
+ * filled. The worker only sees a copy of the courses the main thread
+ * took; the table itself is never shared. Each copy starts a new
+ * generation, and an index is handed out only while it was built from
+ * the latest one, so a query never sees courses older than the table.
+ *
+ * After a lazy load only IDs are copied, since copying bodies would
+ * parse every row the load put off. The indexes that need bodies are
+ * then built on first use instead, as is a dependency tracker whose
+ * closure would be too big to build on speculation.
+ *
+ * Between loads it listens to the table and applies each add, edit or
+ * removal to the built indexes in place; the natural-order index is
+ * read-only and is dropped instead, to be rebuilt on its next use. A change that arrives while
+ * the worker is still building is queued, and replayed on each index
+ * the worker builds from the older copy before that index is handed
+ * out, so the table is never copied again just to catch up.
+ */
+class SecondaryIndexes : public CatalogListener {
+
+public:
+    enum State { NOT_BUILT, ON_FIRST_USE, BUILDING, READY };
+
+private:
+    struct Status {
+        State state = NOT_BUILT;
+        uint64_t generation = 0;
+        double seconds = 0;
+    };
+
+    mutex lock;
+    condition_variable changed;
+    thread worker;
+    bool stopping = false;
+
+    // the newest copy, until the worker takes it
+    vector<Course> pendingCourses;
+    bool pending = false;
+    bool pendingBodies = false;
+    bool pendingTracker = false;
+    uint64_t generation = 0;
+    // a change arrived before the first copy
+    bool behind = false;
+
+    // a change made since the copy the worker builds from
+    struct QueuedChange {
+        Course before;
+        Course after;
+        bool hasBefore;
+        bool hasAfter;
+    };
+    vector<QueuedChange> queued;
+
+    Status status[SECONDARY_INDEXES];
+    shared_ptr<FrontCodedIds> prefix;
+    shared_ptr<SimilarCourses> similar;
+    shared_ptr<const LearnedIndex> natural;
+    // once handed out the tracker follows the table as a listener
+    DependencyTracker* tracker = nullptr;
+    bool trackerFollowing = false;
+
+    void Run();
+    void Apply(const Course* before, const Course* after, FrontCodedIds* toPrefix, SimilarCourses* toSimilar,
+        DependencyTracker* toTracker);
+    void Replay(FrontCodedIds* toPrefix, SimilarCourses* toSimilar, DependencyTracker* toTracker);
+    bool Publish(SecondaryIndex index, uint64_t built, chrono::steady_clock::time_point start);
+    void Wait(SecondaryIndex index, unique_lock<mutex>& guard);
+
+public:
+    ~SecondaryIndexes();
+    void Refresh(HashTable* hashTable, bool bodies);
+    void CourseChanged(const Course* before, const Course* after);
+    void CatchUp(HashTable* hashTable);
+    bool Building(SecondaryIndex index);
+    shared_ptr<const FrontCodedIds> Prefix();
+    shared_ptr<const SimilarCourses> Similar(HashTable* hashTable);
+    DependencyTracker* Tracker(HashTable* hashTable);
+    shared_ptr<const LearnedIndex> Natural(HashTable* hashTable);
+    void PrintStatus();
+};
+
+/**
+ * Stop the worker, letting it finish the index it is on
+ */
+SecondaryIndexes::~SecondaryIndexes() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (!trackerFollowing) {
+        delete tracker;
+    }
+}
+
+/**
+ * Copy the table and start rebuilding every index from the copy. Called
+ * on the thread that owns the table after each load; indexes from an
+ * earlier copy stop being handed out at once.
+ *
+ * @param hashTable The table just loaded
+ * @param bodies False after a lazy load, to copy IDs only
+ */
+void SecondaryIndexes::Refresh(HashTable* hashTable, bool bodies) {
+    vector<Course> courses;
+    hashTable->Snapshot(courses, bodies);
+
+    lock_guard<mutex> guard(lock);
+    generation++;
+    behind = false;
+    queued.clear();
+    pendingCourses.swap(courses);
+    pending = true;
+    pendingBodies = bodies;
+    size_t count = pendingCourses.size();
+    pendingTracker = bodies && !trackerFollowing && count / 8 * count <= BACKGROUND_CLOSURE_BYTES;
+    prefix.reset();
+    similar.reset();
+    natural.reset();
+    status[PREFIX_INDEX].state = BUILDING;
+    status[SIMILAR_INDEX].state = bodies ? BUILDING : ON_FIRST_USE;
+    status[NATURAL_INDEX].state = ON_FIRST_USE;
+    metrics.SetGauge(PREFIX_INDEX_READY, 0);
+    metrics.SetGauge(SIMILAR_INDEX_READY, 0);
+    metrics.SetGauge(NATURAL_INDEX_READY, 0);
+    if (trackerFollowing) {
+        // kept current by the change itself
+        status[DEPENDENCY_INDEX].generation = generation;
+    }
+    else {
+        status[DEPENDENCY_INDEX].state = pendingTracker ? BUILDING : ON_FIRST_USE;
+        metrics.SetGauge(DEPENDENCY_INDEX_READY, 0);
+    }
+    if (!worker.joinable()) {
+        worker = thread(&SecondaryIndexes::Run, this);
+    }
+    changed.notify_all();
+}
+
+/**
+ * Apply one change to the indexes already built: one ID in or out of
+ * the prefix dictionary, one course's band entries in the similar
+ * index, and the change itself in a tracker not yet following the
+ * table. Indexes built on first use are left to be built then, and
+ * those the worker is still building get the change when it is done.
+ *
+ * @param before The course before the change, null if it was added
+ * @param after The course after the change, null if it was removed
+ */
+void SecondaryIndexes::CourseChanged(const Course* before, const Course* after) {
+    lock_guard<mutex> guard(lock);
+    if (generation == 0) {
+        behind = true;
+        return;
+    }
+    if (natural != nullptr && (before == nullptr || after == nullptr)) {
+        natural.reset();
+        status[NATURAL_INDEX].state = ON_FIRST_USE;
+        metrics.SetGauge(NATURAL_INDEX_READY, 0);
+    }
+    bool building = pending;
+    for (int i = 0; i < SECONDARY_INDEXES; i++) {
+        building = building || status[i].state == BUILDING;
+    }
+    if (building) {
+        QueuedChange change;
+        change.hasBefore = before != nullptr;
+        change.hasAfter = after != nullptr;
+        if (change.hasBefore) {
+            change.before = *before;
+        }
+        if (change.hasAfter) {
+            change.after = *after;
+        }
+        queued.push_back(change);
+    }
+    else {
+        queued.clear();
+    }
+    bool trackerCurrent = !trackerFollowing && status[DEPENDENCY_INDEX].state == READY
+        && status[DEPENDENCY_INDEX].generation == generation;
+    Apply(before, after, prefix.get(), similar.get(), trackerCurrent ? tracker : nullptr);
+}
+
+/**
+ * Apply one change to whichever of the given indexes are not null
+ */
+void SecondaryIndexes::Apply(const Course* before, const Course* after, FrontCodedIds* toPrefix,
+    SimilarCourses* toSimilar, DependencyTracker* toTracker) {
+    if (toPrefix != nullptr) {
+        if (before == nullptr) {
+            toPrefix->Insert(after->courseId);
+        }
+        else if (after == nullptr) {
+            toPrefix->Remove(before->courseId);
+        }
+    }
+    if (toSimilar != nullptr) {
+        toSimilar->Update(before, after);
+    }
+    if (toTracker != nullptr) {
+        toTracker->CourseChanged(before, after);
+    }
+}
+
+/**
+ * Bring indexes the worker built from the newest copy up to the table
+ * with the changes queued since. Called with the lock held.
+ */
+void SecondaryIndexes::Replay(FrontCodedIds* toPrefix, SimilarCourses* toSimilar, DependencyTracker* toTracker) {
+    for (size_t i = 0; i < queued.size(); i++) {
+        const QueuedChange& change = queued[i];
+        Apply(change.hasBefore ? &change.before : nullptr, change.hasAfter ? &change.after : nullptr,
+            toPrefix, toSimilar, toTracker);
+    }
+}
+
+/**
+ * Copy the table if a change arrived before the first copy, when there
+ * was no build to queue it for. Called on the thread that owns the
+ * table after each change.
+ *
+ * @param hashTable The table just changed
+ */
+void SecondaryIndexes::CatchUp(HashTable* hashTable) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (!behind) {
+            return;
+        }
+    }
+    Refresh(hashTable, true);
+}
+
+/**
+ * Worker loop: take the newest copy, sort it, then build each index in
+ * turn, dropping the copy as soon as a newer one arrives
+ */
+void SecondaryIndexes::Run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [this] { return stopping || pending; });
+        if (stopping) {
+            return;
+        }
+        vector<Course> courses;
+        courses.swap(pendingCourses);
+        pending = false;
+        bool bodies = pendingBodies;
+        bool buildTracker = pendingTracker;
+        uint64_t building = generation;
+        guard.unlock();
+
+        // stable, so a repeated ID keeps the copy Search finds first
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        stable_sort(courses.begin(), courses.end(), less_than_key());
+
+        vector<string> ids;
+        ids.reserve(courses.size());
+        for (size_t i = 0; i < courses.size(); i++) {
+            if (ids.empty() || ids.back() != courses[i].courseId) {
+                ids.push_back(courses[i].courseId);
+            }
+        }
+        shared_ptr<FrontCodedIds> builtPrefix = make_shared<FrontCodedIds>();
+        builtPrefix->Build(ids);
+        guard.lock();
+        if (Publish(PREFIX_INDEX, building, start)) {
+            Replay(builtPrefix.get(), nullptr, nullptr);
+            prefix = builtPrefix;
+        }
+        if (stopping || !bodies || building != generation) {
+            continue;
+        }
+        guard.unlock();
+
+        start = chrono::steady_clock::now();
+        shared_ptr<SimilarCourses> builtSimilar = make_shared<SimilarCourses>();
+        builtSimilar->Build(courses);
+        guard.lock();
+        if (Publish(SIMILAR_INDEX, building, start)) {
+            Replay(nullptr, builtSimilar.get(), nullptr);
+            similar = builtSimilar;
+        }
+        if (stopping || !buildTracker || building != generation) {
+            continue;
+        }
+        guard.unlock();
+
+        start = chrono::steady_clock::now();
+        DependencyTracker* builtTracker = new DependencyTracker();
+        builtTracker->Rebuild(courses);
+        guard.lock();
+        if (!trackerFollowing && Publish(DEPENDENCY_INDEX, building, start)) {
+            Replay(nullptr, nullptr, builtTracker);
+            delete tracker;
+            tracker = builtTracker;
+        }
+        else {
+            delete builtTracker;
+        }
+    }
+}
+
+/**
+ * Mark an index ready if the copy it was built from is still the
+ * newest. Called with the lock held.
+ *
+ * @return False if the index is stale and should be dropped
+ */
+bool SecondaryIndexes::Publish(SecondaryIndex index, uint64_t built, chrono::steady_clock::time_point start) {
+    if (built != generation) {
+        return false;
+    }
+    status[index].state = READY;
+    status[index].generation = built;
+    status[index].seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    static const MetricGauge gauges[SECONDARY_INDEXES] = {
+        PREFIX_INDEX_READY, SIMILAR_INDEX_READY, DEPENDENCY_INDEX_READY, NATURAL_INDEX_READY
+    };
+    metrics.SetGauge(gauges[index], 1);
+    changed.notify_all();
+    return true;
+}
+
+/**
+ * Block until an index the worker is building for the newest copy is
+ * done. Called with the lock held.
+ */
+void SecondaryIndexes::Wait(SecondaryIndex index, unique_lock<mutex>& guard) {
+    changed.wait(guard, [this, index] { return status[index].state != BUILDING; });
+}
+
+/**
+ * Whether the worker is still building an index, so a caller about to
+ * wait for it can say so
+ */
+bool SecondaryIndexes::Building(SecondaryIndex index) {
+    lock_guard<mutex> guard(lock);
+    return status[index].state == BUILDING;
+}
+
+/**
+ * The sorted ID dictionary, without waiting
+ *
+ * @return The dictionary, or null while it is being built
+ */
+shared_ptr<const FrontCodedIds> SecondaryIndexes::Prefix() {
+    lock_guard<mutex> guard(lock);
+    return prefix;
+}
+
+/**
+ * The similar-course index, waiting for the worker if it is building
+ * it, or building it here after a lazy load
+ *
+ * @param hashTable The table the index must match
+ */
+shared_ptr<const SimilarCourses> SecondaryIndexes::Similar(HashTable* hashTable) {
+    unique_lock<mutex> guard(lock);
+    Wait(SIMILAR_INDEX, guard);
+    if (similar == nullptr) {
+        // only this thread refreshes, so the generation holds meanwhile
+        guard.unlock();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        shared_ptr<SimilarCourses> built = make_shared<SimilarCourses>();
+        built->Build(hashTable);
+        guard.lock();
+        Publish(SIMILAR_INDEX, generation, start);
+        similar = built;
+    }
+    return similar;
+}
+
+/**
+ * The dependency tracker, waiting for the worker if it is building it,
+ * or building it here after a lazy load. From the first call on it
+ * listens to the table and is no longer rebuilt.
+ *
+ * @param hashTable The table the tracker must match
+ * @return The tracker, or nullptr if the catalog is too large for its
+ *         closure to fit in BACKGROUND_CLOSURE_BYTES
+ */
+DependencyTracker* SecondaryIndexes::Tracker(HashTable* hashTable) {
+    unique_lock<mutex> guard(lock);
+    if (trackerFollowing) {
+        return tracker;
+    }
+    Wait(DEPENDENCY_INDEX, guard);
+    if (status[DEPENDENCY_INDEX].state != READY || status[DEPENDENCY_INDEX].generation != generation) {
+        size_t count = hashTable->Count();
+        if (count / 8 * count > BACKGROUND_CLOSURE_BYTES) {
+            return nullptr;
+        }
+        guard.unlock();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        DependencyTracker* built = new DependencyTracker();
+        built->Rebuild(hashTable);
+        guard.lock();
+        Publish(DEPENDENCY_INDEX, generation, start);
+        delete tracker;
+        tracker = built;
+    }
+    hashTable->AddListener(tracker);
+    trackerFollowing = true;
+    return tracker;
+}
+
+/**
+ * The natural-order index, built here from the table's IDs on first
+ * use after each load or added or removed course
+ *
+ * @param hashTable The table the index must match
+ */
+shared_ptr<const LearnedIndex> SecondaryIndexes::Natural(HashTable* hashTable) {
+    unique_lock<mutex> guard(lock);
+    if (natural == nullptr) {
+        guard.unlock();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<string> ids;
+        hashTable->SortedIds(ids);
+        shared_ptr<LearnedIndex> built = make_shared<LearnedIndex>();
+        built->Build(ids);
+        guard.lock();
+        Publish(NATURAL_INDEX, generation, start);
+        natural = built;
+    }
+    return natural;
+}
+
+/**
+ * Print whether each index is ready and how long it took to build
+ */
+void SecondaryIndexes::PrintStatus() {
+    static const char* const names[SECONDARY_INDEXES] = {
+        "Prefix listings", "Similar courses", "Course dependencies", "Natural order"
+    };
+    lock_guard<mutex> guard(lock);
+    for (int i = 0; i < SECONDARY_INDEXES; i++) {
+        cout << " " << names[i] << ": ";
+        switch (status[i].state) {
+        case NOT_BUILT:
+            cout << "not built, no courses loaded" << endl;
+            break;
+        case ON_FIRST_USE:
+            cout << "built on first use" << endl;
+            break;
+        case BUILDING:
+            cout << "building" << endl;
+            break;
+        case READY:
+            cout << "ready, built in " << llround(status[i].seconds * 1000) << " milliseconds";
+            if (i == DEPENDENCY_INDEX && trackerFollowing) {
+                cout << ", kept current by changes";
+            }
+            cout << endl;
+            break;
+        }
+    }
+}
+
+//============================================================================
+// Batch degree audit
+//============================================================================
+
+/**
+ * One student's transcript, with course IDs resolved to graph vertices
+ */
+struct Transcript {
+    string studentId;
+    vector<unsigned int> completed;
+    vector<unsigned int> targets;
+};
+
+/**
+ * Load a transcripts CSV of studentId,courseId[,status] rows. A status
+ * of "target" declares a course the student is working toward; any
+ * other status, or none, means the course was completed. The first
+ * line is a header.
+ *
+ * @param path The transcripts CSV
+ * @param graph The catalog the course IDs are resolved against
+ * @param transcripts Receives one transcript per student, in file order
+ * @param rows Receives the number of rows read
+ * @param unresolved Receives the number of rows naming no catalog course
+ * @return true if the file could be read
+ */
+bool loadTranscripts(string path, const CourseGraph& graph, vector<Transcript>& transcripts,
+    size_t& rows, size_t& unresolved) {
+    MappedFile file;
+    if (!file.Open(path)) {
+        return false;
+    }
+    const char* data = file.Data();
+    size_t size = file.Size();
+    size_t offset = findLineEnd(data, size, 0);
+    offset = offset < size ? offset + 1 : size;
+
+    unordered_map<string, unsigned int> studentOf;
+    vector<string> fields;
+    transcripts.clear();
+    rows = 0;
+    unresolved = 0;
+    while (offset < size) {
+        offset = parseCsvRow(data, size, offset, fields);
+        if (fields.size() < 2 || fields[0].empty()) {
+            continue;
+        }
+        rows++;
+        int v = graph.IndexOf(fields[1]);
+        if (v < 0) {
+            unresolved++;
+            continue;
+        }
+        unordered_map<string, unsigned int>::iterator it = studentOf.find(fields[0]);
+        if (it == studentOf.end()) {
+            it = studentOf.insert(make_pair(fields[0], (unsigned int)transcripts.size())).first;
+            transcripts.push_back(Transcript());
+            transcripts.back().studentId = fields[0];
+        }
+        Transcript& transcript = transcripts[it->second];
+        if (fields.size() > 2 && fields[2] == "target") {
+            transcript.targets.push_back(v);
+        }
+        else {
+            transcript.completed.push_back(v);
+        }
+    }
+    return true;
+}
+
+/**
+ * What an audit found for one student
+ */
+struct AuditResult {
+    // courses the student may take now
+    unsigned int eligible = 0;
+    // targets by state
+    unsigned int targetsDone = 0;
+    unsigned int targetsEligible = 0;
+    unsigned int targetsBlocked = 0;
+    // courses still needed across all targets, the targets included
+    unsigned int remaining = 0;
+    // longest chain among them: terms needed with no course load limit
+    unsigned int terms = 0;
+    // per-target CSV lines, only filled in when a report is written
+    string report;
+};
+
+/**
+ * Audits transcripts against one catalog. A student's completed courses
+ * become a bitset, so every prerequisite test is a single bit probe.
+ * Eligible courses are found by looking only at courses with no
+ * prerequisites (counted once up front) and at dependents of completed
+ * courses, instead of at the whole catalog. Remaining work toward a
+ * target is the set of uncompleted courses reachable from it through
+ * prerequisites, walked depth-first and stopping at completed courses.
+ *
+ * Each thread audits with its own Scratch, so a shared auditor audits
+ * students in parallel.
+ */
+class DegreeAuditor {
+
+public:
+    struct Scratch {
+        vector<uint64_t> completed;
+        vector<uint64_t> marked;
+        vector<unsigned int> touched;
+        vector<unsigned int> depth;
+        vector<pair<unsigned int, unsigned int>> stack;
+    };
+
+private:
+    const CourseGraph& graph;
+    size_t words;
+    // courses without prerequisites as a bitset, and how many there are
+    vector<uint64_t> roots;
+    size_t rootCount = 0;
+
+    bool Test(const vector<uint64_t>& bits, unsigned int v) const {
+        return (bits[v / 64] >> (v % 64)) & 1;
+    }
+    void Set(vector<uint64_t>& bits, unsigned int v) const {
+        bits[v / 64] |= uint64_t(1) << (v % 64);
+    }
+    bool Ready(const Scratch& scratch, unsigned int v) const;
+    unsigned int Remaining(Scratch& scratch, unsigned int target, string* courses);
+
+public:
+    DegreeAuditor(const CourseGraph& graph);
+    void Prepare(Scratch& scratch) const;
+    void Audit(Scratch& scratch, const Transcript& transcript, AuditResult& result, bool report);
+};
+
+/**
+ * Constructor
+ *
+ * @param graph The catalog; it must outlive the auditor
+ */
+DegreeAuditor::DegreeAuditor(const CourseGraph& graph) : graph(graph) {
+    words = (graph.Count() + 63) / 64;
+    roots.assign(words, 0);
+    for (size_t v = 0; v < graph.Count(); v++) {
+        if (graph.prereqStart[v] == graph.prereqStart[v + 1]) {
+            Set(roots, v);
+            rootCount++;
+        }
+    }
+}
+
+/**
+ * Size the per-thread working memory
+ */
+void DegreeAuditor::Prepare(Scratch& scratch) const {
+    scratch.completed.assign(words, 0);
+    scratch.marked.assign(words, 0);
+    scratch.depth.assign(graph.Count(), 0);
+}
+
+/**
+ * Has the student completed every prerequisite of a course
+ */
+bool DegreeAuditor::Ready(const Scratch& scratch, unsigned int v) const {
+    for (unsigned int e = graph.prereqStart[v]; e < graph.prereqStart[v + 1]; e++) {
+        if (!Test(scratch.completed, graph.prereqs[e])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Mark the uncompleted courses a target still needs, the target
+ * included, and measure the longest chain through them. Courses already
+ * marked for an earlier target are shared, not counted again.
+ *
+ * @param courses If not null, receives the newly marked course IDs
+ * @return Length of the longest chain of uncompleted courses ending at
+ *         the target
+ */
+unsigned int DegreeAuditor::Remaining(Scratch& scratch, unsigned int target, string* courses) {
+    if (Test(scratch.completed, target)) {
+        return 0;
+    }
+    if (Test(scratch.marked, target)) {
+        return scratch.depth[target];
+    }
+    // iterative post-order walk so every prerequisite's depth is known
+    // before its dependent's; a course on a cycle sees depth 0 for the
+    // course that closed the cycle
+    Set(scratch.marked, target);
+    scratch.touched.push_back(target);
+    scratch.stack.push_back(make_pair(target, graph.prereqStart[target]));
+    while (!scratch.stack.empty()) {
+        unsigned int v = scratch.stack.back().first;
+        unsigned int& edge = scratch.stack.back().second;
+        if (edge < graph.prereqStart[v + 1]) {
+            unsigned int q = graph.prereqs[edge++];
+            if (!Test(scratch.completed, q) && !Test(scratch.marked, q)) {
+                Set(scratch.marked, q);
+                scratch.touched.push_back(q);
+                scratch.stack.push_back(make_pair(q, graph.prereqStart[q]));
+            }
+            continue;
+        }
+        unsigned int deepest = 0;
+        for (unsigned int e = graph.prereqStart[v]; e < graph.prereqStart[v + 1]; e++) {
+            deepest = max(deepest, scratch.depth[graph.prereqs[e]]);
+        }
+        scratch.depth[v] = deepest + 1;
+        if (courses != nullptr) {
+            if (!courses->empty()) {
+                courses->push_back(' ');
+            }
+            courses->append(graph.ids[v]);
+        }
+        scratch.stack.pop_back();
+    }
+    return scratch.depth[target];
+}
+
+/**
+ * Audit one student
+ *
+ * @param scratch This thread's working memory, from Prepare
+ * @param transcript The student's transcript
+ * @param result Receives the findings
+ * @param report Also write per-target CSV lines into result.report
+ */
+void DegreeAuditor::Audit(Scratch& scratch, const Transcript& transcript, AuditResult& result, bool report) {
+    result = AuditResult();
+    const vector<unsigned int>& completed = transcript.completed;
+    for (size_t i = 0; i < completed.size(); i++) {
+        Set(scratch.completed, completed[i]);
+    }
+
+    // untaken courses without prerequisites are always eligible
+    size_t eligible = rootCount;
+    for (size_t i = 0; i < completed.size(); i++) {
+        unsigned int c = completed[i];
+        if (Test(roots, c) && !Test(scratch.marked, c)) {
+            eligible--;
+        }
+        // marked doubles as "already considered" for this pass
+        Set(scratch.marked, c);
+        scratch.touched.push_back(c);
+    }
+    // any other eligible course is a dependent of a completed course
+    for (size_t i = 0; i < completed.size(); i++) {
+        unsigned int c = completed[i];
+        for (unsigned int e = graph.dependentStart[c]; e < graph.dependentStart[c + 1]; e++) {
+            unsigned int d = graph.dependents[e];
+            if (Test(scratch.marked, d)) {
+                continue;
+            }
+            Set(scratch.marked, d);
+            scratch.touched.push_back(d);
+            if (Ready(scratch, d)) {
+                eligible++;
+            }
+        }
+    }
+    result.eligible = eligible;
+    for (size_t i = 0; i < scratch.touched.size(); i++) {
+        scratch.marked[scratch.touched[i] / 64] = 0;
+    }
+    scratch.touched.clear();
+
+    string courses;
+    for (size_t i = 0; i < transcript.targets.size(); i++) {
+        unsigned int target = transcript.targets[i];
+        const char* state;
+        if (Test(scratch.completed, target)) {
+            state = "done";
+            result.targetsDone++;
+        }
+        else if (Ready(scratch, target)) {
+            state = "eligible";
+            result.targetsEligible++;
+        }
+        else {
+            state = "blocked";
+            result.targetsBlocked++;
+        }
+        courses.clear();
+        unsigned int terms = Remaining(scratch, target, report ? &courses : nullptr);
+        result.terms = max(result.terms, terms);
+        if (report) {
+            result.report += transcript.studentId + "," + graph.ids[target] + "," + state + ","
+                + to_string(terms) + "," + courses + "\n";
+        }
+    }
+    result.remaining = scratch.touched.size();
+
+    // reset only what this student touched
+    for (size_t i = 0; i < scratch.touched.size(); i++) {
+        scratch.marked[scratch.touched[i] / 64] = 0;
+        scratch.depth[scratch.touched[i]] = 0;
+    }
+    scratch.touched.clear();
+    for (size_t i = 0; i < completed.size(); i++) {
+        scratch.completed[completed[i] / 64] = 0;
+    }
+}
+
+/**
+ * Audit every student in a transcripts CSV against a catalog, in
+ * parallel, and print totals with throughput
+ *
+ * @param hashTable The catalog
+ * @param transcriptsPath The transcripts CSV
+ * @param reportPath If not empty, per-target results are written here
+ *        as studentId,targetId,state,terms,remaining courses
+ * @return true if the transcripts (and report) could be read (written)
+ */
+bool auditTranscripts(HashTable* hashTable, string transcriptsPath, string reportPath) {
+    CourseGraph graph;
+    graph.Build(hashTable);
+
+    clock_t ticks = clock();
+    vector<Transcript> transcripts;
+    size_t rows, unresolved;
+    if (!loadTranscripts(transcriptsPath, graph, transcripts, rows, unresolved)) {
+        std::cerr << "Could not read " << transcriptsPath << endl;
+        return false;
+    }
+    ticks = clock() - ticks;
+    cout << "Read " << rows << " transcript rows for " << transcripts.size() << " students in "
+        << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+    if (unresolved > 0) {
+        cout << unresolved << " rows name courses not in the catalog and were skipped" << endl;
+    }
+
+    // wall time, since clock() adds up the CPU time of every thread
+    DegreeAuditor auditor(graph);
+    vector<AuditResult> results(transcripts.size());
+    bool report = !reportPath.empty();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    parallelFor(transcripts.size(), [&](size_t begin, size_t end) {
+        DegreeAuditor::Scratch scratch;
+        auditor.Prepare(scratch);
+        for (size_t i = begin; i < end; i++) {
+            auditor.Audit(scratch, transcripts[i], results[i], report);
+        }
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t eligible = 0, done = 0, ready = 0, blocked = 0, remaining = 0, withTargets = 0;
+    unsigned int terms = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        eligible += results[i].eligible;
+        done += results[i].targetsDone;
+        ready += results[i].targetsEligible;
+        blocked += results[i].targetsBlocked;
+        remaining += results[i].remaining;
+        terms = max(terms, results[i].terms);
+        if (!transcripts[i].targets.empty()) {
+            withTargets++;
+        }
+    }
+    size_t students = max(transcripts.size(), size_t(1));
+    cout << "Audited " << transcripts.size() << " students in " << llround(seconds * 1000)
+        << " milliseconds, " << llround(transcripts.size() / max(seconds, 1e-9)) << " students/sec" << endl;
+    cout << " Eligible courses per student: " << double(eligible) / students << endl;
+    cout << " Targets: " << done << " done, " << ready << " eligible now, " << blocked << " blocked" << endl;
+    if (withTargets > 0) {
+        cout << " Courses still needed per student with targets: " << double(remaining) / withTargets
+            << ", longest chain " << terms << " terms" << endl;
+    }
+
+    if (report) {
+        ofstream out(reportPath.c_str(), ios::binary);
+        out << "studentId,targetId,state,terms,remaining" << "\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            out << results[i].report;
+        }
+        if (!out) {
+            std::cerr << "Could not write " << reportPath << endl;
+            return false;
+        }
+        cout << "Wrote " << reportPath << endl;
+    }
+    return true;
+}
+
+//============================================================================
+// What-if simulation of catalog changes
+//============================================================================
+
+/**
+ * A copy-on-write view of a catalog. Reads fall through to the base
+ * table until a course is written; writes land in a small map of
+ * overrides, so a hypothetical change costs only the courses it touches
+ * and the base table is never modified. A removed course is recorded as
+ * an empty course, the same value Search returns for a missing ID.
+ */
+class CatalogOverlay {
+
+private:
+    HashTable* base;
+    map<string, Course> overrides;
+
+public:
+    CatalogOverlay(HashTable* base) : base(base) { }
+    Course Search(string courseId);
+    void Put(Course course);
+    void Remove(string courseId);
+    size_t ChangedCount() const { return overrides.size(); }
+};
+
+/**
+ * Look up a course, preferring this view's own version of it
+ */
+Course CatalogOverlay::Search(string courseId) {
+    map<string, Course>::iterator it = overrides.find(courseId);
+    if (it != overrides.end()) {
+        return it->second;
+    }
+    return base->Search(courseId);
+}
+
+/**
+ * Add or replace a course in this view only
+ */
+void CatalogOverlay::Put(Course course) {
+    overrides[course.courseId] = course;
+}
+
+/**
+ * Remove a course from this view only
+ */
+void CatalogOverlay::Remove(string courseId) {
+    overrides[courseId] = Course();
+}
+
+/**
+ * One proposed change: retire a course, or renumber it when newId is set
+ */
+struct CatalogChange {
+    string courseId;
+    string newId;
+};
+
+/**
+ * Parse a comma-separated list of changes, where ID retires a course
+ * and ID=NEWID renumbers it
+ *
+ * @param text The list, already upper case
+ * @return The changes in the order given
+ */
+vector<CatalogChange> parseCatalogChanges(string text) {
+    vector<CatalogChange> changes;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == string::npos) {
+            comma = text.size();
+        }
+        string item = text.substr(start, comma - start);
+        size_t equals = item.find('=');
+        CatalogChange change;
+        change.courseId = item.substr(0, equals);
+        if (equals != string::npos) {
+            change.newId = item.substr(equals + 1);
+        }
+        if (!change.courseId.empty()) {
+            changes.push_back(change);
+        }
+        start = comma + 1;
+    }
+    return changes;
+}
+
+/**
+ * Simulate one change on its own overlay and print what it affects
+ *
+ * @param hashTable The base catalog, left untouched
+ * @param graph The base catalog's prerequisite graph
+ * @param transcripts Student transcripts, possibly none
+ * @param change The change to simulate
+ */
+void simulateChange(HashTable* hashTable, const CourseGraph& graph, const vector<Transcript>& transcripts,
+    const CatalogChange& change) {
+    bool renumber = !change.newId.empty();
+    int v = graph.IndexOf(change.courseId);
+    if (v < 0) {
+        cout << "Course ID " << change.courseId << " not found." << endl;
+        return;
+    }
+    if (renumber && graph.IndexOf(change.newId) >= 0) {
+        cout << "Cannot renumber " << change.courseId << " as " << change.newId
+            << ", that ID is already in use." << endl;
+        return;
+    }
+
+    // apply the change, rewriting every course that names the old ID
+    CatalogOverlay overlay(hashTable);
+    Course course = overlay.Search(change.courseId);
+    overlay.Remove(change.courseId);
+    if (renumber) {
+        course.courseId = change.newId;
+        overlay.Put(course);
+    }
+    vector<string> rewritten;
+    for (unsigned int e = graph.dependentStart[v]; e < graph.dependentStart[v + 1]; e++) {
+        // a course listing the prerequisite twice has two adjacent edges
+        const string& dependentId = graph.ids[graph.dependents[e]];
+        if (!rewritten.empty() && rewritten.back() == dependentId) {
+            continue;
+        }
+        Course dependent = overlay.Search(dependentId);
+        vector<string>& prerequisites = dependent.prerequisites;
+        for (int i = prerequisites.size() - 1; i >= 0; i--) {
+            if (prerequisites[i] == change.courseId) {
+                if (renumber) {
+                    prerequisites[i] = change.newId;
+                }
+                else {
+                    prerequisites.erase(prerequisites.begin() + i);
+                }
+            }
+        }
+        overlay.Put(dependent);
+        rewritten.push_back(dependent.courseId);
+    }
+
+    // every course whose prerequisite chain passes through this one
+    vector<uint64_t> affected((graph.Count() + 63) / 64, 0);
+    vector<unsigned int> queue(1, v);
+    affected[v / 64] |= uint64_t(1) << (v % 64);
+    for (size_t i = 0; i < queue.size(); i++) {
+        unsigned int x = queue[i];
+        for (unsigned int e = graph.dependentStart[x]; e < graph.dependentStart[x + 1]; e++) {
+            unsigned int d = graph.dependents[e];
+            if (!((affected[d / 64] >> (d % 64)) & 1)) {
+                affected[d / 64] |= uint64_t(1) << (d % 64);
+                queue.push_back(d);
+            }
+        }
+    }
+
+    // students holding credit for the course, and students working
+    // toward a course in its dependent chain, counted in parallel
+    vector<unsigned char> holds(transcripts.size(), 0);
+    vector<unsigned char> targets(transcripts.size(), 0);
+    parallelFor(transcripts.size(), [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+            const Transcript& transcript = transcripts[s];
+            for (size_t i = 0; i < transcript.completed.size(); i++) {
+                if (transcript.completed[i] == (unsigned int)v) {
+                    holds[s] = 1;
+                }
+            }
+            for (size_t i = 0; i < transcript.targets.size(); i++) {
+                unsigned int t = transcript.targets[i];
+                if ((affected[t / 64] >> (t % 64)) & 1) {
+                    targets[s] = 1;
+                }
+            }
+        }
+    });
+    size_t holding = count(holds.begin(), holds.end(), 1);
+    size_t targeting = count(targets.begin(), targets.end(), 1);
+
+    if (renumber) {
+        cout << "Renumber " << change.courseId << " as " << change.newId << ": " << rewritten.size()
+            << " courses list it as a prerequisite and are rewritten" << endl;
+    }
+    else {
+        cout << "Retire " << change.courseId << ": " << rewritten.size() << " courses lose a direct prerequisite, "
+            << (queue.size() - 1) << " depend on it in all" << endl;
+    }
+    for (size_t i = 0; i < rewritten.size(); i++) {
+        Course dependent = overlay.Search(rewritten[i]);
+        cout << "  " << dependent.courseId << " would require: ";
+        if (dependent.prerequisites.empty()) {
+            cout << "nothing";
+        }
+        for (size_t j = 0; j < dependent.prerequisites.size(); j++) {
+            cout << dependent.prerequisites[j];
+            if ((j + 1) != dependent.prerequisites.size()) {
+                cout << ", ";
+            }
+        }
+        cout << endl;
+    }
+    if (!transcripts.empty()) {
+        cout << " Students: " << holding << (renumber ? " transcripts to remap, " : " hold credit for it, ")
+            << targeting << " are working toward an affected course" << endl;
+    }
+}
+
+/**
+ * Simulate each proposed change independently against the base catalog
+ *
+ * @param hashTable The base catalog, left untouched
+ * @param changeList Changes as parsed by parseCatalogChanges
+ * @param transcriptsPath A transcripts CSV for student counts, or empty
+ * @return true if the transcripts could be read
+ */
+bool simulateChanges(HashTable* hashTable, string changeList, string transcriptsPath) {
+    CourseGraph graph;
+    graph.Build(hashTable);
+    vector<Transcript> transcripts;
+    if (!transcriptsPath.empty()) {
+        size_t rows, unresolved;
+        if (!loadTranscripts(transcriptsPath, graph, transcripts, rows, unresolved)) {
+            std::cerr << "Could not read " << transcriptsPath << endl;
+            return false;
+        }
+    }
+
+    // wall time, since clock() adds up the CPU time of every thread
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<CatalogChange> changes = parseCatalogChanges(changeList);
+    for (size_t i = 0; i < changes.size(); i++) {
+        simulateChange(hashTable, graph, transcripts, changes[i]);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Simulated " << changes.size() << " changes over " << transcripts.size() << " students in "
+        << llround(seconds * 1000) << " milliseconds" << endl;
+    return true;
+}
+
+//============================================================================
+// Flat catalog image
+//============================================================================
+
+const char CATALOG_IMAGE_MAGIC[8] = { 'A', 'B', 'C', 'U', 'I', 'M', 'G', '1' };
+
+/**
+ * Layout of a catalog image. Everything after the header is addressed
+ * by byte offsets from the start of the image, never by pointers, so an
+ * image can be written out, mapped or shared as is.
+ */
+struct ImageHeader {
+    char magic[8];
+    uint32_t courseCount;
+    uint32_t slotCount;
+    uint32_t prereqCount;
+    uint32_t reserved;
+    uint64_t recordsOffset;
+    uint64_t slotsOffset;
+    uint64_t prereqsOffset;
+    uint64_t stringsOffset;
+    uint64_t size;
+};
+
+// one course; strings are offsets into the string pool
+struct ImageRecord {
+    uint32_t id;
+    uint32_t idLength;
+    uint32_t title;
+    uint32_t titleLength;
+    uint32_t prereqStart;
+    uint32_t prereqCount;
+};
+
+// one prerequisite, with the course it names or UINT32_MAX
+struct ImagePrereq {
+    uint32_t id;
+    uint32_t idLength;
+    uint32_t course;
+};
+
+/**
+ * A whole catalog in one contiguous, read-only block: records sorted by
+ * course ID, an open-addressed hash index of record numbers, resolved
+ * prerequisite lists and a pool of NUL terminated strings. Lookups read
+ * only this block, so views into it can be handed out without copying
+ * for as long as the image lives. An image either owns its bytes (after
+ * Build) or borrows them from elsewhere (after Attach).
+ */
+class CatalogImage {
+
+private:
+    // 64-bit words so every section is suitably aligned
+    vector<uint64_t> storage;
+    const char* base = nullptr;
+    const ImageHeader* header = nullptr;
+    const ImageRecord* records = nullptr;
+    const uint32_t* slots = nullptr;
+    const ImagePrereq* prereqs = nullptr;
+    const char* strings = nullptr;
+
+    void Map(const char* data);
+    bool Valid() const;
+
+public:
+    bool Build(HashTable* hashTable);
+    bool Attach(const char* data, size_t size);
+    const char* Data() const { return base; }
+    size_t Size() const { return header == nullptr ? 0 : header->size; }
+    uint32_t Count() const { return header == nullptr ? 0 : header->courseCount; }
+    const ImageRecord& Record(uint32_t index) const { return records[index]; }
+    const ImagePrereq& Prereq(uint32_t index) const { return prereqs[index]; }
+    const char* String(uint32_t offset) const { return strings + offset; }
+    uint32_t Find(const char* id, size_t length) const;
+};
+
+/**
+ * Round up to a multiple of 8
+ */
+size_t alignImage(size_t offset) {
+    return (offset + 7) & ~size_t(7);
+}
+
+/**
+ * Lay out every course of a table as a new image
+ *
+ * @return false if the strings exceed the 4 GB the offsets can address
+ */
+bool CatalogImage::Build(HashTable* hashTable) {
+    vector<string> ids;
+    hashTable->SortedIds(ids);
+    vector<Course> courses(ids.size());
+    size_t prereqTotal = 0;
+    size_t stringBytes = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        courses[i] = hashTable->Search(ids[i]);
+        prereqTotal += courses[i].prerequisites.size();
+        stringBytes += courses[i].courseId.size() + courses[i].courseTitle.size() + 2;
+        for (size_t j = 0; j < courses[i].prerequisites.size(); j++) {
+            stringBytes += courses[i].prerequisites[j].size() + 1;
+        }
+    }
+    if (stringBytes > UINT32_MAX || prereqTotal > UINT32_MAX) {
+        return false;
+    }
+
+    // slots stay at most half full so probes are short
+    size_t slotCount = 1;
+    while (slotCount < ids.size() * 2) {
+        slotCount <<= 1;
+    }
+    ImageHeader layout;
+    memset(&layout, 0, sizeof(layout));
+    memcpy(layout.magic, CATALOG_IMAGE_MAGIC, sizeof(layout.magic));
+    layout.courseCount = ids.size();
+    layout.slotCount = slotCount;
+    layout.prereqCount = prereqTotal;
+    layout.recordsOffset = alignImage(sizeof(ImageHeader));
+    layout.slotsOffset = alignImage(layout.recordsOffset + ids.size() * sizeof(ImageRecord));
+    layout.prereqsOffset = alignImage(layout.slotsOffset + slotCount * sizeof(uint32_t));
+    layout.stringsOffset = alignImage(layout.prereqsOffset + prereqTotal * sizeof(ImagePrereq));
+    layout.size = alignImage(layout.stringsOffset + stringBytes);
+
+    storage.assign(layout.size / 8, 0);
+    char* image = (char*)storage.data();
+    memcpy(image, &layout, sizeof(layout));
+    ImageRecord* recordOut = (ImageRecord*)(image + layout.recordsOffset);
+    uint32_t* slotOut = (uint32_t*)(image + layout.slotsOffset);
+    ImagePrereq* prereqOut = (ImagePrereq*)(image + layout.prereqsOffset);
+    char* pool = image + layout.stringsOffset;
+    uint32_t poolSize = 0;
+    auto addString = [&](const string& text) {
+        uint32_t offset = poolSize;
+        memcpy(pool + poolSize, text.data(), text.size());
+        poolSize += text.size() + 1;
+        return offset;
+    };
+
+    // records and the hash index first, so prerequisites can resolve
+    for (uint32_t i = 0; i < ids.size(); i++) {
+        recordOut[i].id = addString(courses[i].courseId);
+        recordOut[i].idLength = courses[i].courseId.size();
+        recordOut[i].title = addString(courses[i].courseTitle);
+        recordOut[i].titleLength = courses[i].courseTitle.size();
+        uint32_t slot = kernels.hash(ids[i].data(), ids[i].size()) & (slotCount - 1);
+        while (slotOut[slot] != 0) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        // 0 marks an empty slot, so record numbers are stored plus one
+        slotOut[slot] = i + 1;
+    }
+    Map(image);
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < ids.size(); i++) {
+        recordOut[i].prereqStart = next;
+        recordOut[i].prereqCount = courses[i].prerequisites.size();
+        for (size_t j = 0; j < courses[i].prerequisites.size(); j++) {
+            const string& prereq = courses[i].prerequisites[j];
+            prereqOut[next].id = addString(prereq);
+            prereqOut[next].idLength = prereq.size();
+            prereqOut[next].course = Find(prereq.data(), prereq.size());
+            next++;
+        }
+    }
+    return true;
+}
+
+/**
+ * Point the section pointers into an image whose header is in place
+ */
+void CatalogImage::Map(const char* data) {
+    base = data;
+    header = (const ImageHeader*)data;
+    records = (const ImageRecord*)(data + header->recordsOffset);
+    slots = (const uint32_t*)(data + header->slotsOffset);
+    prereqs = (const ImagePrereq*)(data + header->prereqsOffset);
+    strings = data + header->stringsOffset;
+}
+
+/**
+ * Check every offset, length and index inside the mapped sections, so
+ * a damaged or foreign image cannot send a lookup out of bounds, and
+ * that an empty slot ends every probe. It takes one pass over the
+ * image, which is small next to building it.
+ */
+bool CatalogImage::Valid() const {
+    uint64_t poolSize = header->size - header->stringsOffset;
+    // a string must fit in the pool with its NUL
+    auto validString = [&](uint32_t offset, uint32_t length) {
+        return uint64_t(offset) + length < poolSize && strings[uint64_t(offset) + length] == '\0';
+    };
+    for (uint32_t i = 0; i < header->courseCount; i++) {
+        const ImageRecord& record = records[i];
+        if (!validString(record.id, record.idLength) || !validString(record.title, record.titleLength)
+            || uint64_t(record.prereqStart) + record.prereqCount > header->prereqCount) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->prereqCount; i++) {
+        if (!validString(prereqs[i].id, prereqs[i].idLength)
+            || (prereqs[i].course != UINT32_MAX && prereqs[i].course >= header->courseCount)) {
+            return false;
+        }
+    }
+    bool emptySlot = false;
+    for (uint32_t i = 0; i < header->slotCount; i++) {
+        if (slots[i] > header->courseCount) {
+            return false;
+        }
+        emptySlot = emptySlot || slots[i] == 0;
+    }
+    return emptySlot;
+}
+
+/**
+ * Use an image held elsewhere, which must outlive this object
+ *
+ * @param data Start of the image, 8-byte aligned
+ * @param size Number of bytes available at data
+ * @return false if the bytes are not a consistent image
+ */
+bool CatalogImage::Attach(const char* data, size_t size) {
+    const ImageHeader* candidate = (const ImageHeader*)data;
+    if (size < sizeof(ImageHeader) || memcmp(candidate->magic, CATALOG_IMAGE_MAGIC, sizeof(candidate->magic)) != 0) {
+        return false;
+    }
+    // pairs with the fence a publisher puts before writing the magic
+    atomic_thread_fence(memory_order_acquire);
+    if (candidate->size > size || candidate->stringsOffset > candidate->size
+        || candidate->recordsOffset < sizeof(ImageHeader) || candidate->recordsOffset > candidate->slotsOffset
+        || candidate->slotsOffset > candidate->prereqsOffset || candidate->prereqsOffset > candidate->stringsOffset
+        || (candidate->recordsOffset | candidate->slotsOffset | candidate->prereqsOffset) % 8 != 0
+        || candidate->recordsOffset + uint64_t(candidate->courseCount) * sizeof(ImageRecord) > candidate->slotsOffset
+        || candidate->slotsOffset + uint64_t(candidate->slotCount) * sizeof(uint32_t) > candidate->prereqsOffset
+        || candidate->prereqsOffset + uint64_t(candidate->prereqCount) * sizeof(ImagePrereq) > candidate->stringsOffset
+        || candidate->slotCount == 0 || (candidate->slotCount & (candidate->slotCount - 1)) != 0) {
+        return false;
+    }
+    Map(data);
+    if (!Valid()) {
+        *this = CatalogImage();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Record number of a course ID, or UINT32_MAX if it is not in the image
+ */
+uint32_t CatalogImage::Find(const char* id, size_t length) const {
+    if (header == nullptr) {
+        return UINT32_MAX;
+    }
+    uint32_t mask = header->slotCount - 1;
+    for (uint32_t slot = kernels.hash(id, length) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        const ImageRecord& record = records[slots[slot] - 1];
+        if (record.idLength == length && kernels.keyEquals(strings + record.id, id, length)) {
+            return slots[slot] - 1;
+        }
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * Is a name a POSIX shared memory object ("/abcu-catalog") rather than
+ * a file path: one leading slash and no other
+ */
+bool isSharedMemoryName(const string& name) {
+    return name.size() > 1 && name[0] == '/' && name.find('/', 1) == string::npos;
+}
+
+/**
+ * Make an image available for other processes to map. A shared memory
+ * name gets a fresh object in place of any old one; processes already
+ * attached keep the pages they mapped. The object is filled before its
+ * magic is written, so a process attaching meanwhile sees no magic and
+ * is refused rather than mapping a half-copied image. Any other name is
+ * written as a file and renamed into place.
+ *
+ * @param image The image to publish
+ * @param name A shared memory name or a file path
+ * @return true if the image was published
+ */
+bool publishCatalogImage(const CatalogImage& image, string name) {
+#ifndef _WIN32
+    if (isSharedMemoryName(name)) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool published = false;
+        if (ftruncate(fd, image.Size()) == 0) {
+            void* region = mmap(nullptr, image.Size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (region != MAP_FAILED) {
+                char* target = static_cast<char*>(region);
+                size_t magicBytes = sizeof(CATALOG_IMAGE_MAGIC);
+                memcpy(target + magicBytes, image.Data() + magicBytes, image.Size() - magicBytes);
+                // the image is complete before anyone can see the magic
+                atomic_thread_fence(memory_order_release);
+                memcpy(target, image.Data(), magicBytes);
+                munmap(region, image.Size());
+                published = true;
+            }
+        }
+        close(fd);
+        if (!published) {
+            shm_unlink(name.c_str());
+        }
+        return published;
+    }
+#endif
+    string tempPath = name + ".tmp";
+    ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+    out.write(image.Data(), image.Size());
+    out.close();
+    if (out.fail() || rename(tempPath.c_str(), name.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A read-only shared mapping of a published image. Every process that
+ * attaches maps the same physical pages, and since the image holds only
+ * offsets it works wherever it lands in each address space.
+ */
+class SharedCatalog {
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    CatalogImage image;
+
+public:
+    SharedCatalog() { }
+    virtual ~SharedCatalog() { Detach(); }
+    bool Attach(string name);
+    void Detach();
+    const CatalogImage& Image() const { return image; }
+};
+
+/**
+ * Map a published image
+ *
+ * @param name The shared memory name or file path it was published to
+ * @return false if it is missing or not a catalog image
+ */
+bool SharedCatalog::Attach(string name) {
+    Detach();
+#ifndef _WIN32
+    int fd = isSharedMemoryName(name) ? shm_open(name.c_str(), O_RDONLY, 0) : open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* region = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return false;
+    }
+    // lookups hop between sections, so read ahead would be wasted
+    madvise(region, info.st_size, MADV_RANDOM);
+    data = static_cast<const char*>(region);
+    size = info.st_size;
+    if (!image.Attach(data, size)) {
+        Detach();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Unmap the image; views into it become invalid
+ */
+void SharedCatalog::Detach() {
+    image = CatalogImage();
+#ifndef _WIN32
+    if (data != nullptr) {
+        munmap((void*)data, size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+/**
+ * A course of an image, copied out for display
+ */
+Course imageCourse(const CatalogImage& image, uint32_t index) {
+    const ImageRecord& record = image.Record(index);
+    Course course;
+    course.courseId.assign(image.String(record.id), record.idLength);
+    course.courseTitle.assign(image.String(record.title), record.titleLength);
+    for (uint32_t i = 0; i < record.prereqCount; i++) {
+        const ImagePrereq& prereq = image.Prereq(record.prereqStart + i);
+        course.prerequisites.push_back(string(image.String(prereq.id), prereq.idLength));
+    }
+    return course;
+}
+
+//============================================================================
+// Metrics export
+//============================================================================
+
+/**
+ * Serves the metrics from a background thread: rewrites a file in
+ * Prometheus text format on an interval, answers GET /metrics on a
+ * loopback HTTP port, or both. The file is replaced by rename so a
+ * collector never reads it half written.
+ */
+class MetricsExporter {
+
+private:
+    string filePath;
+    double interval = 10.0;
+    int listenFd = -1;
+    thread worker;
+    atomic<bool> stopping;
+
+    void Run();
+    bool WriteFile();
+    void Serve(int client);
+
+public:
+    MetricsExporter() : stopping(false) { }
+    virtual ~MetricsExporter() { Stop(); }
+    bool Start(string path, double seconds, int port);
+    void Stop();
+};
+
+/**
+ * Start exporting
+ *
+ * @param path File to rewrite, or empty for none
+ * @param seconds Seconds between rewrites of the file
+ * @param port Loopback port to listen on, or 0 for none
+ * @return false if the port could not be opened
+ */
+bool MetricsExporter::Start(string path, double seconds, int port) {
+    filePath = path;
+    interval = max(seconds, 0.1);
+    if (port > 0) {
+#ifndef _WIN32
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+            std::cerr << "Could not listen on 127.0.0.1:" << port << ": " << strerror(errno) << std::endl;
+            if (listenFd >= 0) {
+                close(listenFd);
+            }
+            listenFd = -1;
+            return false;
+        }
+#else
+        std::cerr << "The metrics port is not supported on this platform" << std::endl;
+        return false;
+#endif
+    }
+    worker = thread(&MetricsExporter::Run, this);
+    return true;
+}
+
+/**
+ * Stop the thread, writing the file one last time
+ */
+void MetricsExporter::Stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+    stopping.store(true);
+    worker.join();
+    if (!filePath.empty()) {
+        WriteFile();
+    }
+#ifndef _WIN32
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+#endif
+}
+
+/**
+ * Replace the metrics file
+ *
+ * @return true if it was written
+ */
+bool MetricsExporter::WriteFile() {
+    string text;
+    metrics.Render(text);
+    string tmpPath = filePath + ".tmp";
+    ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+    out.write(text.data(), text.size());
+    out.close();
+    if (out.fail() || rename(tmpPath.c_str(), filePath.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Wait for scrapes, and rewrite the file whenever the interval is up
+ */
+void MetricsExporter::Run() {
+    chrono::steady_clock::time_point due = chrono::steady_clock::now();
+    while (!stopping.load()) {
+        if (!filePath.empty() && chrono::steady_clock::now() >= due) {
+            WriteFile();
+            due = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double>(interval));
+        }
+        // wake at least every 200 ms to notice Stop
+#ifndef _WIN32
+        if (listenFd >= 0) {
+            pollfd ready = { listenFd, POLLIN, 0 };
+            if (poll(&ready, 1, 200) > 0) {
+                int client = accept(listenFd, nullptr, nullptr);
+                if (client >= 0) {
+                    Serve(client);
+                }
+            }
+            continue;
+        }
+#endif
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+}
+
+/**
+ * Answer one HTTP request and close the connection
+ */
+void MetricsExporter::Serve(int client) {
+#ifndef _WIN32
+    // a stalled client must not hold up the file writer for long
+    timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+        ssize_t got = recv(client, buffer, sizeof(buffer), 0);
+        if (got <= 0) {
+            break;
+        }
+        request.append(buffer, got);
+    }
+    string status = "200 OK";
+    string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        metrics.Render(body);
+    }
+    else {
+        status = "404 Not Found";
+        body = "metrics are at /metrics\n";
+    }
+    string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+        + to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    for (size_t sent = 0; sent < response.size(); ) {
+        ssize_t wrote = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (wrote <= 0) {
+            break;
+        }
+        sent += wrote;
+    }
+    close(client);
+#endif
+}
+
+//============================================================================
+// Catalog server
+//============================================================================
+
+// connections a core accepts or wakes for per epoll_wait
+const int SERVER_EVENTS = 64;
+// reply bytes a connection may queue before its input is left unread
+const size_t SERVER_OUTPUT_LIMIT = 1 << 20;
+// replies a connection may queue behind an unfinished listing
+const size_t SERVER_PENDING_LIMIT = 1024;
+// longest request line accepted
+const size_t SERVER_LINE_LIMIT = 4096;
+// rows a listing may return and still be answered inline as cheap
+const size_t SERVER_EXPENSIVE_ROWS = 1024;
+// rows of an expensive listing produced between checks for new requests
+const uint32_t SERVER_SLICE_ROWS = 4096;
+
+/**
+ * Answers catalog queries over TCP from one thread per core. Every core
+ * has its own listening socket on the same port, bound with
+ * SO_REUSEPORT so the kernel spreads new connections across them, and
+ * its own epoll loop. A connection stays on the core that accepted it,
+ * and all cores read the same frozen CatalogImage, so serving a request
+ * takes no lock and touches no other core's data.
+ *
+ * The protocol is one request per line, each answered in order:
+ *   FIND id      OK followed by the course as a CSV row, or NOT_FOUND id
+ *   LIST prefix  one CSV row of ID and title per course whose ID starts
+ *                with prefix, in ID order, then END count
+ *   COUNT        OK and the number of courses
+ * Anything else gets ERROR and a reason.
+ *
+ * Each request's cost is estimated before it runs: one row for a lookup,
+ * the number of matching courses for a listing, found with two binary
+ * searches. Cheap requests are answered as soon as they are read.
+ * Expensive ones join the core's queue and run a slice at a time
+ * between rounds of cheap ones, so a large listing delays a lookup by
+ * one slice at most. Only a limited number of cores may be running
+ * expensive work at once. When the queue ahead of a new expensive
+ * request would take longer than the latency budget to drain, or a
+ * queued one has waited longer than that, it is answered with
+ *   BUSY retry-after-ms=N
+ * instead, N being the estimated time until the queue has room.
+ */
+class CatalogServer {
+
+private:
+    // a reply that may be finished after replies queued behind it
+    struct PendingReply {
+        string text;
+        bool ready = false;
+        // bytes of text counted in the connection's pendingBytes
+        size_t counted = 0;
+    };
+
+    // a client's unparsed input and unsent replies
+    struct Connection {
+        string input;
+        string output;
+        size_t sent = 0;
+        uint32_t events = 0; // epoll interest, set on accept
+        // replies after the first unfinished one, kept for ordering
+        deque<shared_ptr<PendingReply> > pending;
+        size_t pendingBytes = 0;
+    };
+
+    // an expensive listing waiting for or being given its slices
+    struct ListJob {
+        int fd = -1;
+        shared_ptr<PendingReply> reply;
+        uint32_t first = 0;
+        uint32_t next = 0;
+        uint32_t end = 0;
+        chrono::steady_clock::time_point queued;
+        bool started = false;
+    };
+
+    struct alignas(64) Core {
+        int listenFd = -1;
+        int epollFd = -1;
+        thread worker;
+        // only this core's thread touches the rest
+        unordered_map<int, Connection> connections;
+        deque<ListJob> jobs;
+        size_t queuedRows = 0;
+        double rowsPerSecond = 5e6; // refined as slices run
+        bool holdsSlot = false;
+    };
+
+    const CatalogImage* image = nullptr;
+    vector<Core*> cores;
+    int port = 0;
+    atomic<bool> stopping;
+    size_t expensiveRows = SERVER_EXPENSIVE_ROWS;
+    int expensiveLimit = 0;
+    double budget = 0.05;
+    atomic<int> expensiveRunning;
+
+    void Run(int core);
+    static bool Backlogged(const Connection& connection);
+    bool Pump(Core& core, int fd, Connection& connection);
+    void Handle(Core& core, int fd, Connection& connection, const char* line, size_t length);
+    bool RunSlice(Core& core);
+    void Finish(Core& core, int fd);
+    void PrefixRange(const char* prefix, size_t length, uint32_t& first, uint32_t& end) const;
+    void AppendRows(uint32_t first, uint32_t end, string& out) const;
+
+public:
+    CatalogServer() : stopping(false), expensiveRunning(0) { }
+    virtual ~CatalogServer() { Stop(); }
+    void SetAdmission(size_t rows, int limit, double seconds);
+    bool Start(const CatalogImage* catalog, string address, int port, int threads);
+    void Stop();
+    int Port() const { return port; }
+    int Cores() const { return cores.size(); }
+};
+
+/**
+ * Tune admission control, before Start
+ *
+ * @param rows Listings of more rows than this are expensive; SIZE_MAX
+ *        answers everything inline, without admission control
+ * @param limit Most cores running expensive work at once, 0 for a
+ *        quarter of the server threads
+ * @param seconds Queue latency budget for expensive requests
+ */
+void CatalogServer::SetAdmission(size_t rows, int limit, double seconds) {
+    expensiveRows = rows;
+    expensiveLimit = limit;
+    budget = seconds;
+}
+
+/**
+ * Open one listening socket per thread and start the threads
+ *
+ * @param catalog The image to serve; it must outlive the server
+ * @param address IPv4 address to listen on
+ * @param port Port to listen on, or 0 to pick a free one, see Port
+ * @param threads Event loop threads, pinned to cores 0 up to threads-1
+ * @return false if a socket could not be opened
+ */
+bool CatalogServer::Start(const CatalogImage* catalog, string address, int port, int threads) {
+#ifdef __linux__
+    image = catalog;
+    this->port = port;
+    stopping.store(false);
+    expensiveRunning.store(0);
+    if (expensiveLimit <= 0) {
+        expensiveLimit = max(1, threads / 4);
+    }
+    sockaddr_in bound;
+    memset(&bound, 0, sizeof(bound));
+    bound.sin_family = AF_INET;
+    if (inet_pton(AF_INET, address.c_str(), &bound.sin_addr) != 1) {
+        std::cerr << "Not an IPv4 address: " << address << std::endl;
+        return false;
+    }
+    for (int i = 0; i < threads; i++) {
+        Core* core = new Core();
+        cores.push_back(core);
+        core->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int on = 1;
+        setsockopt(core->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(core->listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        // after the first socket, the rest join whatever port it got
+        bound.sin_port = htons(this->port);
+        if (core->listenFd < 0 || ::bind(core->listenFd, (sockaddr*)&bound, sizeof(bound)) != 0
+            || listen(core->listenFd, 1024) != 0) {
+            std::cerr << "Could not listen on " << address << ":" << this->port << ": " << strerror(errno) << std::endl;
+            Stop();
+            return false;
+        }
+        if (this->port == 0) {
+            socklen_t length = sizeof(bound);
+            getsockname(core->listenFd, (sockaddr*)&bound, &length);
+            this->port = ntohs(bound.sin_port);
+        }
+        core->epollFd = epoll_create1(0);
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = core->listenFd;
+        epoll_ctl(core->epollFd, EPOLL_CTL_ADD, core->listenFd, &event);
+    }
+    for (int i = 0; i < threads; i++) {
+        cores[i]->worker = thread(&CatalogServer::Run, this, i);
+    }
+    return true;
+#else
+    std::cerr << "The catalog server is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+/**
+ * Stop every thread and close the sockets, dropping open connections
+ */
+void CatalogServer::Stop() {
+#ifdef __linux__
+    stopping.store(true);
+    for (size_t i = 0; i < cores.size(); i++) {
+        if (cores[i]->worker.joinable()) {
+            cores[i]->worker.join();
+        }
+        for (unordered_map<int, Connection>::iterator it = cores[i]->connections.begin();
+            it != cores[i]->connections.end(); ++it) {
+            close(it->first);
+        }
+        if (cores[i]->epollFd >= 0) {
+            close(cores[i]->epollFd);
+        }
+        if (cores[i]->listenFd >= 0) {
+            close(cores[i]->listenFd);
+        }
+        delete cores[i];
+    }
+#endif
+    cores.clear();
+}
+
+/**
+ * One core's event loop: accept from this core's socket, serve the
+ * connections it accepted and work through its expensive queue, until
+ * Stop
+ *
+ * @param core Index of the core, also the CPU the thread is pinned to
+ */
+void CatalogServer::Run(int core) {
+#ifdef __linux__
+    int cpus = thread::hardware_concurrency();
+    if (cpus > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    metrics.SetCore(core);
+    Core& self = *cores[core];
+    epoll_event events[SERVER_EVENTS];
+    // with expensive work queued, only check for requests between slices;
+    // while waiting for another core to free a slot, check every 1 ms
+    int timeout = 200;
+    while (!stopping.load(memory_order_relaxed)) {
+        int ready = epoll_wait(self.epollFd, events, SERVER_EVENTS, timeout);
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == self.listenFd) {
+                for (int client = accept4(self.listenFd, nullptr, nullptr, SOCK_NONBLOCK); client >= 0;
+                    client = accept4(self.listenFd, nullptr, nullptr, SOCK_NONBLOCK)) {
+                    int on = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    epoll_event event;
+                    memset(&event, 0, sizeof(event));
+                    event.events = EPOLLIN;
+                    event.data.fd = client;
+                    epoll_ctl(self.epollFd, EPOLL_CTL_ADD, client, &event);
+                    self.connections[client].events = EPOLLIN;
+                    metrics.Count(SERVER_CONNECTIONS);
+                }
+                continue;
+            }
+            unordered_map<int, Connection>::iterator found = self.connections.find(fd);
+            if (found == self.connections.end()) {
+                continue;
+            }
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) || !Pump(self, fd, found->second)) {
+                close(fd);
+                self.connections.erase(found);
+            }
+        }
+        timeout = self.jobs.empty() ? 200 : RunSlice(self) ? 0 : 1;
+    }
+    if (self.holdsSlot) {
+        expensiveRunning.fetch_sub(1);
+        self.holdsSlot = false;
+    }
+#endif
+}
+
+/**
+ * Whether a connection has as many replies waiting as it may, unsent or
+ * queued behind an unfinished listing
+ */
+bool CatalogServer::Backlogged(const Connection& connection) {
+    return connection.output.size() - connection.sent + connection.pendingBytes >= SERVER_OUTPUT_LIMIT
+        || connection.pending.size() >= SERVER_PENDING_LIMIT;
+}
+
+/**
+ * Read what a connection has sent, answer or queue its complete lines
+ * and send as many finished replies as the socket takes. Once it is
+ * backlogged, by a client that is not reading or by replies held behind
+ * a listing, its further requests stay unread until the backlog drains.
+ *
+ * @return false once the connection should be closed
+ */
+bool CatalogServer::Pump(Core& core, int fd, Connection& connection) {
+#ifdef __linux__
+    bool open = true;
+    char buffer[16384];
+    // bounds the time one busy client can hold its core per wakeup
+    for (int reads = 0; ; reads++) {
+        size_t start = 0;
+        for (size_t end = connection.input.find('\n'); end != string::npos && !Backlogged(connection);
+            end = connection.input.find('\n', start)) {
+            size_t queued = connection.pending.size();
+            Handle(core, fd, connection, connection.input.data() + start, end - start);
+            if (connection.pending.size() > queued) {
+                connection.pending.back()->counted = connection.pending.back()->text.size();
+                connection.pendingBytes += connection.pending.back()->counted;
+            }
+            start = end + 1;
+        }
+        connection.input.erase(0, start);
+        if (open && connection.input.size() > SERVER_LINE_LIMIT && connection.input.find('\n') == string::npos) {
+            Handle(core, fd, connection, nullptr, 0);
+            open = false;
+        }
+        // replies become sendable in request order
+        while (!connection.pending.empty() && connection.pending.front()->ready) {
+            connection.output += connection.pending.front()->text;
+            connection.pendingBytes -= connection.pending.front()->counted;
+            connection.pending.pop_front();
+        }
+
+        while (connection.sent < connection.output.size()) {
+            ssize_t wrote = send(fd, connection.output.data() + connection.sent,
+                connection.output.size() - connection.sent, MSG_NOSIGNAL);
+            if (wrote > 0) {
+                connection.sent += wrote;
+            }
+            else if (wrote < 0 && errno == EINTR) {
+                continue;
+            }
+            else if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            else {
+                return false;
+            }
+        }
+        if (connection.sent == connection.output.size()) {
+            connection.output.clear();
+            connection.sent = 0;
+        }
+        if (!connection.output.empty() || !open || Backlogged(connection)) {
+            break;
+        }
+        // requests held back by the output limit are answered first
+        if (connection.input.find('\n') != string::npos) {
+            continue;
+        }
+        if (reads >= 16) {
+            break;
+        }
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            connection.input.append(buffer, got);
+        }
+        else if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else if (got == 0 || errno != EINTR) {
+            // the lines already received are still answered
+            open = false;
+        }
+    }
+
+    // while replies are backed up, wait for room to send them and leave
+    // new requests in the socket; while they are held behind a listing,
+    // or after a hang up, wait for nothing, as Finish pumps again
+    bool writing = !connection.output.empty();
+    uint32_t events = writing ? uint32_t(EPOLLOUT) : open && !Backlogged(connection) ? uint32_t(EPOLLIN) : 0;
+    if (events != connection.events) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(core.epollFd, EPOLL_CTL_MOD, fd, &event);
+        connection.events = events;
+    }
+    // a client that hung up is kept until its queued listings are sent
+    return open || writing || !connection.pending.empty();
+#else
+    return false;
+#endif
+}
+
+/**
+ * Estimate a request's cost and answer it, queue it or turn it away
+ *
+ * @param line The request without its newline, or null for a request
+ *        line that was too long
+ */
+void CatalogServer::Handle(Core& core, int fd, Connection& connection, const char* line, size_t length) {
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    // behind an unfinished reply, even a cheap answer has to wait its turn
+    shared_ptr<PendingReply> later;
+    if (!connection.pending.empty()) {
+        later = make_shared<PendingReply>();
+        later->ready = true;
+        connection.pending.push_back(later);
+    }
+    string& out = later ? later->text : connection.output;
+    if (line == nullptr) {
+        out += "ERROR request line too long\n";
+        return;
+    }
+
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    const char* space = static_cast<const char*>(memchr(line, ' ', length));
+    size_t verbLength = space == nullptr ? length : size_t(space - line);
+    const char* argument = space == nullptr ? line + length : space + 1;
+    size_t argumentLength = line + length - argument;
+
+    if (verbLength == 4 && memcmp(line, "FIND", 4) == 0) {
+        uint32_t index = image->Find(argument, argumentLength);
+        if (index == UINT32_MAX) {
+            out += "NOT_FOUND ";
+            out.append(argument, argumentLength);
+            out += '\n';
+        }
+        else {
+            const ImageRecord& record = image->Record(index);
+            out += "OK ";
+            appendCsvField(out, image->String(record.id), record.idLength);
+            out += ',';
+            appendCsvField(out, image->String(record.title), record.titleLength);
+            for (uint32_t i = 0; i < record.prereqCount; i++) {
+                const ImagePrereq& prereq = image->Prereq(record.prereqStart + i);
+                out += ',';
+                appendCsvField(out, image->String(prereq.id), prereq.idLength);
+            }
+            out += '\n';
+        }
+    }
+    else if (verbLength == 4 && memcmp(line, "LIST", 4) == 0) {
+        uint32_t first, end;
+        PrefixRange(argument, argumentLength, first, end);
+        if (end - first > expensiveRows) {
+            // the wait ahead of this listing, at the rate slices have run
+            double wait = core.queuedRows / core.rowsPerSecond;
+            if (wait > budget) {
+                out += "BUSY retry-after-ms=" + to_string(llround(ceil((wait - budget) * 1000)) + 1) + "\n";
+                metrics.Count(SERVER_REJECTIONS);
+                return;
+            }
+            if (!later) {
+                later = make_shared<PendingReply>();
+                connection.pending.push_back(later);
+            }
+            later->ready = false;
+            ListJob job;
+            job.fd = fd;
+            job.reply = later;
+            job.first = job.next = first;
+            job.end = end;
+            job.queued = begin;
+            core.jobs.push_back(job);
+            core.queuedRows += end - first;
+            return;
+        }
+        AppendRows(first, end, out);
+        out += "END " + to_string(end - first) + "\n";
+    }
+    else if (verbLength == 5 && memcmp(line, "COUNT", 5) == 0) {
+        out += "OK " + to_string(image->Count()) + "\n";
+    }
+    else {
+        out += "ERROR unknown request, expected FIND, LIST or COUNT\n";
+    }
+    metrics.Count(SERVER_REQUESTS);
+    metrics.Observe(SERVER_SECONDS, nanosSince(begin));
+}
+
+/**
+ * Give the expensive listing at the front of the core's queue one slice
+ *
+ * @return false if it is waiting for another core to free a slot
+ */
+bool CatalogServer::RunSlice(Core& core) {
+    while (!core.jobs.empty()) {
+        ListJob& job = core.jobs.front();
+        int fd = job.fd;
+        // the connection closed and dropped its replies
+        if (job.reply.use_count() == 1) {
+            if (job.started) {
+                expensiveRunning.fetch_sub(1);
+                core.holdsSlot = false;
+            }
+            core.queuedRows -= job.end - job.next;
+            core.jobs.pop_front();
+            continue;
+        }
+        if (!job.started) {
+            double waited = chrono::duration<double>(chrono::steady_clock::now() - job.queued).count();
+            if (waited > budget) {
+                double wait = core.queuedRows / core.rowsPerSecond;
+                job.reply->text = "BUSY retry-after-ms=" + to_string(llround(ceil(wait * 1000)) + 1) + "\n";
+                job.reply->ready = true;
+                metrics.Count(SERVER_REJECTIONS);
+                core.queuedRows -= job.end - job.next;
+                core.jobs.pop_front();
+                Finish(core, fd);
+                continue;
+            }
+            if (!core.holdsSlot) {
+                int running = expensiveRunning.load();
+                do {
+                    if (running >= expensiveLimit) {
+                        return false;
+                    }
+                } while (!expensiveRunning.compare_exchange_weak(running, running + 1));
+                core.holdsSlot = true;
+            }
+            job.started = true;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        uint32_t stop = job.end - job.next > SERVER_SLICE_ROWS ? job.next + SERVER_SLICE_ROWS : job.end;
+        AppendRows(job.next, stop, job.reply->text);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds > 0) {
+            core.rowsPerSecond = 0.9 * core.rowsPerSecond + 0.1 * ((stop - job.next) / seconds);
+        }
+        core.queuedRows -= stop - job.next;
+        job.next = stop;
+        if (job.next == job.end) {
+            job.reply->text += "END " + to_string(job.end - job.first) + "\n";
+            job.reply->ready = true;
+            expensiveRunning.fetch_sub(1);
+            core.holdsSlot = false;
+            metrics.Count(SERVER_REQUESTS);
+            metrics.Observe(SERVER_EXPENSIVE_SECONDS, nanosSince(job.queued));
+            core.jobs.pop_front();
+            Finish(core, fd);
+        }
+        return true;
+    }
+    return true;
+}
+
+/**
+ * Send a connection the replies a finished listing has unblocked
+ */
+void CatalogServer::Finish(Core& core, int fd) {
+#ifdef __linux__
+    unordered_map<int, Connection>::iterator found = core.connections.find(fd);
+    if (found != core.connections.end() && !Pump(core, fd, found->second)) {
+        close(fd);
+        core.connections.erase(found);
+    }
+#endif
+}
+
+/**
+ * The run of courses whose IDs start with a prefix. Records are in ID
+ * order, so two binary searches find it without visiting the matches.
+ *
+ * @param first Receives the index of the first match
+ * @param end Receives the index after the last match
+ */
+void CatalogServer::PrefixRange(const char* prefix, size_t length, uint32_t& first, uint32_t& end) const {
+    // order of the record against the prefix, over the prefix's length
+    auto compare = [&](uint32_t index) {
+        const ImageRecord& record = image->Record(index);
+        int order = memcmp(image->String(record.id), prefix, min(size_t(record.idLength), length));
+        return order != 0 ? order : record.idLength < length ? -1 : 0;
+    };
+    uint32_t low = 0;
+    uint32_t high = image->Count();
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (compare(middle) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    first = low;
+    high = image->Count();
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (compare(middle) <= 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    end = low;
+}
+
+/**
+ * Append one CSV row of ID and title per course in a range
+ */
+void CatalogServer::AppendRows(uint32_t first, uint32_t end, string& out) const {
+    for (uint32_t i = first; i < end; i++) {
+        const ImageRecord& record = image->Record(i);
+        appendCsvField(out, image->String(record.id), record.idLength);
+        out += ',';
+        appendCsvField(out, image->String(record.title), record.titleLength);
+        out += '\n';
+    }
+}
+
+//============================================================================
+// Staged ingest pipeline
+//============================================================================
+
+/**
+ * Bounded single-producer, single-consumer ring. The producer alone
+ * advances tail and the consumer alone advances head, so each side
+ * needs only an acquire load of the other's index and a release store
+ * of its own: no locks and no compare-and-swap. A full ring is the
+ * backpressure: the producer waits until the consumer catches up.
+ */
+template <typename T>
+class SpscQueue {
+
+private:
+    vector<T> slots;
+    size_t mask;
+    // each index on its own cache line so the two sides do not collide
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+
+public:
+    SpscQueue(size_t capacity);
+    bool TryPush(T& item);
+    bool TryPop(T& item);
+    void Push(T& item, size_t& stalls);
+    void Pop(T& item, size_t& stalls);
+};
+
+/**
+ * Constructor
+ *
+ * @param capacity Items the ring holds, rounded up to a power of two
+ */
+template <typename T>
+SpscQueue<T>::SpscQueue(size_t capacity) : head(0), tail(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+/**
+ * Move an item in if there is room
+ */
+template <typename T>
+bool SpscQueue<T>::TryPush(T& item) {
+    size_t at = tail.load(memory_order_relaxed);
+    if (at - head.load(memory_order_acquire) > mask) {
+        return false;
+    }
+    slots[at & mask] = move(item);
+    tail.store(at + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Move the oldest item out if there is one
+ */
+template <typename T>
+bool SpscQueue<T>::TryPop(T& item) {
+    size_t at = head.load(memory_order_relaxed);
+    if (at == tail.load(memory_order_acquire)) {
+        return false;
+    }
+    item = move(slots[at & mask]);
+    head.store(at + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Push, yielding while the ring is full
+ *
+ * @param stalls Incremented for every wait, to show where the pipeline
+ *        backs up
+ */
+template <typename T>
+void SpscQueue<T>::Push(T& item, size_t& stalls) {
+    while (!TryPush(item)) {
+        stalls++;
+        this_thread::yield();
+    }
+}
+
+/**
+ * Pop, yielding while the ring is empty
+ */
+template <typename T>
+void SpscQueue<T>::Pop(T& item, size_t& stalls) {
+    while (!TryPop(item)) {
+        stalls++;
+        this_thread::yield();
+    }
+}
+
+// the largest number of line chunks buffered ahead of the parser
+const size_t INGEST_CHUNKS_AHEAD = 8;
+// courses per batch handed to the inserter, and batches buffered ahead
+const size_t INGEST_BATCH_COURSES = 1024;
+const size_t INGEST_BATCHES_AHEAD = 16;
+
+// whole CSV lines read from a file
+struct TextChunk {
+    string text;
+    bool last = false;
+};
+
+// parsed courses with their ID hashes, ready for InsertHashed
+struct CourseBatch {
+    vector<Course> courses;
+    vector<uint32_t> hashes;
+    bool last = false;
+};
+
+// waits at each queue, and how much went through
+struct IngestStats {
+    size_t readerStalls = 0;
+    size_t parserWaits = 0;
+    size_t parserStalls = 0;
+    size_t inserterWaits = 0;
+    size_t bytes = 0;
+    size_t rows = 0;
+    // how the reader stage read its files
+    bool ring = false;
+    size_t reads = 0;
+    int mostInFlight = 0;
+};
+
+/**
+ * Reader stage: push files as chunks of whole lines, each header line
+ * left out as csv::Parser leaves it out. A file's last line ends with
+ * the file, so no line runs on into the next file.
+ *
+ * @param ring false to read with pread rather than io_uring
+ * @return false if a file could not be opened or read
+ */
+bool readChunks(const vector<string>& csvPaths, SpscQueue<TextChunk>& chunks, IngestStats& stats, bool ring) {
+    BatchedReader reader(ring);
+    string carry;
+    bool header = true;
+    bool ok = reader.Read(csvPaths, [&](int, const char* block, size_t got) {
+        if (got == 0) {
+            // end of a file: flush its unterminated last line, if any
+            if (!header && !carry.empty()) {
+                TextChunk chunk;
+                chunk.text.swap(carry);
+                chunk.text.push_back('\n');
+                chunks.Push(chunk, stats.readerStalls);
+            }
+            carry.clear();
+            header = true;
+            return;
+        }
+        stats.bytes += got;
+        // a line cut by the block boundary waits for the next block
+        size_t cut = got;
+        while (cut > 0 && block[cut - 1] != '\n') {
+            cut--;
+        }
+        if (cut == 0) {
+            carry.append(block, got);
+            return;
+        }
+        TextChunk chunk;
+        chunk.text.swap(carry);
+        chunk.text.append(block, cut);
+        carry.assign(block + cut, got - cut);
+        if (header) {
+            chunk.text.erase(0, chunk.text.find('\n') + 1);
+            header = false;
+        }
+        chunks.Push(chunk, stats.readerStalls);
+    });
+    stats.ring = reader.Ring();
+    stats.reads = reader.Reads();
+    stats.mostInFlight = reader.MostInFlight();
+    TextChunk chunk;
+    chunk.last = true;
+    chunks.Push(chunk, stats.readerStalls);
+    return ok;
+}
+
+/**
+ * Parser stage: tokenize rows, build courses and hash their IDs
+ */
+void parseChunks(SpscQueue<TextChunk>& chunks, SpscQueue<CourseBatch>& batches, IngestStats& stats) {
+    TextChunk chunk;
+    CourseBatch batch;
+    vector<string> fields;
+    do {
+        chunks.Pop(chunk, stats.parserWaits);
+        const char* data = chunk.text.data();
+        size_t size = chunk.text.size();
+        for (size_t offset = 0; offset < size; ) {
+            offset = parseCsvRow(data, size, offset, fields);
+            if (fields[0].empty()) {
+                continue;
+            }
+            Course course;
+            course.courseId = fields[0];
+            course.courseTitle = fields.size() > 1 ? fields[1] : string();
+            course.prerequisites.assign(fields.begin() + min(fields.size(), size_t(2)), fields.end());
+            batch.hashes.push_back(kernels.hash(course.courseId.data(), course.courseId.size()));
+            batch.courses.push_back(move(course));
+            if (batch.courses.size() == INGEST_BATCH_COURSES) {
+                batches.Push(batch, stats.parserStalls);
+                batch = CourseBatch();
+            }
+        }
+    } while (!chunk.last);
+    batch.last = true;
+    batches.Push(batch, stats.parserStalls);
+}
+
+//============================================================================
+// Static methods used for testing
+//============================================================================
+
+/**
+ * Display the course information to the console (std::out)
+ *
+ * @param course struct containing the course info
+ */
+void displayCourse(Course course) {
+    // output key, courseID, courseTitle, and any prerequisites
+    cout << " " << course.courseId << ", " << course.courseTitle << endl;
+    cout << " Prerequisites: ";
+    for (size_t i = 0; i < course.prerequisites.size(); i++)
+    {
+        cout << course.prerequisites[i];
+        // If not the last item in the list, print comma
+        if ((i + 1) != course.prerequisites.size()) {
+            cout << ", ";
+        }
+    }
+    cout << endl;
+    return;
+}
+
+/**
+ * Convert a course ID or prefix typed by the user to upper case
+ *
+ * @param text The text as entered
+ * @return The upper-case text
+ */
+string upperCase(string text) {
+    kernels.changeCase(&text[0], text.size(), true);
+    return text;
+}
+
+/**
+ * Print every course whose ID starts with a prefix, in ID order
+ *
+ * @param ids The front-coded dictionary of the table's IDs, or null to
+ *            scan the table while the dictionary is being built
+ * @param hashTable The table holding the courses
+ * @param prefix The ID prefix, e.g. "CSCI3"
+ */
+void printCoursesByPrefix(const FrontCodedIds* ids, HashTable* hashTable, string prefix) {
+    vector<string> matches;
+    if (ids != nullptr) {
+        size_t first, last;
+        ids->PrefixRange(prefix, first, last);
+        ids->Decode(first, last, matches);
+    }
+    else {
+        hashTable->IdsWithPrefix(prefix, matches);
+    }
+    if (matches.empty()) {
+        cout << "No course IDs start with " << prefix << "." << endl;
+        return;
+    }
+    for (size_t i = 0; i < matches.size(); i++) {
+        Course course = hashTable->Search(matches[i]);
+        cout << " " << course.courseId << ", " << course.courseTitle << endl;
+    }
+}
+
+/**
+ * Heap and inline bytes used by a vector of plain ID strings
+ */
+size_t plainIdBytes(const vector<string>& ids) {
+    size_t bytes = sizeof(ids) + ids.capacity() * sizeof(string);
+    for (size_t i = 0; i < ids.size(); i++) {
+        // strings short enough for the inline buffer allocate nothing
+        if (ids[i].capacity() > string().capacity()) {
+            bytes += ids[i].capacity() + 1;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Compare the front-coded dictionary with a sorted vector of strings:
+ * memory used and the time for exact and prefix lookups of every ID.
+ *
+ * @param hashTable The loaded table to take IDs from
+ */
+void benchmarkIdDictionary(HashTable* hashTable) {
+    clock_t ticks;
+    vector<string> plain;
+    hashTable->SortedIds(plain);
+    FrontCodedIds coded;
+    coded.Build(plain);
+
+    // probe in a scattered order so neither side gets a warm walk
+    vector<string> probes = plain;
+    shuffle(probes.begin(), probes.end(), mt19937(42));
+
+    cout << plain.size() << " course IDs" << endl;
+    cout << "  plain strings: " << plainIdBytes(plain) << " bytes" << endl;
+    cout << "  front-coded:   " << coded.MemoryBytes() << " bytes" << endl;
+
+    size_t hits = 0;
+    ticks = clock();
+    for (size_t i = 0; i < probes.size(); i++) {
+        hits += binary_search(plain.begin(), plain.end(), probes[i]);
+    }
+    ticks = clock() - ticks;
+    cout << "  plain lookup:       " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << hits << " found)" << endl;
+
+    hits = 0;
+    ticks = clock();
+    for (size_t i = 0; i < probes.size(); i++) {
+        size_t rank;
+        hits += coded.Find(probes[i], rank);
+    }
+    ticks = clock() - ticks;
+    cout << "  front-coded lookup: " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << hits << " found)" << endl;
+}
+
+/**
+ * Compare the learned index with binary search over sorted IDs and
+ * with HashTable::Search, looking up every ID once.
+ *
+ * @param hashTable The loaded table to take IDs from
+ */
+void benchmarkLearnedIndex(HashTable* hashTable) {
+    clock_t ticks;
+    vector<string> plain;
+    hashTable->SortedIds(plain);
+    LearnedIndex learned;
+    ticks = clock();
+    learned.Build(plain);
+    ticks = clock() - ticks;
+
+    vector<string> probes = plain;
+    shuffle(probes.begin(), probes.end(), mt19937(42));
+
+    cout << plain.size() << " course IDs, " << learned.SegmentCount() << " segments ("
+        << learned.ModelBytes() << " bytes), built in "
+        << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+    size_t hits = 0;
+    ticks = clock();
+    for (size_t i = 0; i < probes.size(); i++) {
+        hits += binary_search(plain.begin(), plain.end(), probes[i]);
+    }
+    ticks = clock() - ticks;
+    cout << "  binary search:     " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << hits << " found)" << endl;
+
+    hits = 0;
+    ticks = clock();
+    for (size_t i = 0; i < probes.size(); i++) {
+        size_t rank;
+        hits += learned.Find(probes[i], rank);
+    }
+    ticks = clock() - ticks;
+    cout << "  learned index:     " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << hits << " found)" << endl;
+
+    hits = 0;
+    ticks = clock();
+    for (size_t i = 0; i < probes.size(); i++) {
+        hits += !hashTable->Search(probes[i]).courseId.empty();
+    }
+    ticks = clock() - ticks;
+    cout << "  HashTable::Search: " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << hits << " found)" << endl;
+}
+
+/**
+ * Time every kernel at every level this CPU supports on synthetic data,
+ * checking each result against the scalar version.
+ */
+void benchmarkKernels() {
+    clock_t ticks;
+    mt19937 random(42);
+    // CSV-like text with a newline near the end, and course-ID keys
+    string text(1 << 22, 'x');
+    for (size_t i = 0; i < text.size(); i++) {
+        text[i] = "abcdefghij,ABCDEFGHIJ 0123456789"[random() % 32];
+    }
+    text[text.size() - 7] = '\n';
+    vector<string> keys;
+    for (int i = 0; i < 200000; i++) {
+        keys.push_back("CSCI" + to_string(100 + i));
+    }
+    const size_t words = 1 << 16;
+    vector<uint64_t> a(words);
+    vector<uint64_t> b(words);
+    for (size_t i = 0; i < words; i++) {
+        a[i] = ((uint64_t)random() << 32) | random();
+        b[i] = a[i] | ((uint64_t)random() << 32);
+    }
+
+    Kernels scalar = kernelsFor(KERNELS_SCALAR);
+    uint32_t expectedSum = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        expectedSum += scalar.hash(keys[i].data(), keys[i].size());
+    }
+    KernelLevel best = detectKernelLevel();
+    for (int level = KERNELS_SCALAR; level <= best; level++) {
+        Kernels table = kernelsFor(KernelLevel(level));
+        bool agrees = true;
+        cout << table.name << ":" << endl;
+
+        uint32_t sum = 0;
+        ticks = clock();
+        for (int round = 0; round < 20; round++) {
+            for (size_t i = 0; i < keys.size(); i++) {
+                sum += table.hash(keys[i].data(), keys[i].size());
+            }
+        }
+        ticks = clock() - ticks;
+        agrees = agrees && sum == expectedSum * 20
+            && table.hash(text.data(), 1000) == scalar.hash(text.data(), 1000);
+        cout << "  hash:           " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+        size_t found = 0;
+        ticks = clock();
+        for (int round = 0; round < 50; round++) {
+            found += table.findByte(text.data(), text.size(), '\n');
+        }
+        ticks = clock() - ticks;
+        agrees = agrees && found == 50 * scalar.findByte(text.data(), text.size(), '\n');
+        cout << "  findByte:       " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+        size_t equal = 0;
+        ticks = clock();
+        for (int round = 0; round < 20; round++) {
+            for (size_t i = 1; i < keys.size(); i++) {
+                equal += table.keyEquals(keys[i].data(), keys[i - 1].data(), keys[i].size());
+            }
+        }
+        ticks = clock() - ticks;
+        agrees = agrees && equal == 0 && table.keyEquals(text.data(), text.data(), text.size());
+        cout << "  keyEquals:      " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+        string folded = text;
+        string expected = text;
+        scalar.changeCase(&expected[0], expected.size(), true);
+        ticks = clock();
+        for (int round = 0; round < 50; round++) {
+            table.changeCase(&folded[0], folded.size(), round % 2 == 0);
+        }
+        table.changeCase(&folded[0], folded.size(), true);
+        ticks = clock() - ticks;
+        agrees = agrees && folded == expected;
+        cout << "  changeCase:     " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+        vector<uint64_t> merged = a;
+        size_t bits = 0;
+        bool missing = false;
+        ticks = clock();
+        for (int round = 0; round < 500; round++) {
+            table.bitsetOr(merged.data(), b.data(), words);
+            bits += table.bitsetCount(merged.data(), words);
+            missing = missing || table.bitsetAndNotAny(b.data(), a.data(), words);
+        }
+        ticks = clock() - ticks;
+        agrees = agrees && bits == 500 * scalar.bitsetCount(b.data(), words)
+            && missing == scalar.bitsetAndNotAny(b.data(), a.data(), words);
+        cout << "  bitset ops:     " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds" << endl;
+
+        cout << "  matches scalar: " << (agrees ? "yes" : "NO") << endl;
+    }
+}
+
+/**
+ * Build the reachability index and time random prerequisite queries
+ * against it, checking a sample of answers with a plain search.
+ *
+ * @param hashTable The loaded table
+ */
+void benchmarkReachability(HashTable* hashTable) {
+    clock_t ticks;
+    CourseGraph graph;
+    graph.Build(hashTable);
+    ReachabilityIndex index;
+    ticks = clock();
+    index.Build(graph);
+    ticks = clock() - ticks;
+    cout << graph.Count() << " courses, " << graph.prereqs.size() << " prerequisite edges, "
+        << index.ComponentCount() << " components" << endl;
+    cout << "  built in " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds, "
+        << index.MemoryBytes() << " bytes" << endl;
+    if (graph.Count() == 0) {
+        return;
+    }
+
+    const int queries = 200000;
+    mt19937 random(42);
+    vector<pair<int, int>> pairs;
+    for (int i = 0; i < queries; i++) {
+        pairs.push_back(make_pair(random() % graph.Count(), random() % graph.Count()));
+    }
+    size_t yes = 0;
+    ticks = clock();
+    for (int i = 0; i < queries; i++) {
+        yes += index.IsPrerequisite(pairs[i].first, pairs[i].second);
+    }
+    ticks = clock() - ticks;
+    cout << "  " << queries << " queries in " << ticks * 1000 / CLOCKS_PER_SEC << " milliseconds ("
+        << double(ticks) * 1e6 / CLOCKS_PER_SEC / queries << " microseconds each, " << yes << " true)" << endl;
+
+    int mismatches = 0;
+    for (int i = 0; i < 1000; i++) {
+        if (index.IsPrerequisite(pairs[i].first, pairs[i].second)
+            != isPrerequisiteBySearch(graph, pairs[i].first, pairs[i].second)) {
+            mismatches++;
+        }
+    }
+    cout << "  " << mismatches << " mismatches against breadth-first search in 1000 checks" << endl;
+}
+
+/**
+ * Split a comma-separated list of course IDs typed by the user
+ *
+ * @param text The list as entered
+ * @return The upper-case IDs with surrounding spaces removed
+ */
+vector<string> splitCourseIds(string text) {
+    vector<string> courseIds;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == string::npos) {
+            comma = text.size();
+        }
+        string id = text.substr(start, comma - start);
+        id.erase(0, id.find_first_not_of(" \t"));
+        id.erase(id.find_last_not_of(" \t") + 1);
+        if (!id.empty()) {
+            courseIds.push_back(upperCase(id));
+        }
+        start = comma + 1;
+    }
+    return courseIds;
+}
+
+/**
+ * Display what the dependency tracker knows about a course
+ *
+ * @param tracker The tracker following the course table
+ * @param courseId The course to describe
+ */
+void printDependencies(DependencyTracker* tracker, string courseId) {
+    unsigned int level = tracker->Level(courseId);
+    if (level == NO_LEVEL && tracker->PrerequisiteCount(courseId) == 0) {
+        cout << "Course ID " << courseId << " not found." << endl;
+        return;
+    }
+    cout << " " << courseId << endl;
+    if (level == NO_LEVEL) {
+        cout << " Level: none, " << courseId << " is on a prerequisite cycle" << endl;
+    }
+    else {
+        cout << " Level: " << level << endl;
+    }
+    cout << " Requires " << tracker->PrerequisiteCount(courseId) << " courses in all" << endl;
+    cout << " Unlocks " << tracker->UnlockCount(courseId) << " courses in all" << endl;
+    vector<string> dependents;
+    tracker->Dependents(courseId, dependents);
+    cout << " Required directly by: ";
+    for (size_t i = 0; i < dependents.size(); i++) {
+        cout << dependents[i];
+        if ((i + 1) != dependents.size()) {
+            cout << ", ";
+        }
+    }
+    cout << endl;
+}
+
+/**
+ * Load a CSV file containing courses into a container
+ *
+ * @param csvPath the path to the CSV file to load
+ * @return a container holding all the courses read
+ */
+void loadCourses(string csvPath, HashTable* hashTable) {
+    cout << "Loading CSV file " << csvPath << endl;
+
+    // initialize the CSV Parser using the given path
+    csv::Parser file = csv::Parser(csvPath);
+
+    try {
+        // loop to read rows of a CSV file
+        for (unsigned int i = 0; i < file.rowCount(); i++) {
+
+            // Create a data structure and add to the collection of courses
+            Course course;
+            course.courseId = file[i][0];
+            course.courseTitle = file[i][1];
+
+            // checks for prerequisistes and adds them
+            for (int j = 2; j < file[i].size(); j++) {
+                course.prerequisites.push_back (file[i][j]);
+            }
+
+            // push this course to the end
+            hashTable->Insert(course);
+        }
+    } catch (csv::Error &e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+/**
+ * Index a CSV file of courses without parsing it. Only the course ID
+ * of each row is read; the row's byte offset is kept so the title and
+ * prerequisites can be parsed on first lookup. The offsets are saved
+ * to a sidecar index so an unchanged CSV is not rescanned next time;
+ * the table itself is still rebuilt, one node per row.
+ *
+ * @param csvPath the path to the CSV file to load
+ * @param hashTable the table receiving the lazy courses
+ */
+void loadCoursesLazy(string csvPath, HashTable* hashTable) {
+    cout << "Loading CSV file " << csvPath << " (lazy)" << endl;
+
+    MappedFile* file = new MappedFile();
+    if (!file->Open(csvPath)) {
+        std::cerr << "Failed to open " << csvPath << std::endl;
+        delete file;
+        return;
+    }
+    const char* data = file->Data();
+    size_t size = file->Size();
+    string idxPath = offsetIndexPath(csvPath);
+    vector<OffsetIndexEntry> entries;
+
+    if (readOffsetIndex(idxPath, *file, entries)) {
+        cout << "Using offset index " << idxPath << endl;
+    }
+    else {
+        // first line is the header, the same as csv::Parser treats it
+        size_t offset = findLineEnd(data, size, 0);
+        offset = offset < size ? offset + 1 : size;
+
+        // loop to index rows of the mapped file
+        OffsetIndexEntry entry;
+        while (offset < size) {
+            size_t end = findLineEnd(data, size, offset);
+            // course ID is the first field, read as parseCsvRow reads it
+            parseCsvField(data, offset, csvRowLast(data, offset, end), entry.courseId);
+            if (!entry.courseId.empty()) {
+                entry.offset = offset;
+                entries.push_back(entry);
+            }
+            offset = end < size ? end + 1 : size;
+        }
+
+        // a read-only directory just means the next start rescans
+        if (!writeOffsetIndex(idxPath, *file, entries)) {
+            std::cerr << "Could not write offset index " << idxPath << std::endl;
+        }
+    }
+
+    unsigned int source = hashTable->AddSource(file);
+    hashTable->Reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        hashTable->InsertLazy(entries[i].courseId, source, entries[i].offset);
+    }
+}
+
+/**
+ * The CSV files a load path names: the path itself, or every .csv
+ * file in it, in name order, if it is a directory of department files
+ *
+ * @param path A CSV file or a directory
+ * @return The files to load
+ */
+vector<string> csvFilesAt(string path) {
+    vector<string> files;
+#ifndef _WIN32
+    DIR* directory = opendir(path.c_str());
+    if (directory != nullptr) {
+        for (dirent* entry = readdir(directory); entry != nullptr; entry = readdir(directory)) {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".csv") == 0) {
+                files.push_back(path + "/" + name);
+            }
+        }
+        closedir(directory);
+        sort(files.begin(), files.end());
+        return files;
+    }
+#endif
+    files.push_back(path);
+    return files;
+}
+
+/**
+ * Load CSV files with reading, parsing and inserting overlapped on
+ * separate threads. The reader and parser run ahead of the table
+ * through bounded queues, so whichever stage is slowest sets the pace
+ * and the others wait rather than buffer the whole input. The reader
+ * keeps many reads in flight across the files, see BatchedReader.
+ *
+ * @param csvPaths the CSV files to load, in order
+ * @param hashTable the table receiving the courses
+ * @param ring false to read with pread rather than io_uring
+ */
+void loadCoursesPipelined(vector<string> csvPaths, HashTable* hashTable, bool ring = true) {
+    if (csvPaths.size() == 1) {
+        cout << "Loading CSV file " << csvPaths[0] << " (pipelined)" << endl;
+    }
+    else {
+        cout << "Loading " << csvPaths.size() << " CSV files (pipelined)" << endl;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SpscQueue<TextChunk> chunks(INGEST_CHUNKS_AHEAD);
+    SpscQueue<CourseBatch> batches(INGEST_BATCHES_AHEAD);
+    IngestStats stats;
+    bool opened = true;
+    thread reader([&]() { opened = readChunks(csvPaths, chunks, stats, ring); });
+    thread parser([&]() { parseChunks(chunks, batches, stats); });
+
+    // the inserter stage runs here, the only thread touching the table
+    CourseBatch batch;
+    do {
+        batches.Pop(batch, stats.inserterWaits);
+        for (size_t i = 0; i < batch.courses.size(); i++) {
+            hashTable->InsertHashed(move(batch.courses[i]), batch.hashes[i]);
+        }
+        stats.rows += batch.courses.size();
+    } while (!batch.last);
+    reader.join();
+    parser.join();
+    if (!opened) {
+        // rows read before the failure stay loaded, as with loadCourses
+        std::cerr << "Failed to read a CSV file after " << stats.rows << " rows" << std::endl;
+        return;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Loaded " << stats.rows << " rows (" << stats.bytes << " bytes) in " << llround(seconds * 1000)
+        << " milliseconds" << endl;
+    cout << " " << stats.reads << " reads with " << (stats.ring ? "io_uring" : "pread") << ", up to "
+        << stats.mostInFlight << " in flight" << endl;
+    cout << " Waits for input: parser " << stats.parserWaits << ", inserter " << stats.inserterWaits
+        << "; waits on a full queue: reader " << stats.readerStalls << ", parser " << stats.parserStalls << endl;
+}
+
+/**
+ * Time the sequential loader against the pipelined one, reading with
+ * io_uring and with pread, and check that all build the same table
+ *
+ * @param csvPath The CSV, or directory of CSVs, to load
+ */
+void benchmarkIngest(string csvPath) {
+    vector<string> csvPaths = csvFilesAt(csvPath);
+    HashTable* sequential = new HashTable();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < csvPaths.size(); i++) {
+        loadCourses(csvPaths[i], sequential);
+    }
+    double sequentialSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    vector<Course> expected;
+    sequential->Sort(expected);
+    delete sequential;
+    cout << "Sequential load: " << llround(sequentialSeconds * 1000) << " milliseconds" << endl;
+
+    for (int ring = 1; ring >= 0; ring--) {
+        HashTable* pipelined = new HashTable();
+        start = chrono::steady_clock::now();
+        loadCoursesPipelined(csvPaths, pipelined, ring == 1);
+        double pipelinedSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        vector<Course> actual;
+        pipelined->Sort(actual);
+        bool same = expected.size() == actual.size();
+        for (size_t i = 0; same && i < expected.size(); i++) {
+            same = expected[i].courseId == actual[i].courseId && expected[i].courseTitle == actual[i].courseTitle
+                && expected[i].prerequisites == actual[i].prerequisites;
+        }
+        cout << "Pipelined load" << (ring == 1 ? "" : " without io_uring") << ": " << llround(pipelinedSeconds * 1000)
+            << " milliseconds on " << thread::hardware_concurrency() << " hardware threads" << endl;
+        cout << (same ? "Same courses as the sequential load" : "The loads differ") << endl;
+        delete pipelined;
+    }
+}
+
+/**
+ * One load-test connection: send batches of pipelined requests until
+ * the deadline, recording each batch's round trip
+ *
+ * @param port Loopback port of the server
+ * @param ids IDs to look up with FIND
+ * @param heavy A request to send instead of lookups, or empty
+ * @param depth Requests per batch
+ * @param deadline When to stop
+ * @param seed Seed for picking IDs
+ * @param roundTrips Receives the round trip of every batch in nanoseconds
+ * @param busy Incremented for every BUSY reply
+ * @return Requests answered
+ */
+uint64_t loadTestConnection(int port, const vector<string>& ids, string heavy, int depth,
+    chrono::steady_clock::time_point deadline, unsigned seed, vector<uint64_t>& roundTrips, uint64_t& busy) {
+    uint64_t answered = 0;
+#ifdef __linux__
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    mt19937 random(seed);
+    string batch;
+    string line;
+    char buffer[65536];
+    while (chrono::steady_clock::now() < deadline) {
+        batch.clear();
+        for (int i = 0; i < depth; i++) {
+            batch += heavy.empty() ? "FIND " + ids[random() % ids.size()] + "\n" : heavy + "\n";
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) != ssize_t(batch.size())) {
+            break;
+        }
+        // a listing's reply ends with its END line
+        int replies = 0;
+        long long retryAfter = 0;
+        while (replies < depth) {
+            ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+            if (got <= 0) {
+                close(fd);
+                return answered;
+            }
+            for (ssize_t i = 0; i < got; i++) {
+                if (buffer[i] != '\n') {
+                    if (line.size() < 40) {
+                        line.push_back(buffer[i]);
+                    }
+                    continue;
+                }
+                bool rejected = line.compare(0, 5, "BUSY ") == 0;
+                if (rejected) {
+                    size_t equals = line.find('=');
+                    retryAfter = max(retryAfter, equals == string::npos ? 0 : atoll(line.c_str() + equals + 1));
+                }
+                busy += rejected;
+                replies += heavy.empty() || rejected || line.compare(0, 4, "END ") == 0;
+                line.clear();
+            }
+        }
+        roundTrips.push_back(nanosSince(start));
+        answered += depth;
+        // a well-behaved client backs off as long as the server asked
+        this_thread::sleep_for(chrono::milliseconds(retryAfter));
+    }
+    close(fd);
+#endif
+    return answered;
+}
+
+/**
+ * Measure how the server scales with cores: serve the CSV over loopback
+ * with 1, 2, 4 ... threads up to the hardware threads, and load each
+ * setup with two pipelining connections per server thread. Then load
+ * the most threads with lookups and whole-catalog listings at once,
+ * with and without admission control, to compare lookup latency under
+ * overload.
+ *
+ * @param csvPath The CSV to serve
+ */
+void benchmarkServer(string csvPath) {
+    HashTable* hashTable = new HashTable();
+    loadCourses(csvPath, hashTable);
+    CatalogImage image;
+    vector<string> ids;
+    hashTable->SortedIds(ids);
+    if (ids.empty() || !image.Build(hashTable)) {
+        cout << "Nothing to serve" << endl;
+        delete hashTable;
+        return;
+    }
+    delete hashTable;
+
+    const int depth = 16;
+    const double seconds = 2.0;
+    int most = max(1, int(thread::hardware_concurrency()));
+    // server threads, and whether listing clients join in with or
+    // without admission control
+    vector<int> runThreads;
+    vector<bool> runOverload, runAdmission;
+    for (int threads = 1; ; threads = min(threads * 2, most)) {
+        runThreads.push_back(threads);
+        runOverload.push_back(false);
+        runAdmission.push_back(true);
+        if (threads == most) {
+            break;
+        }
+    }
+    for (int admission = 0; admission <= 1; admission++) {
+        runThreads.push_back(most);
+        runOverload.push_back(true);
+        runAdmission.push_back(admission == 1);
+    }
+
+    for (size_t run = 0; run < runThreads.size(); run++) {
+        int threads = runThreads[run];
+        bool overload = runOverload[run];
+        bool admission = runAdmission[run];
+        CatalogServer server;
+        server.SetAdmission(admission ? SERVER_EXPENSIVE_ROWS : SIZE_MAX, 0, 0.05);
+        if (!server.Start(&image, "127.0.0.1", 0, threads)) {
+            return;
+        }
+        map<int, uint64_t> before, after;
+        metrics.CoreCounts(SERVER_REQUESTS, before);
+        int lookups = threads * 2;
+        int connections = lookups + (overload ? 2 : 0);
+        vector<vector<uint64_t> > roundTrips(connections);
+        vector<uint64_t> answered(connections, 0);
+        vector<uint64_t> busy(connections, 0);
+        vector<thread> clients;
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::now()
+            + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+        for (int c = 0; c < connections; c++) {
+            clients.push_back(thread([&, c]() {
+                answered[c] = loadTestConnection(server.Port(), ids, c < lookups ? string() : string("LIST"),
+                    c < lookups ? depth : 4, deadline, c + 1, roundTrips[c], busy[c]);
+            }));
+        }
+        vector<uint64_t> all;
+        uint64_t total = 0;
+        uint64_t listings = 0;
+        uint64_t rejected = 0;
+        for (int c = 0; c < connections; c++) {
+            clients[c].join();
+            if (c < lookups) {
+                total += answered[c];
+                all.insert(all.end(), roundTrips[c].begin(), roundTrips[c].end());
+            }
+            else {
+                listings += answered[c] - busy[c];
+                rejected += busy[c];
+            }
+        }
+        server.Stop();
+        metrics.CoreCounts(SERVER_REQUESTS, after);
+        sort(all.begin(), all.end());
+        uint64_t p50 = all.empty() ? 0 : all[all.size() / 2];
+        uint64_t p99 = all.empty() ? 0 : all[min(all.size() - 1, all.size() * 99 / 100)];
+        if (overload) {
+            cout << "With listings, admission control " << (admission ? "on" : "off") << ": ";
+        }
+        cout << threads << (threads == 1 ? " core: " : " cores: ") << llround(total / seconds) << " lookups/s, batch of "
+            << depth << " round trip p50 " << p50 / 1000 << " us, p99 " << p99 / 1000 << " us" << endl;
+        if (overload) {
+            cout << " Listings: " << listings << " answered, " << rejected << " turned away as BUSY" << endl;
+        }
+        cout << " Requests per core:";
+        for (int i = 0; i < threads; i++) {
+            cout << " " << after[i] - before[i];
+        }
+        cout << endl;
+    }
+}
+
+/**
+ * Simple C function to convert a string to a double
+ * after stripping out unwanted char
+ *
+ * credit: http://stackoverflow.com/a/24875936
+ *
+ * @param ch The character to strip out
+ */
+double strToDouble(string str, char ch) {
+    str.erase(remove(str.begin(), str.end(), ch), str.end());
+    return atof(str.c_str());
+}
+
+/**
+ * Parse a byte count with an optional K, M or G suffix
+ *
+ * @param text The count, e.g. "64M"
+ * @param bytes Receives the number of bytes
+ * @return false unless text is digits and at most one suffix letter
+ */
+bool parseByteSize(string text, size_t& bytes) {
+    if (text.empty() || !isdigit((unsigned char)text[0])) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+    int shift = 0;
+    switch (toupper((unsigned char)*end)) {
+    case '\0':
+        break;
+    case 'G':
+        shift = 30;
+        break;
+    case 'M':
+        shift = 20;
+        break;
+    case 'K':
+        shift = 10;
+        break;
+    default:
+        return false;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return false;
+    }
+    if (value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    bytes = size_t(value) << shift;
+    return true;
+}
+
+/**
+ * Parse a whole number within a range
+ *
+ * @param text The number, e.g. "20"
+ * @param lowest The smallest value accepted
+ * @param highest The largest value accepted
+ * @param value Receives the number
+ * @return false unless text is only digits and the number is in range
+ */
+bool parseCount(string text, size_t lowest, size_t highest, size_t& value) {
+    if (text.empty() || text.find_first_not_of("0123456789") != string::npos) {
+        return false;
+    }
+    errno = 0;
+    unsigned long long number = strtoull(text.c_str(), nullptr, 10);
+    if (errno == ERANGE || number < lowest || number > highest) {
+        return false;
+    }
+    value = size_t(number);
+    return true;
+}
+
+/**
+ * Parse a non-negative decimal number
+ *
+ * @param text The number, e.g. "2.5"
+ * @param value Receives the number
+ * @return false unless text is digits with at most one decimal point
+ */
+bool parseDecimal(string text, double& value) {
+    if (text.empty() || text.find_first_not_of("0123456789.") != string::npos
+        || text.find('.') != text.rfind('.') || text == ".") {
+        return false;
+    }
+    value = strtod(text.c_str(), nullptr);
+    return isfinite(value);
+}
+
+/**
+ * Load a CSV file of courses without any console output, for callers
+ * embedding the catalog
+ *
+ * @param csvPath the path to the CSV file to load
+ * @param hashTable the table receiving the courses
+ * @return false if the file could not be read
+ */
+bool loadCoursesQuietly(string csvPath, HashTable* hashTable) {
+    MappedFile file;
+    if (!file.Open(csvPath)) {
+        return false;
+    }
+    const char* data = file.Data();
+    size_t size = file.Size();
+    // first line is the header, the same as csv::Parser treats it
+    size_t offset = findLineEnd(data, size, 0);
+    offset = offset < size ? offset + 1 : size;
+    vector<string> fields;
+    while (offset < size) {
+        offset = parseCsvRow(data, size, offset, fields);
+        if (fields[0].empty()) {
+            continue;
+        }
+        Course course;
+        course.courseId = fields[0];
+        course.courseTitle = fields.size() > 1 ? fields[1] : string();
+        course.prerequisites.assign(fields.begin() + min(fields.size(), size_t(2)), fields.end());
+        hashTable->Insert(course);
     }
-    cout << endl;
-    return;
+    return true;
 }
 
+//============================================================================
+// C interface (abcu_catalog.h)
+//============================================================================
+
+struct abcu_catalog {
+    // built by abcu_catalog_open
+    CatalogImage image;
+    // mapped by abcu_catalog_attach
+    SharedCatalog shared;
+    // whichever of the two is in use
+    const CatalogImage* view = &image;
+};
+
+namespace {
+
+// kernels are normally picked in main, which a library never runs
+once_flag kernelsSelected;
+
 /**
- * Load a CSV file containing courses into a container
- *
- * @param csvPath the path to the CSV file to load
- * @return a container holding all the courses read
+ * Fill in the caller's view of one record
  */
-void loadCourses(string csvPath, HashTable* hashTable) {
-    cout << "Loading CSV file " << csvPath << endl;
+void viewCourse(const CatalogImage& image, uint32_t index, abcu_course* course) {
+    const ImageRecord& record = image.Record(index);
+    course->index = index;
+    course->prerequisite_count = record.prereqCount;
+    course->id.data = image.String(record.id);
+    course->id.length = record.idLength;
+    course->title.data = image.String(record.title);
+    course->title.length = record.titleLength;
+}
 
-    // initialize the CSV Parser using the given path
-    csv::Parser file = csv::Parser(csvPath);
+}
+
+extern "C" {
 
+int abcu_catalog_open(const char* csv_path, abcu_catalog** catalog) {
+    if (csv_path == nullptr || catalog == nullptr) {
+        return ABCU_ERROR_ARGUMENT;
+    }
+    *catalog = nullptr;
+    call_once(kernelsSelected, []() { selectKernels(string()); });
+    // no C++ exception may cross into the caller
     try {
-        // loop to read rows of a CSV file
-        for (unsigned int i = 0; i < file.rowCount(); i++) {
+        HashTable table;
+        if (!loadCoursesQuietly(csv_path, &table)) {
+            return ABCU_ERROR_IO;
+        }
+        abcu_catalog* opened = new abcu_catalog();
+        if (!opened->image.Build(&table)) {
+            delete opened;
+            return ABCU_ERROR_MEMORY;
+        }
+        *catalog = opened;
+        return ABCU_OK;
+    }
+    catch (const bad_alloc&) {
+        return ABCU_ERROR_MEMORY;
+    }
+    catch (...) {
+        return ABCU_ERROR_FORMAT;
+    }
+}
 
-            // Create a data structure and add to the collection of courses
-            Course course;
-            course.courseId = file[i][0];
-            course.courseTitle = file[i][1];
+int abcu_catalog_attach(const char* name, abcu_catalog** catalog) {
+    if (name == nullptr || catalog == nullptr) {
+        return ABCU_ERROR_ARGUMENT;
+    }
+    *catalog = nullptr;
+    call_once(kernelsSelected, []() { selectKernels(string()); });
+    try {
+        abcu_catalog* attached = new abcu_catalog();
+        if (!attached->shared.Attach(name)) {
+            delete attached;
+            return ABCU_ERROR_IO;
+        }
+        attached->view = &attached->shared.Image();
+        *catalog = attached;
+        return ABCU_OK;
+    }
+    catch (const bad_alloc&) {
+        return ABCU_ERROR_MEMORY;
+    }
+}
 
-            // checks for prerequisistes and adds them
-            for (int j = 2; j < file[i].size(); j++) {
-                course.prerequisites.push_back (file[i][j]);
-            }
+void abcu_catalog_close(abcu_catalog* catalog) {
+    delete catalog;
+}
 
-            // push this course to the end
-            hashTable->Insert(course);
+size_t abcu_catalog_count(const abcu_catalog* catalog) {
+    return catalog == nullptr ? 0 : catalog->view->Count();
+}
+
+int abcu_catalog_at(const abcu_catalog* catalog, size_t index, abcu_course* course) {
+    if (catalog == nullptr || course == nullptr) {
+        return ABCU_ERROR_ARGUMENT;
+    }
+    if (index >= catalog->view->Count()) {
+        return ABCU_NOT_FOUND;
+    }
+    viewCourse(*catalog->view, index, course);
+    return ABCU_OK;
+}
+
+int abcu_catalog_find(const abcu_catalog* catalog, const char* id, size_t id_length, abcu_course* course) {
+    if (catalog == nullptr || course == nullptr || (id == nullptr && id_length > 0)) {
+        return ABCU_ERROR_ARGUMENT;
+    }
+    uint32_t index = catalog->view->Find(id, id_length);
+    if (index == UINT32_MAX) {
+        return ABCU_NOT_FOUND;
+    }
+    viewCourse(*catalog->view, index, course);
+    return ABCU_OK;
+}
+
+size_t abcu_catalog_find_batch(const abcu_catalog* catalog, const abcu_str* ids, size_t count,
+    abcu_course* courses) {
+    if (catalog == nullptr || ids == nullptr || courses == nullptr) {
+        return 0;
+    }
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        // an ID with no data is reported missing like an unknown one
+        bool usable = ids[i].data != nullptr || ids[i].length == 0;
+        uint32_t index = usable ? catalog->view->Find(ids[i].data, ids[i].length) : UINT32_MAX;
+        if (index == UINT32_MAX) {
+            courses[i].index = ABCU_NO_COURSE;
+            courses[i].prerequisite_count = 0;
+            courses[i].id.data = "";
+            courses[i].id.length = 0;
+            courses[i].title = courses[i].id;
+            continue;
         }
-    } catch (csv::Error &e) {
-        std::cerr << e.what() << std::endl;
+        viewCourse(*catalog->view, index, &courses[i]);
+        found++;
     }
+    return found;
+}
+
+int abcu_catalog_prerequisite(const abcu_catalog* catalog, uint32_t course_index, uint32_t position,
+    abcu_prerequisite* prerequisite) {
+    if (catalog == nullptr || prerequisite == nullptr) {
+        return ABCU_ERROR_ARGUMENT;
+    }
+    if (course_index >= catalog->view->Count() || position >= catalog->view->Record(course_index).prereqCount) {
+        return ABCU_NOT_FOUND;
+    }
+    const ImagePrereq& prereq = catalog->view->Prereq(catalog->view->Record(course_index).prereqStart + position);
+    prerequisite->course = prereq.course;
+    prerequisite->id.data = catalog->view->String(prereq.id);
+    prerequisite->id.length = prereq.idLength;
+    return ABCU_OK;
 }
 
-/**
- * Simple C function to convert a string to a double
- * after stripping out unwanted char
- *
- * credit: http://stackoverflow.com/a/24875936
- *
- * @param ch The character to strip out
- */
-double strToDouble(string str, char ch) {
-    str.erase(remove(str.begin(), str.end(), ch), str.end());
-    return atof(str.c_str());
 }
 
+#ifndef ABCU_LIBRARY
+
 /**
  * The one and only main() method
  */
 int main(int argc, char* argv[]) {
 
+    // pull --option=value arguments out ahead of the positional ones
+    size_t bodyBudget = 0;
+    bool compressTitles = false;
+    string bench;
+    string kernelLevel;
+    string snapshotPath;
+    bool diff = false;
+    size_t rankLimit = 0;
+    // numeric options are parsed into this before narrowing
+    size_t number = 0;
+    string prerequisiteQuery;
+    string transcriptsPath;
+    string auditReportPath;
+    string whatIf;
+    string metricsPath;
+    double metricsInterval = 10.0;
+    int metricsPort = 0;
+    string walPath;
+    size_t walCheckpointEvery = 1000;
+    string publishName;
+    string attachName;
+    bool pipeline = false;
+    bool naturalOrder = false;
+    string similarQuery;
+    string serveSpec;
+    int servePort = 0;
+    int serveThreads = 0;
+    int serveExpensive = 0;
+    double serveBudget = 0.05;
+    vector<char*> positional;
+    positional.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, 14, "--body-budget=") == 0) {
+            if (!parseByteSize(arg.substr(14), bodyBudget)) {
+                std::cerr << "Invalid --body-budget " << arg.substr(14)
+                    << ", expected a number with an optional K, M or G suffix" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--compress-titles") {
+            compressTitles = true;
+        }
+        else if (arg.compare(0, 10, "--kernels=") == 0) {
+            kernelLevel = arg.substr(10);
+            if (kernelLevel != "scalar" && kernelLevel != "avx2" && kernelLevel != "avx512") {
+                std::cerr << "Unknown --kernels " << kernelLevel << ", expected scalar, avx2 or avx512" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 16, "--save-snapshot=") == 0) {
+            snapshotPath = arg.substr(16);
+        }
+        else if (arg == "--diff") {
+            diff = true;
+        }
+        else if (arg.compare(0, 12, "--is-prereq=") == 0) {
+            prerequisiteQuery = arg.substr(12);
+        }
+        else if (arg.compare(0, 7, "--rank=") == 0) {
+            if (!parseCount(arg.substr(7), 1, SIZE_MAX, rankLimit)) {
+                std::cerr << "Invalid --rank " << arg.substr(7) << ", expected a positive count" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 8, "--audit=") == 0) {
+            transcriptsPath = arg.substr(8);
+        }
+        else if (arg.compare(0, 15, "--audit-report=") == 0) {
+            auditReportPath = arg.substr(15);
+        }
+        else if (arg.compare(0, 10, "--what-if=") == 0) {
+            whatIf = upperCase(arg.substr(10));
+        }
+        else if (arg.compare(0, 15, "--metrics-file=") == 0) {
+            metricsPath = arg.substr(15);
+        }
+        else if (arg.compare(0, 19, "--metrics-interval=") == 0) {
+            if (!parseDecimal(arg.substr(19), metricsInterval) || metricsInterval <= 0) {
+                std::cerr << "Invalid --metrics-interval " << arg.substr(19) << ", expected a positive number of seconds"
+                    << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 15, "--metrics-port=") == 0) {
+            if (!parseCount(arg.substr(15), 1, 65535, number)) {
+                std::cerr << "Invalid --metrics-port " << arg.substr(15) << ", expected a port from 1 to 65535"
+                    << std::endl;
+                return 1;
+            }
+            metricsPort = int(number);
+        }
+        else if (arg.compare(0, 6, "--wal=") == 0) {
+            walPath = arg.substr(6);
+        }
+        else if (arg.compare(0, 17, "--wal-checkpoint=") == 0) {
+            if (!parseCount(arg.substr(17), 1, SIZE_MAX, walCheckpointEvery)) {
+                std::cerr << "Invalid --wal-checkpoint " << arg.substr(17) << ", expected a positive count of changes"
+                    << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 10, "--publish=") == 0) {
+            publishName = arg.substr(10);
+        }
+        else if (arg.compare(0, 9, "--attach=") == 0) {
+            attachName = arg.substr(9);
+        }
+        else if (arg.compare(0, 10, "--similar=") == 0) {
+            similarQuery = upperCase(arg.substr(10));
+        }
+        else if (arg.compare(0, 8, "--serve=") == 0) {
+            serveSpec = arg.substr(8);
+            size_t colon = serveSpec.rfind(':');
+            string port = colon == string::npos ? serveSpec : serveSpec.substr(colon + 1);
+            if (!parseCount(port, 0, 65535, number)) {
+                std::cerr << "Invalid --serve port " << port << ", expected a port from 0 to 65535" << std::endl;
+                return 1;
+            }
+            servePort = int(number);
+        }
+        else if (arg.compare(0, 16, "--serve-threads=") == 0) {
+            if (!parseCount(arg.substr(16), 1, INT_MAX, number)) {
+                std::cerr << "Invalid --serve-threads " << arg.substr(16) << ", expected a positive count" << std::endl;
+                return 1;
+            }
+            serveThreads = int(number);
+        }
+        else if (arg.compare(0, 18, "--serve-expensive=") == 0) {
+            if (!parseCount(arg.substr(18), 0, INT_MAX, number)) {
+                std::cerr << "Invalid --serve-expensive " << arg.substr(18)
+                    << ", expected a count of cores, 0 for a quarter of the threads" << std::endl;
+                return 1;
+            }
+            serveExpensive = int(number);
+        }
+        else if (arg.compare(0, 18, "--serve-budget-ms=") == 0) {
+            if (!parseDecimal(arg.substr(18), serveBudget)) {
+                std::cerr << "Invalid --serve-budget-ms " << arg.substr(18) << ", expected a number of milliseconds"
+                    << std::endl;
+                return 1;
+            }
+            serveBudget /= 1000;
+        }
+        else if (arg == "--pipeline") {
+            pipeline = true;
+        }
+        else if (arg == "--natural-order") {
+            naturalOrder = true;
+        }
+        else if (arg.compare(0, 8, "--bench=") == 0) {
+            bench = arg.substr(8);
+        }
+        else {
+            positional.push_back(argv[i]);
+        }
+    }
+    argc = positional.size();
+    argv = positional.data();
+
+    // bind the vectorized kernels before anything hashes or scans
+    if (!selectKernels(kernelLevel)) {
+        std::cerr << "Unknown ABCU_KERNELS " << getenv("ABCU_KERNELS") << ", expected scalar, avx2 or avx512" << std::endl;
+        return 1;
+    }
+
     // process command line arguments
     string csvPath, courseKey;
     switch (argc) {
@@ -439,21 +10214,259 @@ int main(int argc, char* argv[]) {
         courseKey = "";
     }
 
-    // For upper-case conversion
-    string tempStr;
+    // Course IDs collected after each load
+    vector<string> ids;
+    // Courses found by a title search
+    vector<Course> matches;
+    // Tagged catalog versions, followed once the first is tagged
+    CatalogVersions* versions = nullptr;
+    string versionLabel;
+    // Dependency tracker, or null if the catalog is too large for one
+    DependencyTracker* tracker = nullptr;
+    // Prefix, similar-course, dependency and natural-order indexes,
+    // built after each load and kept current by each change
+    SecondaryIndexes indexes;
 
     // Define a hash table to hold all the courses
     HashTable* courseTable;
 
     Course course;
     courseTable = new HashTable();
-    
+    // cap the memory lazily loaded course bodies may use
+    courseTable->SetBodyBudget(bodyBudget);
+
+    // compare the two catalog versions named on the command line
+    if (diff) {
+        return diffCatalogs(csvPath, courseKey) ? 0 : 1;
+    }
+
+    // save the CSV given on the command line as a snapshot
+    if (!snapshotPath.empty()) {
+        loadCourses(csvPath, courseTable);
+        if (!saveSnapshot(courseTable, snapshotPath)) {
+            cout << "Could not write " << snapshotPath << endl;
+            return 1;
+        }
+        cout << "Saved snapshot " << snapshotPath << endl;
+        return 0;
+    }
+
+    // rank the courses of the CSV given on the command line
+    if (rankLimit > 0) {
+        loadCourses(csvPath, courseTable);
+        rankUnlocks(courseTable, rankLimit);
+        return 0;
+    }
+
+    // answer one "is A a prerequisite of B" query given as A,B
+    if (!prerequisiteQuery.empty()) {
+        size_t comma = prerequisiteQuery.find(',');
+        string first = upperCase(prerequisiteQuery.substr(0, comma));
+        string second = comma == string::npos ? string() : upperCase(prerequisiteQuery.substr(comma + 1));
+        loadCourses(csvPath, courseTable);
+        CourseGraph graph;
+        graph.Build(courseTable);
+        ReachabilityIndex index;
+        index.Build(graph);
+        bool required = index.IsPrerequisite(graph.IndexOf(first), graph.IndexOf(second));
+        cout << first << (required ? " is" : " is not") << " a prerequisite of " << second << endl;
+        return 0;
+    }
+
+    // list the courses most like the one given
+    if (!similarQuery.empty()) {
+        loadCourses(csvPath, courseTable);
+        SimilarCourses similar;
+        similar.Build(courseTable);
+        printSimilarCourses(similar, similarQuery);
+        return 0;
+    }
+
+    // lay the CSV out as an image other processes can map
+    if (!publishName.empty()) {
+        loadCourses(csvPath, courseTable);
+        CatalogImage image;
+        if (!image.Build(courseTable) || !publishCatalogImage(image, publishName)) {
+            cout << "Could not publish " << publishName << endl;
+            return 1;
+        }
+        cout << "Published " << image.Count() << " courses (" << image.Size() << " bytes) to "
+            << publishName << endl;
+        return 0;
+    }
+
+    // look up course IDs read from input in a published image
+    if (!attachName.empty() && serveSpec.empty()) {
+        SharedCatalog shared;
+        if (!shared.Attach(attachName)) {
+            cout << "Could not attach " << attachName << endl;
+            return 1;
+        }
+        const CatalogImage& image = shared.Image();
+        cout << "Attached " << image.Count() << " courses (" << image.Size() << " bytes) from "
+            << attachName << endl;
+        while (getline(cin, courseKey)) {
+            courseKey = upperCase(courseKey);
+            uint32_t index = image.Find(courseKey.data(), courseKey.size());
+            if (index == UINT32_MAX) {
+                cout << "Course ID " << courseKey << " not found." << endl;
+            }
+            else {
+                displayCourse(imageCourse(image, index));
+            }
+        }
+        return 0;
+    }
+
+    // simulate retiring or renumbering courses, counting students from
+    // the --audit transcripts when given
+    if (!whatIf.empty()) {
+        loadCourses(csvPath, courseTable);
+        return simulateChanges(courseTable, whatIf, transcriptsPath) ? 0 : 1;
+    }
+
+    // audit a transcripts CSV against the catalog on the command line
+    if (!transcriptsPath.empty()) {
+        loadCourses(csvPath, courseTable);
+        return auditTranscripts(courseTable, transcriptsPath, auditReportPath) ? 0 : 1;
+    }
+
+    // benchmarks load the CSV given on the command line and exit
+    if (bench == "kernels") {
+        benchmarkKernels();
+        return 0;
+    }
+    if (bench == "ingest") {
+        benchmarkIngest(csvPath);
+        return 0;
+    }
+    if (bench == "serve") {
+        benchmarkServer(csvPath);
+        return 0;
+    }
+    if (bench == "wal") {
+        benchmarkWriteAheadLog(csvPath.empty() ? string("bench.wal") : csvPath);
+        return 0;
+    }
+    if (!bench.empty()) {
+        loadCourses(csvPath, courseTable);
+        if (bench == "ids") {
+            benchmarkIdDictionary(courseTable);
+        }
+        else if (bench == "learned") {
+            benchmarkLearnedIndex(courseTable);
+        }
+        else if (bench == "reach") {
+            benchmarkReachability(courseTable);
+        }
+        else if (bench == "similar") {
+            benchmarkSimilarCourses(courseTable);
+        }
+        else {
+            cout << "Unknown benchmark " << bench << "." << endl;
+        }
+        return 0;
+    }
+
+    // export metrics while the menu runs, if asked to
+    MetricsExporter exporter;
+    if (!metricsPath.empty() || metricsPort > 0) {
+        metricsEnabled = true;
+        courseTable->PublishMetrics();
+        if (!exporter.Start(metricsPath, metricsInterval, metricsPort)) {
+            return 1;
+        }
+    }
+
+    // serve the CSV, or an attached image, until interrupted
+    if (!serveSpec.empty()) {
+#ifdef __linux__
+        size_t colon = serveSpec.rfind(':');
+        string address = colon == string::npos ? string("127.0.0.1") : serveSpec.substr(0, colon);
+        int threads = serveThreads > 0 ? serveThreads : max(1, int(thread::hardware_concurrency()));
+        SharedCatalog shared;
+        CatalogImage built;
+        const CatalogImage* image = &built;
+        if (!attachName.empty()) {
+            if (!shared.Attach(attachName)) {
+                cout << "Could not attach " << attachName << endl;
+                return 1;
+            }
+            image = &shared.Image();
+        }
+        else {
+            loadCourses(csvPath, courseTable);
+            if (!built.Build(courseTable)) {
+                cout << "Could not build the catalog image" << endl;
+                return 1;
+            }
+        }
+        // only this thread takes the signals, via sigwait below
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        CatalogServer server;
+        server.SetAdmission(SERVER_EXPENSIVE_ROWS, serveExpensive, serveBudget);
+        if (!server.Start(image, address, servePort, threads)) {
+            return 1;
+        }
+        cout << "Serving " << image->Count() << " courses on " << address << ":" << server.Port() << " with "
+            << threads << " threads" << endl;
+        int received;
+        sigwait(&signals, &received);
+        server.Stop();
+        exporter.Stop();
+        map<int, uint64_t> requests;
+        metrics.CoreCounts(SERVER_REQUESTS, requests);
+        cout << "Requests per core:";
+        for (map<int, uint64_t>::iterator it = requests.begin(); it != requests.end(); ++it) {
+            cout << " " << it->second;
+        }
+        cout << endl;
+        return 0;
+#else
+        cout << "The catalog server is not supported on this platform" << endl;
+        return 1;
+#endif
+    }
+
+    // recover from the checkpoint and log, then log every change
+    WriteAheadLog wal;
+    bool walEnabled = !walPath.empty();
+    if (walEnabled) {
+        size_t replayed;
+        if (!wal.Open(walPath, courseTable, replayed)) {
+            return 1;
+        }
+        courseTable->AddListener(&wal);
+        courseTable->SortedIds(ids);
+        cout << "Recovered " << ids.size() << " courses after replaying " << replayed << " logged changes" << endl;
+        // courses recovered from the log are indexed like loaded ones
+        indexes.Refresh(courseTable, true);
+    }
+    // edits from the menu are applied to the indexes as they happen
+    courseTable->AddListener(&indexes);
+
     cout << "Welcome to the course planner." << endl;
     int choice = 0;
     while (choice != 9) {
         cout << "\n  1. Load Data Structure." << endl;
         cout << "  2. Print Course List." << endl;
         cout << "  3. Print Course." << endl;
+        cout << "  4. Load Data Structure (lazy)." << endl;
+        cout << "  5. Print Courses by Prefix." << endl;
+        cout << "  6. Search Course Titles." << endl;
+        cout << "  7. Export Course List." << endl;
+        cout << "  8. Print Course List by Title." << endl;
+        cout << " 10. Add or Update Course." << endl;
+        cout << " 11. Remove Course." << endl;
+        cout << " 12. Print Course Dependencies." << endl;
+        cout << " 13. Tag Catalog Version." << endl;
+        cout << " 14. Print Course from Version." << endl;
+        cout << " 15. Print Similar Courses." << endl;
+        cout << " 16. Print Index Status." << endl;
         cout << "  9. Exit\n" << endl;
         cout << "What would you like to do? ";
         cin >> choice;
@@ -467,13 +10480,36 @@ int main(int argc, char* argv[]) {
             getline(cin, csvPath);
 
             // Complete the method call to load the courses
-            loadCourses(csvPath, courseTable);
+            // a bulk load goes into a checkpoint, not the log row by row
+            wal.SetLogging(false);
+            courseTable->BeginBulkLoad();
+            if (pipeline) {
+                loadCoursesPipelined(csvFilesAt(csvPath), courseTable);
+            }
+            else {
+                loadCourses(csvPath, courseTable);
+            }
+            courseTable->EndBulkLoad();
+            wal.SetLogging(true);
+            if (walEnabled) {
+                wal.Checkpoint(courseTable);
+            }
+            if (compressTitles) {
+                courseTable->CompressTitles();
+            }
+            // lookups are ready now, the other indexes follow
+            indexes.Refresh(courseTable, true);
             break;
 
         case 2:
             // Complete the method call to print all courses
             cout << "Here is a sample schedule:\n" << endl;
-            courseTable->PrintAll();
+            if (naturalOrder) {
+                printCoursesInNaturalOrder(*indexes.Natural(courseTable), courseTable);
+            }
+            else {
+                courseTable->PrintAll();
+            }
             break;
 
         case 3:
@@ -483,16 +10519,7 @@ int main(int argc, char* argv[]) {
             getline(cin, courseKey);
 
             // Make sure course ID is in upper-case format
-            tempStr = "";
-            for (int c = 0; c < courseKey.size(); c++) {
-                if (islower(courseKey[c])) {
-                    tempStr.push_back(toupper(courseKey[c]));
-                }
-                else {
-                    tempStr.push_back(courseKey[c]);
-                }
-            }
-            courseKey = tempStr;
+            courseKey = upperCase(courseKey);
 
             // Complete the method call to search for course
             course = courseTable->Search(courseKey);
@@ -505,6 +10532,179 @@ int main(int argc, char* argv[]) {
             }
             break;
 
+        case 4:
+            // Get csv path from user
+            cout << "Enter name of CSV file to load: ";
+            cin.ignore();
+            getline(cin, csvPath);
+
+            // Index course IDs only, rows are parsed on first lookup
+            // a bulk load goes into a checkpoint, not the log row by row
+            wal.SetLogging(false);
+            courseTable->BeginBulkLoad();
+            loadCoursesLazy(csvPath, courseTable);
+            courseTable->EndBulkLoad();
+            wal.SetLogging(true);
+            if (walEnabled) {
+                wal.Checkpoint(courseTable);
+            }
+            if (compressTitles) {
+                courseTable->CompressTitles();
+            }
+            // copying bodies would parse every row the lazy load put off
+            indexes.Refresh(courseTable, false);
+            break;
+
+        case 5:
+            // Prompts input for the start of the course IDs to list
+            cout << "What course ID prefix do you want to list? ";
+            cin.ignore();
+            getline(cin, courseKey);
+            printCoursesByPrefix(indexes.Prefix().get(), courseTable, upperCase(courseKey));
+            break;
+
+        case 6:
+            // Prompts input for part of a title
+            cout << "What title text do you want to find? ";
+            cin.ignore();
+            getline(cin, courseKey);
+            courseTable->SearchTitles(courseKey, matches);
+            for (size_t i = 0; i < matches.size(); i++) {
+                cout << " " << matches[i].courseId << ", " << matches[i].courseTitle << endl;
+            }
+            if (matches.empty()) {
+                cout << "No course titles contain " << courseKey << "." << endl;
+            }
+            break;
+
+        case 7:
+            // Get export path from user
+            cout << "Enter name of CSV file to write: ";
+            cin.ignore();
+            getline(cin, csvPath);
+            cout << "Sort by title instead of course ID? (y/n) ";
+            getline(cin, courseKey);
+            if (courseTable->ExportCsv(csvPath, upperCase(courseKey) == "Y" ? BY_TITLE : BY_ID)) {
+                cout << "Exported courses to " << csvPath << endl;
+            }
+            else {
+                cout << "Could not write " << csvPath << endl;
+            }
+            break;
+
+        case 8:
+            // Same listing, ordered by title
+            cout << "Here is a sample schedule:\n" << endl;
+            courseTable->PrintAll(BY_TITLE);
+            break;
+
+        case 10:
+            // Prompts input for every field of the course
+            cout << "Enter course ID: ";
+            cin.ignore();
+            getline(cin, courseKey);
+            course = Course();
+            course.courseId = upperCase(courseKey);
+            cout << "Enter course title: ";
+            getline(cin, course.courseTitle);
+            cout << "Enter prerequisites separated by commas: ";
+            getline(cin, courseKey);
+            course.prerequisites = splitCourseIds(courseKey);
+            if (!courseTable->Update(course)) {
+                cout << "Could not save " << course.courseId << endl;
+                break;
+            }
+            indexes.CatchUp(courseTable);
+            cout << "Saved " << course.courseId << endl;
+            break;
+
+        case 11:
+            // Prompts input for ID to remove
+            cout << "What course do you want to remove? ";
+            cin.ignore();
+            getline(cin, courseKey);
+            courseKey = upperCase(courseKey);
+            if (courseTable->Remove(courseKey)) {
+                indexes.CatchUp(courseTable);
+                cout << "Removed " << courseKey << endl;
+            }
+            else if (!courseTable->Search(courseKey).courseId.empty()) {
+                cout << "Could not remove " << courseKey << endl;
+            }
+            else {
+                cout << "Course ID " << courseKey << " not found." << endl;
+            }
+            break;
+
+        case 12:
+            // From its first use the tracker follows each edit itself
+            cout << "What course do you want to know about? ";
+            cin.ignore();
+            getline(cin, courseKey);
+            courseKey = upperCase(courseKey);
+            if (indexes.Building(DEPENDENCY_INDEX)) {
+                cout << "Waiting for the dependency index..." << endl;
+            }
+            tracker = indexes.Tracker(courseTable);
+            if (tracker == nullptr) {
+                cout << "The catalog is too large to track dependencies; use --is-prereq=A,B to ask about one pair"
+                    << endl;
+                break;
+            }
+            printDependencies(tracker, courseKey);
+            break;
+
+        case 13:
+            // Versions are followed from the first tag on
+            if (versions == nullptr) {
+                versions = new CatalogVersions();
+                versions->Start(courseTable);
+                courseTable->AddListener(versions);
+            }
+            cout << "Label for this version: ";
+            cin.ignore();
+            getline(cin, courseKey);
+            if (!versions->Tag(courseKey)) {
+                cout << "Version " << courseKey << " already exists." << endl;
+            }
+            versions->PrintVersions();
+            break;
+
+        case 14:
+            // Prompts input for version label and course ID
+            cout << "Which version? ";
+            cin.ignore();
+            getline(cin, versionLabel);
+            cout << "What course do you want to know about? ";
+            getline(cin, courseKey);
+            courseKey = upperCase(courseKey);
+            if (versions == nullptr || versions->Version(versionLabel) == nullptr) {
+                cout << "Version " << versionLabel << " not found." << endl;
+            }
+            else if (versions->Version(versionLabel)->Find(courseKey) == nullptr) {
+                cout << "Course ID " << courseKey << " not in version " << versionLabel << "." << endl;
+            }
+            else {
+                displayCourse(*versions->Version(versionLabel)->Find(courseKey));
+            }
+            break;
+
+        case 15:
+            // Prompts input for ID to find courses like
+            cout << "What course do you want similar courses for? ";
+            cin.ignore();
+            getline(cin, courseKey);
+            if (indexes.Building(SIMILAR_INDEX)) {
+                cout << "Waiting for the similar course index..." << endl;
+            }
+            printSimilarCourses(*indexes.Similar(courseTable), upperCase(courseKey));
+            break;
+
+        case 16:
+            // Indexes still building are answered by a scan or waited for
+            indexes.PrintStatus();
+            break;
+
         case 9:
             // Exit
             cout << "Thank you for using the course planner!" << endl;
@@ -514,6 +10714,18 @@ int main(int argc, char* argv[]) {
             // Invalid entry error message
             cout << choice << " is not a valid option." << endl;
         }
+
+        // gauges are taken here, on the thread that owns the table
+        if (metricsEnabled) {
+            courseTable->PublishMetrics();
+        }
+        // between commands the table holds exactly what was logged
+        if (walEnabled && (wal.SinceCheckpoint() >= walCheckpointEvery || (choice == 9 && wal.SinceCheckpoint() > 0))) {
+            wal.Checkpoint(courseTable);
+        }
     }
+    exporter.Stop();
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // ABCU_LIBRARY
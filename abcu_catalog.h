@@ -0,0 +1,152 @@
+/*
+ * abcu_catalog.h
+ *
+ * C interface to the course catalog engine in HashTable.cpp, for
+ * callers in other languages. Build the shared library with main left
+ * out, for example:
+ *
+ *     g++ -std=c++17 -O2 -pthread -fPIC -shared -fvisibility=hidden \
+ *         -DABCU_LIBRARY HashTable.cpp -o libabcu_catalog.so
+ *
+ * An open catalog is a single flat, read-only image: courses sorted by
+ * ID, a hash index over them, and one pool holding every string. The
+ * strings handed back are borrowed views into that pool, not copies.
+ * They stay valid until abcu_catalog_close is called on the catalog
+ * they came from and must not be written or freed by the caller. Each
+ * view is also NUL terminated, so it can be used as a C string.
+ *
+ * An open catalog is never modified, so any number of threads may query
+ * it at once without locking.
+ */
+
+#ifndef ABCU_CATALOG_H
+#define ABCU_CATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  ifdef ABCU_LIBRARY
+#    define ABCU_API __declspec(dllexport)
+#  else
+#    define ABCU_API __declspec(dllimport)
+#  endif
+#else
+#  define ABCU_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* status codes returned by the functions below */
+#define ABCU_OK 0
+#define ABCU_NOT_FOUND 1
+#define ABCU_ERROR_IO 2
+#define ABCU_ERROR_FORMAT 3
+#define ABCU_ERROR_MEMORY 4
+#define ABCU_ERROR_ARGUMENT 5
+
+/* index of a course that is not in the catalog */
+#define ABCU_NO_COURSE UINT32_MAX
+
+typedef struct abcu_catalog abcu_catalog;
+
+/* a borrowed, NUL terminated string; length excludes the NUL */
+typedef struct abcu_str {
+    const char* data;
+    size_t length;
+} abcu_str;
+
+/* one course; index is its position in course ID order */
+typedef struct abcu_course {
+    uint32_t index;
+    uint32_t prerequisite_count;
+    abcu_str id;
+    abcu_str title;
+} abcu_course;
+
+/* one prerequisite; course is ABCU_NO_COURSE if it names no course */
+typedef struct abcu_prerequisite {
+    uint32_t course;
+    abcu_str id;
+} abcu_prerequisite;
+
+/**
+ * Load a courses CSV and build its image
+ *
+ * @param csv_path Path of the CSV; the first line is a header
+ * @param catalog Receives the catalog, to be closed by the caller
+ * @return ABCU_OK, ABCU_ERROR_IO or ABCU_ERROR_MEMORY
+ */
+ABCU_API int abcu_catalog_open(const char* csv_path, abcu_catalog** catalog);
+
+/**
+ * Map a catalog image another process published with --publish. A name
+ * with one leading slash and no other ("/abcu-catalog") is a POSIX
+ * shared memory object; anything else is a file path. Every process
+ * attached to the same image shares its physical pages. Every offset
+ * in the image is checked once here, so a damaged image is refused
+ * rather than read out of bounds.
+ *
+ * @param name Where the image was published
+ * @param catalog Receives the catalog, to be closed by the caller
+ * @return ABCU_OK, ABCU_ERROR_IO if it is missing or not a valid
+ *         catalog image, or ABCU_ERROR_MEMORY
+ */
+ABCU_API int abcu_catalog_attach(const char* name, abcu_catalog** catalog);
+
+/**
+ * Free a catalog, or unmap an attached one. Every view it handed out
+ * becomes invalid.
+ */
+ABCU_API void abcu_catalog_close(abcu_catalog* catalog);
+
+/**
+ * Number of courses in the catalog
+ */
+ABCU_API size_t abcu_catalog_count(const abcu_catalog* catalog);
+
+/**
+ * Course at a position in course ID order, for iterating sorted
+ *
+ * @return ABCU_OK, or ABCU_NOT_FOUND past the last course
+ */
+ABCU_API int abcu_catalog_at(const abcu_catalog* catalog, size_t index, abcu_course* course);
+
+/**
+ * Look up a course by ID. The ID need not be NUL terminated.
+ *
+ * @return ABCU_OK or ABCU_NOT_FOUND
+ */
+ABCU_API int abcu_catalog_find(const abcu_catalog* catalog, const char* id, size_t id_length,
+    abcu_course* course);
+
+/**
+ * Look up many course IDs in one call. A missing course gets index
+ * ABCU_NO_COURSE and empty strings, as does an entry whose data is
+ * NULL with a nonzero length. The IDs need not be NUL terminated.
+ *
+ * @param ids The IDs to look up
+ * @param count Number of IDs and of entries in courses
+ * @param courses Receives one course per ID
+ * @return Number of IDs found
+ */
+ABCU_API size_t abcu_catalog_find_batch(const abcu_catalog* catalog, const abcu_str* ids, size_t count,
+    abcu_course* courses);
+
+/**
+ * One of a course's prerequisites, in the order the catalog lists them
+ *
+ * @param course_index The course's index
+ * @param position Which prerequisite, below its prerequisite_count
+ * @return ABCU_OK, or ABCU_NOT_FOUND if either index is out of range
+ */
+ABCU_API int abcu_catalog_prerequisite(const abcu_catalog* catalog, uint32_t course_index, uint32_t position,
+    abcu_prerequisite* prerequisite);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ABCU_CATALOG_H */